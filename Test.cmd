@@ -14,11 +14,58 @@
 @set c=TimeMem TestSetAlloc 20000000 pop_hit 1 hit 1 miss 1
 %c% boost::unordered_set
 %c% spp::sparse_hash_set
+%c% spp_mmap
 %c% unordered
 %c% btree
+%c% scan 1 btree_sweep
+%c% scan 1 align 64 btree_sweep
+%c% rank 1 btree_counted
+%c% rank 1 bit_vector
+%c% mt 4 btree
+%c% mt 4 olc_btree
+%c% image 1 btree
+%c% batch 16 btree
+%c% btree_slab
+%c% btree_slab_huge
 %c% sparse
+%c% threads 4 sparse
+%c% batch 16 sparse
+%c% sparse_mmap
+%c% sparse_arena
 %c% dense
+%c% threads 4 dense
+%c% batch 16 dense
+%c% image 1 dense
+%c% dense_linear
+%c% dense_robin_hood
+%c% dense_mmap
+%c% dense_mmap_huge
+%c% hash identity dense
+%c% hash multiply_shift dense
+%c% hash murmur3 dense
+%c% hash xxh3 dense
+%c% hash crc32c dense
+%c% shift 16 hash multiply_shift dense
+%c% shift 16 hash murmur3 dense
+%c% shift 16 hash xxh3 dense
+%c% shift 16 hash crc32c dense
+%c% shift 16 hash xxh3 sparse
+%c% shift 16 hash xxh3 closed
+%c% load_sweep 10 dense
+%c% load_sweep 10 reserve 20000000 dense
+%c% load_sweep 10 sparse
+%c% load_sweep 10 closed
+%c% load_sweep 10 reserve 20000000 closed
+%c% load_sweep 10 spp::sparse_hash_set
+%c% load_sweep 25 unordered
+%c% compact 1000 dense
+%c% compact 1000 dense_robin_hood
+%c% compact 1000 sparse
+%c% erase 50 compact 1000 sparse
+%c% latency 1 dense
+%c% latency 1 incremental 2 dense
 %c% closed
+%c% batch 16 closed
 %c% forward
 %c% huge_forward
 %c% huge_linked
@@ -91,9 +91,20 @@ int32_t inline __builtin_popcountll(uint64_t value)
 #include <set>
 #include <iomanip>
 #include <chrono>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <numeric>
+#include <functional>
+#include <iterator>
 #include "btree_set.h"
+#include "btree_slab_allocator.h"
 #include <sparsehash/sparse_hash_set>
 #include <sparsehash/dense_hash_set>
+#include <sparsehash/internal/mmap_allocator_with_realloc.h>
+#include <sparsehash/internal/arena_allocator_with_realloc.h>
 #include <deque>
 #include <mct/hash-set.hpp>
 #include <sdsl/bit_vectors.hpp>
@@ -103,6 +114,27 @@ int32_t inline __builtin_popcountll(uint64_t value)
 #include <sparsepp/spp.h>
 #include <boost/unordered_set.hpp>
 #include <boost/container/flat_set.hpp>
+#include "mphf_set.h"
+#include "eytzinger_set.h"
+#include "art_set.h"
+#include "pgm_set.h"
+#include "quotient_set.h"
+#include "compressed_btree_set.h"
+#include "olc_btree_set.h"
+#include "btree_image.h"
+#include <sparsehash/dense_hash_image>
+#include "hash_policy.h"
+#ifdef _MSC_VER
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #ifdef _DEBUG
 const auto amount = 100000;
@@ -144,6 +176,11 @@ struct Pool
     _next = _end = nullptr;
     _pools.clear();
   }
+  // Several tests can run in one process, each reports its own counters.
+  void reset_counters()
+  {
+    _alloc = _free = _grow = _shrink = _new = _delete = Counter();
+  }
   void* allocate(size_t sz) {
     if (sz == 0)
     {
@@ -168,6 +205,38 @@ struct Pool
     _free.add(sz);
 #ifndef USE_POOL
     free(p);
+#endif
+  }
+  // Blocks starting on an align byte boundary, align is a power of two.
+  void* allocate_aligned(size_t sz, size_t align) {
+    if (sz == 0)
+    {
+      return nullptr;
+    }
+#ifdef USE_POOL
+    auto p = static_cast<char*>(allocate(sz + align - 1));
+    return p + (align - reinterpret_cast<uintptr_t>(p) % align) % align;
+#else
+    _alloc.add(sz);
+#ifdef _MSC_VER
+    return _aligned_malloc(sz, align);
+#else
+    void* p = nullptr;
+    return posix_memalign(&p, align, sz) == 0 ? p : nullptr;
+#endif
+#endif
+  }
+  void deallocate_aligned(void* p, size_t sz, size_t align) {
+#ifdef USE_POOL
+    deallocate(p, sz + align - 1);
+#else
+    (void)align; // only the pool needs it to find the block size
+    _free.add(sz);
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    free(p);
+#endif
 #endif
   }
   void* reallocate(void* p, size_t new_sz, size_t old_sz) {
@@ -197,6 +266,21 @@ struct Pool
 #endif
   }
 
+  // Allocators which get their memory elsewhere count it here.
+  void count_allocate(size_t sz) { _alloc.add(sz); }
+  void count_deallocate(size_t sz) { _free.add(sz); }
+  void count_reallocate(size_t new_sz, size_t old_sz)
+  {
+    if (new_sz > old_sz)
+    {
+      _grow.add(new_sz - old_sz);
+    }
+    else if (new_sz < old_sz)
+    {
+      _shrink.add(old_sz - new_sz);
+    }
+  }
+
   static void report(const char* name, size_t count, size_t sz)
   {
     if (count == 0 && sz == 0)
@@ -280,7 +364,7 @@ public:
     return static_cast<pointer>(pool.allocate(n * sizeof(value_type)));
   }
   void deallocate(pointer p, size_type n) {
-    pool.deallocate(p, n);
+    pool.deallocate(p, n * sizeof(value_type));
   }
   pointer reallocate(pointer p, size_type new_n, size_type old_n) {
     return static_cast<pointer>(pool.reallocate(p, new_n * sizeof(value_type), old_n * sizeof(value_type)));
@@ -324,30 +408,317 @@ using PoolAllocator = Reallocator<T>;
 template <class T>
 using SppAllocator = Reallocator<T>;
 
+// The pool is not thread safe, sets which allocate from several threads at
+// once serialize the calls.
+std::mutex pool_mutex;
+
+template<class T>
+class SharedPoolAllocator
+{
+public:
+  typedef T value_type;
+
+  SharedPoolAllocator() noexcept {}
+  template<class U>
+  SharedPoolAllocator(const SharedPoolAllocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    return static_cast<T*>(pool.allocate(n * sizeof(T)));
+  }
+  void deallocate(T* p, size_t n) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    pool.deallocate(p, n * sizeof(T));
+  }
+};
+
+template<class T, class U>
+constexpr bool operator==(const SharedPoolAllocator<T>&, const SharedPoolAllocator<U>&) noexcept { return true; }
+
+template<class T, class U>
+constexpr bool operator!=(const SharedPoolAllocator<T>&, const SharedPoolAllocator<U>&) noexcept { return false; }
+
+// Large blocks are memory mappings of their own, which reallocate() grows
+// with mremap, see sparsehash/internal/mmap_allocator_with_realloc.h. The
+// pool only counts them.
+template<class T, bool Populate = false, bool HugePages = false>
+class MmapReallocator : public google::mmap_allocator_with_realloc<T, Populate, HugePages> {
+  typedef google::mmap_allocator_with_realloc<T, Populate, HugePages> base;
+public:
+  using typename base::size_type;
+  using typename base::pointer;
+
+  MmapReallocator() noexcept {}
+  template<typename U>
+  MmapReallocator(const MmapReallocator<U, Populate, HugePages>&) noexcept {}
+
+  pointer allocate(size_type n) {
+    pool.count_allocate(n * sizeof(T));
+    return base::allocate(n);
+  }
+  void deallocate(pointer p, size_type n) {
+    pool.count_deallocate(n * sizeof(T));
+    base::deallocate(p, n);
+  }
+  pointer reallocate(pointer p, size_type new_n, size_type old_n) {
+    pool.count_reallocate(new_n * sizeof(T), old_n * sizeof(T));
+    return base::reallocate(p, new_n, old_n);
+  }
+
+  template<class U>
+  struct rebind {
+    typedef MmapReallocator<U, Populate, HugePages> other;
+  };
+};
+
+template<class T, bool P, bool H>
+constexpr bool operator==(const MmapReallocator<T, P, H>&, const MmapReallocator<T, P, H>&) noexcept { return true; }
+
+template<class T, bool P, bool H>
+constexpr bool operator!=(const MmapReallocator<T, P, H>&, const MmapReallocator<T, P, H>&) noexcept { return false; }
+
+// Sparse tables with it keep their groups in an arena, which takes its slabs
+// from the pool in chunks, see sparsehash/internal/arena_allocator_with_realloc.h.
+template<class T>
+class ArenaReallocator : public Reallocator<T> {
+public:
+  static const bool uses_group_arena = true;
+
+  ArenaReallocator() noexcept {}
+  template<typename U>
+  ArenaReallocator(const ArenaReallocator<U>&) noexcept {}
+
+  template<class U>
+  struct rebind {
+    typedef ArenaReallocator<U> other;
+  };
+};
+
+template<class T>
+constexpr bool operator==(const ArenaReallocator<T>&, const ArenaReallocator<T>&) noexcept { return true; }
+
+template<class T>
+constexpr bool operator!=(const ArenaReallocator<T>&, const ArenaReallocator<T>&) noexcept { return false; }
+
 #else
 template <class T>
 using Reallocator = google::libc_allocator_with_realloc<T>;
+template <class T, bool Populate = false, bool HugePages = false>
+using MmapReallocator = google::mmap_allocator_with_realloc<T, Populate, HugePages>;
+template <class T>
+using ArenaReallocator = google::arena_allocator_with_realloc<T>;
 template <class T>
 using PoolAllocator = std::allocator<T>;
 template <class T>
+using SharedPoolAllocator = std::allocator<T>;
+template <class T>
 using SppAllocator = SPP_DEFAULT_ALLOCATOR<T>;
 #endif
 
-typedef google::dense_hash_set<test_t, std::hash<test_t>, std::equal_to<test_t>, Reallocator<test_t>> Dense;
+// Gives every block an Align byte boundary, so that btree nodes can start on
+// a cache line or a page. Always goes through the pool to be accounted.
+template<class T, size_t Align>
+class AlignedAllocator
+{
+public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+
+  template<class U>
+  struct rebind {
+    typedef AlignedAllocator<U, Align> other;
+  };
+
+  AlignedAllocator() noexcept {}
+  template<class U>
+  AlignedAllocator(const AlignedAllocator<U, Align>&) noexcept {}
+
+  pointer allocate(size_type n) {
+    auto p = pool.allocate_aligned(n * sizeof(value_type), Align);
+    if (p == nullptr)
+    {
+      throw std::bad_alloc();
+    }
+    return static_cast<pointer>(p);
+  }
+  void deallocate(pointer p, size_type n) {
+    pool.deallocate_aligned(p, n * sizeof(value_type), Align);
+  }
+  size_type max_size() const { return std::numeric_limits<size_type>::max() / sizeof(value_type); }
+};
+
+template<class T, class U, size_t Align>
+constexpr bool operator==(const AlignedAllocator<T, Align>&, const AlignedAllocator<U, Align>&) noexcept { return true; }
+
+template<class T, class U, size_t Align>
+constexpr bool operator!=(const AlignedAllocator<T, Align>&, const AlignedAllocator<U, Align>&) noexcept { return false; }
+
+template<class Probe, class A = Reallocator<test_t>, class H = std::hash<test_t>>
+using DenseOf = google::dense_hash_set<test_t, H, std::equal_to<test_t>, A, Probe>;
+typedef DenseOf<google::dense_probe_quadratic> Dense;
+typedef DenseOf<google::dense_probe_linear> DenseLinear;
+typedef DenseOf<google::dense_probe_robin_hood> DenseRobinHood;
+typedef DenseOf<google::dense_probe_quadratic, MmapReallocator<test_t>> DenseMmap;
+typedef DenseOf<google::dense_probe_quadratic, MmapReallocator<test_t, true, true>> DenseMmapHuge;
+template<class A, class H = std::hash<test_t>>
+using SparseOf = google::sparse_hash_set<test_t, H, std::equal_to<test_t>, A>;
+typedef SparseOf<Reallocator<test_t>> Sparse;
+typedef SparseOf<MmapReallocator<test_t>> SparseMmap;
+typedef SparseOf<ArenaReallocator<test_t>> SparseArena;
+template<class H>
+using SppWith = spp::sparse_hash_set<test_t, H, std::equal_to<test_t>, SppAllocator<test_t>>;
+typedef SppWith<spp::spp_hash<test_t>> Spp;
+typedef spp::sparse_hash_set<test_t, spp::spp_hash<test_t>, std::equal_to<test_t>, MmapReallocator<test_t>> SppMmap;
+template<class H>
+using ClosedWith = mct::closed_hash_set<test_t, H, std::equal_to<test_t>, PoolAllocator<test_t>>;
+typedef ClosedWith<std::hash<test_t>> Closed;
+template<class H>
+using UnorderedWith = std::unordered_set<test_t, H, std::equal_to<test_t>, PoolAllocator<test_t>>;
+template<class H>
+using BoostUnorderedWith = boost::unordered_set<test_t, H, std::equal_to<test_t>, PoolAllocator<test_t>>;
 typedef boost::container::flat_set<test_t, std::less<test_t>, PoolAllocator<test_t>> Flat;
+typedef mphf_set<test_t, PoolAllocator<test_t>> Mphf;
+typedef eytzinger_set<test_t, PoolAllocator<test_t>> Eytzinger;
+typedef pgm_set<test_t, PoolAllocator<test_t>> Pgm;
+typedef quotient_set<test_t> Quotient;
+typedef compressed_btree_set<test_t, PoolAllocator<test_t>> CompressedBtree;
+typedef olc_btree_set<test_t, SharedPoolAllocator<test_t>> OlcBtree;
+typedef btree::btree_set<test_t, std::less<test_t>, PoolAllocator<test_t>> Btree;
+typedef btree::btree_set<test_t, std::less<test_t>, PoolAllocator<test_t>, 256, true> BtreeCounted;
+typedef btree::btree_set<test_t, std::less<test_t>, btree::btree_slab_allocator<test_t>> BtreeSlab;
+typedef btree::btree_set<test_t, std::less<test_t>, btree::btree_slab_allocator<test_t, true>> BtreeSlabHuge;
+
+// btree_set with a given node size, Align 0 keeps the default allocator.
+template<int NodeSize, size_t Align>
+struct BtreeOf
+{
+  typedef btree::btree_set<test_t, std::less<test_t>, AlignedAllocator<test_t, Align>, NodeSize> type;
+};
+
+template<int NodeSize>
+struct BtreeOf<NodeSize, 0>
+{
+  typedef btree::btree_set<test_t, std::less<test_t>, PoolAllocator<test_t>, NodeSize> type;
+};
+
+// The hash sets whose hash function the hash option picks, with hash H.
+template<class H>
+using DenseWith = DenseOf<google::dense_probe_quadratic, Reallocator<test_t>, H>;
+template<class H>
+using DenseLinearWith = DenseOf<google::dense_probe_linear, Reallocator<test_t>, H>;
+template<class H>
+using DenseRobinHoodWith = DenseOf<google::dense_probe_robin_hood, Reallocator<test_t>, H>;
+template<class H>
+using SparseWith = SparseOf<Reallocator<test_t>, H>;
+
+// btree_set built with bulk_load() from the values queued during population.
+struct BtreeBulk : Btree
+{
+  std::vector<test_t, PoolAllocator<test_t>> pending;
+};
 
 size_t populate_count = amount;
 size_t pop_hit_count = 0;
 size_t hit_count = 0;
 size_t miss_count = 0;
+size_t scan_count = 0;
+size_t rank_count = 0;
+size_t setops_count = 0;
+size_t mt_threads = 0;
+size_t image_count = 0;
+size_t batch_size = 1;
+size_t prefetch_depth = 16;
+size_t pgm_epsilon = 64;
+size_t bulk_fill = 100;
+size_t bulk_threads = 1;
+size_t btree_node_size = 256;
+size_t btree_align = 0;
+size_t dense_step = 0;
+size_t latency_count = 0;
+size_t key_shift = 0;
+size_t max_load = 0;
+size_t load_sweep = 0;
+size_t reserve_count = 0;
+size_t erase_percent = 90;
+size_t compact_budget = 0;
+size_t remove_count = 0;
+std::string hash_function;
+
+// The values of all steps, uniform in [0, max_value] or, with shift n, as
+// many distinct values spread out to multiples of 2^n in the same range,
+// which differ only in their high bits.
+struct key_distribution
+{
+  std::uniform_int_distribution<test_t> rnd;
+  size_t shift;
 
+  template<class G>
+  test_t operator()(G& gen)
+  {
+    return rnd(gen) << shift;
+  }
+};
+
+// With compaction on, the largest possible value is kept back as the
+// deleted key of compact_test.
+key_distribution key_values()
+{
+  auto top = compact_budget > 0 ? std::min(max_value, static_cast<test_t>(std::numeric_limits<test_t>::max() - 1)) : max_value;
+  return key_distribution{ std::uniform_int_distribution<test_t>(0, top >> key_shift), key_shift };
+}
+
+// Static sets only queue values during population and are built in one go
+// afterwards, the build is reported as a separate phase.
 template<typename T>
-void init_set(T& s){}
+struct is_static_set : std::false_type {};
 
 template<>
-void init_set(Dense& s)
+struct is_static_set<Mphf> : std::true_type {};
+
+template<>
+struct is_static_set<Eytzinger> : std::true_type {};
+
+template<>
+struct is_static_set<Pgm> : std::true_type {};
+
+template<>
+struct is_static_set<BtreeBulk> : std::true_type {};
+
+// Dense hash sets, which the incremental option makes resize a slice at a time.
+template<typename T>
+struct is_dense_set : std::false_type {};
+
+template<class Probe, class A, class H>
+struct is_dense_set<DenseOf<Probe, A, H>> : std::true_type {};
+
+template<typename T>
+void init_set(T& s){}
+
+template<class Probe, class A, class H>
+void init_set(DenseOf<Probe, A, H>& s)
 {
   s.set_empty_key(0);
+  s.set_incremental_resize(dense_step);
+  s.set_resize_threads(bulk_threads);
+  s.set_batch_depth(prefetch_depth);
+}
+
+template<class A, class H>
+void init_set(SparseOf<A, H>& s)
+{
+  s.set_resize_threads(bulk_threads);
+  s.set_batch_depth(prefetch_depth);
+}
+
+template<class H>
+void init_set(ClosedWith<H>& s)
+{
+  s.batch_depth(prefetch_depth);
 }
 
 template<>
@@ -356,154 +727,1244 @@ void init_set(sdsl::bit_vector& s)
   s.resize(populate_count);
 }
 
+template<>
+void init_set(Pgm& s)
+{
+  s.set_epsilon(pgm_epsilon);
+}
+
+template<>
+void init_set(Quotient& s)
+{
+  s.set_key_bits(64 - __builtin_clzll(max_value));
+}
+
+// Hash sets whose max load factor can be set.
+template<typename T, typename = void>
+struct has_load_factor : std::false_type {};
+
 template<typename T>
-void elapsed(const char* name, T end, T start)
+struct has_load_factor<T, decltype(std::declval<T&>().max_load_factor(1.0f), void())> : std::true_type {};
+
+// Chained hash sets, which may hold more values than buckets.
+template<typename T>
+struct is_chained_set : std::false_type {};
+
+template<typename H, typename E, typename A>
+struct is_chained_set<std::unordered_set<test_t, H, E, A>> : std::true_type {};
+
+template<typename H, typename E, typename A>
+struct is_chained_set<boost::unordered_set<test_t, H, E, A>> : std::true_type {};
+
+template<typename T>
+auto reserve_set(T& s, size_t n, int) -> decltype(s.reserve(n), void())
 {
-  std::cout << name << ", sec: " << std::fixed << std::setprecision(3) <<
-    std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() / 1000.0 << std::endl;
+  s.reserve(n);
 }
 
+// google sets call it resize().
 template<typename T>
-void do_set(T& s, test_t v)
+void reserve_set(T& s, size_t n, long)
 {
-  s.insert(v);
+  s.resize(n);
+}
+
+template<typename T>
+void tune_set(T& s, std::false_type) {}
+
+// The load and reserve options, the load factor first as it decides the
+// buckets reserved.
+template<typename T>
+void tune_set(T& s, std::true_type)
+{
+  if (max_load > 0)
+  {
+    if (max_load >= 100 && !is_chained_set<T>::value)
+    {
+      throw std::invalid_argument("load must be less than 100 for open addressing sets");
+    }
+    s.max_load_factor(max_load / 100.0f);
+  }
+  if (reserve_count > 0)
+  {
+    reserve_set(s, reserve_count, 0);
+  }
 }
 
+template<typename T>
+void build_set(T& s){}
+
 template<>
-void do_set(sdsl::bit_vector& s, test_t v)
+void build_set(Mphf& s)
 {
-  s[v % populate_count] = true;
+  s.build();
 }
 
 template<>
-void do_set(EWAHBoolArray<uint32_t>& s, test_t v)
+void build_set(Eytzinger& s)
 {
-  s.set(static_cast<uint32_t>(v));
+  s.build();
 }
 
 template<>
-void do_set(EWAHBoolArray<uint64_t>& s, test_t v)
+void build_set(Pgm& s)
 {
-  s.set(v);
+  s.build();
 }
 
 template<>
-void do_set(ConciseSet<>& s, test_t v)
+void build_set(BtreeBulk& s)
 {
-  s.add(static_cast<uint32_t>(v));
+  s.bulk_load(s.pending.begin(), s.pending.end(), bulk_fill / 100.0, static_cast<int>(bulk_threads));
+  decltype(s.pending)().swap(s.pending);
 }
 
 template<typename T>
-bool is_set(T& s, test_t v)
+void report_set(const T& s){}
+
+template<>
+void report_set(const Pgm& s)
 {
-  return s.find(v) != s.end();
+  std::cout << "Model: eps " << s.epsilon() << " segments " << s.segment_count() << " levels " << s.height() <<
+    " bytes " << s.model_bytes() << std::endl;
 }
 
-template<>
-bool is_set(sdsl::bit_vector& s, test_t v)
+template<typename A>
+void report_allocator(const A& a) {}
+
+// Slab memory does not go through the pool allocator.
+template<typename T, bool H>
+void report_allocator(const btree::btree_slab_allocator<T, H>& a)
 {
-  return s[v % populate_count];
+  auto& slabs = *a.pool();
+  std::cout << "Slab: reserved " << slabs.bytes_reserved() << " used " << slabs.bytes_used() << " huge pages " <<
+    slabs.huge_pages() << std::endl;
 }
 
-template<>
-bool is_set(EWAHBoolArray<uint32_t>& s, test_t v)
+template<typename K, typename C, typename A, int N, bool R>
+void report_set(const btree::btree_set<K, C, A, N, R>& s)
 {
-  return s.get(static_cast<uint32_t>(v));
+  std::cout << "Tree: node " << N << " height " << s.height() << " nodes " << s.nodes() << " fullness " <<
+    std::fixed << std::setprecision(3) << s.fullness() << " overhead " << s.overhead() << " bytes " <<
+    s.bytes_used() << std::endl;
+  report_allocator(s.get_allocator());
 }
 
 template<>
-bool is_set(EWAHBoolArray<uint64_t>& s, test_t v)
+void report_set(const BtreeBulk& s)
 {
-  return s.get(static_cast<uint64_t>(v));
+  report_set(static_cast<const Btree&>(s));
 }
 
-template<>
-bool is_set(sparse_set& s, test_t v)
+// Probe lengths in buckets, hit over the elements, miss over the home buckets,
+// clusters of non-empty buckets and the variance of the elements per home
+// bucket, which is about the load for a good hash function.
+struct ProbeStats
 {
-  return s.test(v);
+  double hit_mean;
+  double hit_variance;
+  size_t hit_max;
+  double miss_mean;
+  double miss_variance;
+  size_t miss_max;
+  double cluster_mean;
+  size_t cluster_max;
+  double home_variance;
+};
+
+template<typename P>
+void report_probes(double load, const P& p)
+{
+  std::cout << "Probe: load " << std::fixed << std::setprecision(3) << load << " hit mean " << p.hit_mean << " var " <<
+    p.hit_variance << " max " << p.hit_max << " miss mean " << p.miss_mean << " var " << p.miss_variance << " max " <<
+    p.miss_max << " cluster mean " << p.cluster_mean << " max " << p.cluster_max << " home var " << p.home_variance <<
+    std::endl;
 }
 
-template<>
-bool is_set(unordered_sparse_set& s, test_t v)
+template<class Probe, class A, class H>
+void report_set(const DenseOf<Probe, A, H>& s)
 {
-  return s.test(v);
+  report_probes(s.load_factor(), s.probe_stats());
 }
 
-template<>
-bool is_set(ConciseSet<>& s, test_t v)
+template<class A, class H>
+void report_set(const SparseOf<A, H>& s)
 {
-  return s.contains(static_cast<uint32_t>(v));
+  report_probes(s.load_factor(), s.probe_stats());
 }
 
-std::string test_name;
+template<class H>
+void report_set(const SppWith<H>& s)
+{
+  report_probes(s.load_factor(), s.probe_stats());
+}
+
+template<class H>
+void report_set(const ClosedWith<H>& s)
+{
+  auto c = s.collect_statistics();
+  ProbeStats p = { c.avg_present_lookup, c.var_present_lookup, c.max_present_lookup, c.avg_absent_lookup,
+    c.var_absent_lookup, c.max_absent_lookup, c.avg_cluster, c.max_cluster, c.var_home_elements };
+  report_probes(s.load_factor(), p);
+}
 
+// Chained sets: a hit compares the elements of its bucket up to itself, a
+// miss all of them, a cluster is the chain of a non-empty bucket.
 template<typename T>
-void test()
+void report_chains(const T& s)
 {
-  std::cout << "Testing: " << test_name << " max " << max_value << " bits " << 64 - __builtin_clzll(max_value) << " cnt " << populate_count;
-#ifdef WRAP_ALLOC
-  std::cout << " wrap_alloc";
-#endif
-#ifdef USE_POOL
-  std::cout << " pool";
-#endif
-  std::cout << std::endl;
-  std::uniform_int_distribution<test_t> rnd(0, max_value);
-  T s;
-  init_set(s);
-  std::default_random_engine generator(5489);
-  {
-    auto start = std::chrono::high_resolution_clock::now();
-    for (auto n = 0; n < populate_count; ++n)
-    {
-      do_set(s, rnd(generator));
-    }
-    auto end = std::chrono::high_resolution_clock::now();
-    pool.report(populate_count * sizeof(test_t));
-    elapsed("population", end, start);
-  }
-  size_t cnt = 0;
+  ProbeStats p = {};
+  double hit_sum = 0;
+  double hit_squares = 0;
+  double miss_squares = 0;
+  size_t clusters = 0;
+  for (size_t b = 0; b < s.bucket_count(); ++b)
   {
-    auto start = std::chrono::high_resolution_clock::now();
-    for (auto h = 0; h < pop_hit_count; ++h)
-    {
-      std::default_random_engine gen(5489);
-      for (auto n = 0; n < populate_count; ++n)
-      {
-        do_set(s, rnd(gen));
-      }
-    }
-    auto end = std::chrono::high_resolution_clock::now();
-    elapsed("population hit", end, start);
+    double k = static_cast<double>(s.bucket_size(b));
+    hit_sum += k * (k + 1) / 2;
+    hit_squares += k * (k + 1) * (2 * k + 1) / 6;
+    miss_squares += k * k;
+    p.hit_max = std::max(p.hit_max, s.bucket_size(b));
+    clusters += k > 0 ? 1 : 0;
   }
+  p.miss_max = p.hit_max;
+  p.cluster_max = p.hit_max;
+  if (s.size() > 0)
   {
-    auto start = std::chrono::high_resolution_clock::now();
-    for (auto h = 0; h < hit_count; ++h)
-    {
-      std::default_random_engine gen(5489);
-      for (auto n = 0; n < populate_count; ++n)
-      {
-        cnt += is_set(s, rnd(gen)) ? 1 : 0;
-      }
-    }
-    auto end = std::chrono::high_resolution_clock::now();
-    elapsed("hit", end, start);
+    p.hit_mean = hit_sum / s.size();
+    p.hit_variance = hit_squares / s.size() - p.hit_mean * p.hit_mean;
+    p.cluster_mean = static_cast<double>(s.size()) / clusters;
   }
-  {
-    auto start = std::chrono::high_resolution_clock::now();
-    for (auto m = 0; m < miss_count; ++m)
+  p.miss_mean = static_cast<double>(s.size()) / s.bucket_count();
+  p.miss_variance = miss_squares / s.bucket_count() - p.miss_mean * p.miss_mean;
+  p.home_variance = p.miss_variance;
+  report_probes(s.load_factor(), p);
+}
+
+template<class H>
+void report_set(const UnorderedWith<H>& s)
+{
+  report_chains(s);
+}
+
+template<class H>
+void report_set(const BoostUnorderedWith<H>& s)
+{
+  report_chains(s);
+}
+
+// int_vector memory does not go through the pool allocator.
+template<>
+void report_set(const Quotient& s)
+{
+  std::cout << "Table: slots " << s.bucket_count() << " slot bits " << s.slot_bits() << " load " << std::fixed <<
+    std::setprecision(3) << s.load_factor() << " max probe " << s.max_probe() << " bytes " << s.bytes_used() <<
+    " ratio " << static_cast<double>(s.bytes_used()) / (populate_count * sizeof(test_t)) << std::endl;
+}
+
+template<>
+void report_set(const OlcBtree& s)
+{
+  std::cout << "Tree: node " << s.node_keys() << " height " << s.height() << " nodes " << s.nodes() << " fullness " <<
+    std::fixed << std::setprecision(3) << s.fullness() << " overhead " << s.overhead() << " bytes " <<
+    s.bytes_used() << std::endl;
+}
+
+// Leaves are counted as nodes, the index btree adds to the height.
+template<>
+void report_set(const CompressedBtree& s)
+{
+  std::cout << "Tree: node " << s.leaf_keys() << " height " << s.height() << " nodes " << s.leaves() << " fullness " <<
+    std::fixed << std::setprecision(3) << s.fullness() << " overhead " << s.overhead() << " bytes " <<
+    s.bytes_used() << " width " << s.average_width() << " ratio " <<
+    static_cast<double>(s.bytes_used()) / (s.size() * sizeof(test_t)) << std::endl;
+}
+
+template<typename T>
+void elapsed(const char* name, T end, T start)
+{
+  std::cout << name << ", sec: " << std::fixed << std::setprecision(3) <<
+    std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() / 1000.0 << std::endl;
+}
+
+template<typename T>
+void do_set(T& s, test_t v)
+{
+  s.insert(v);
+}
+
+template<>
+void do_set(sdsl::bit_vector& s, test_t v)
+{
+  s[v % populate_count] = true;
+}
+
+template<>
+void do_set(BtreeBulk& s, test_t v)
+{
+  if (s.find(v) == s.end())
+  {
+    s.pending.push_back(v);
+  }
+}
+
+template<>
+void do_set(EWAHBoolArray<uint32_t>& s, test_t v)
+{
+  s.set(static_cast<uint32_t>(v));
+}
+
+template<>
+void do_set(EWAHBoolArray<uint64_t>& s, test_t v)
+{
+  s.set(v);
+}
+
+template<>
+void do_set(ConciseSet<>& s, test_t v)
+{
+  s.add(static_cast<uint32_t>(v));
+}
+
+template<typename T>
+bool is_set(T& s, test_t v)
+{
+  return s.find(v) != s.end();
+}
+
+template<>
+bool is_set(sdsl::bit_vector& s, test_t v)
+{
+  return s[v % populate_count];
+}
+
+template<>
+bool is_set(EWAHBoolArray<uint32_t>& s, test_t v)
+{
+  return s.get(static_cast<uint32_t>(v));
+}
+
+template<>
+bool is_set(EWAHBoolArray<uint64_t>& s, test_t v)
+{
+  return s.get(static_cast<uint64_t>(v));
+}
+
+template<>
+bool is_set(sparse_set& s, test_t v)
+{
+  return s.test(v);
+}
+
+template<>
+bool is_set(unordered_sparse_set& s, test_t v)
+{
+  return s.test(v);
+}
+
+template<>
+bool is_set(ConciseSet<>& s, test_t v)
+{
+  return s.contains(static_cast<uint32_t>(v));
+}
+
+// Sum of all values in iteration order, 0 for sets which cannot be iterated.
+template<typename T>
+auto scan_set(const T& s, int) -> decltype(s.begin() != s.end(), size_t())
+{
+  size_t sum = 0;
+  for (auto it = s.begin(); it != s.end(); ++it)
+  {
+    sum += *it;
+  }
+  return sum;
+}
+
+template<typename T>
+size_t scan_set(const T& s, long)
+{
+  return 0;
+}
+
+// Sets answering rank (number of values below v) and select (value at a
+// position in sorted order) queries.
+template<typename T>
+struct has_order_statistics : std::false_type {};
+
+template<>
+struct has_order_statistics<BtreeCounted> : std::true_type {};
+
+template<>
+struct has_order_statistics<sdsl::bit_vector> : std::true_type {};
+
+template<typename T>
+struct ranked
+{
+  explicit ranked(const T& s) : _s(s) {}
+  size_t size() const { return _s.size(); }
+  size_t rank(test_t v) const { return _s.rank(v); }
+  test_t select(size_t k) const { return *_s.select(k); }
+
+  const T& _s;
+};
+
+// bit_vector holds v % cnt, rank and select go through sdsl support structures
+// which are built over the populated vector.
+template<>
+struct ranked<sdsl::bit_vector>
+{
+  explicit ranked(const sdsl::bit_vector& s) : _rank(&s), _select(&s), _size(_rank(s.size())) {}
+  size_t size() const { return _size; }
+  size_t rank(test_t v) const { return _rank(v % populate_count); }
+  test_t select(size_t k) const { return _select(k + 1); }
+
+  sdsl::rank_support_v5<1> _rank;
+  sdsl::select_support_mcl<1> _select;
+  size_t _size;
+};
+
+template<typename T>
+void rank_test(const T& s, std::false_type) {}
+
+template<typename T>
+void rank_test(const T& s, std::true_type)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  ranked<T> r(s);
+  auto end = std::chrono::high_resolution_clock::now();
+  elapsed("rank index", end, start);
+  auto rnd = key_values();
+  std::default_random_engine gen(5489);
+  size_t sum = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (auto m = 0; m < rank_count; ++m)
+  {
+    for (auto n = 0; n < populate_count; ++n)
+    {
+      sum += r.rank(rnd(gen));
+    }
+  }
+  end = std::chrono::high_resolution_clock::now();
+  elapsed("rank", end, start);
+  if (r.size() > 0)
+  {
+    std::uniform_int_distribution<size_t> pos(0, r.size() - 1);
+    start = std::chrono::high_resolution_clock::now();
+    for (auto m = 0; m < rank_count; ++m)
+    {
+      for (auto n = 0; n < populate_count; ++n)
+      {
+        sum += r.select(pos(gen));
+      }
+    }
+    end = std::chrono::high_resolution_clock::now();
+    elapsed("select", end, start);
+  }
+  std::cout << "rank sum: " << sum << std::endl;
+}
+
+// Sets with merge based union, intersection and difference.
+template<typename T>
+struct has_set_algebra : std::false_type {};
+
+template<class C, class A, int N, bool R>
+struct has_set_algebra<btree::btree_set<test_t, C, A, N, R>> : std::true_type {};
+
+template<typename T>
+void set_algebra_test(const T& s, std::false_type) {}
+
+// Builds a second set y of the first half of the populated values and as many
+// others, then times the union, intersection and difference of the set and y
+// setops_count times each: assigned by the btree merge routines, written to a
+// vector by std::set_union and friends, and in place on a copy of the set,
+// whose cost the copy step shows.
+template<typename T>
+void set_algebra_test(const T& s, std::true_type)
+{
+  auto rnd = key_values();
+  T y;
+  std::default_random_engine gen(5489);
+  std::default_random_engine other(5490);
+  for (size_t n = 0; n < populate_count / 2; ++n)
+  {
+    y.insert(rnd(gen));
+    y.insert(rnd(other));
+  }
+  size_t sum = 0;
+  auto run = [&](const char* name, const std::function<size_t()>& f)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto m = 0; m < setops_count; ++m)
+    {
+      sum += f();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    elapsed(name, end, start);
+  };
+  std::vector<test_t> v;
+  v.reserve(s.size() + y.size());
+  run("assign_union", [&] { T r; r.assign_union(s, y); return r.size(); });
+  run("std::set_union", [&] { v.clear(); std::set_union(s.begin(), s.end(), y.begin(), y.end(), std::back_inserter(v)); return v.size(); });
+  run("assign_intersection", [&] { T r; r.assign_intersection(s, y); return r.size(); });
+  run("std::set_intersection", [&] { v.clear(); std::set_intersection(s.begin(), s.end(), y.begin(), y.end(), std::back_inserter(v)); return v.size(); });
+  run("assign_difference", [&] { T r; r.assign_difference(s, y); return r.size(); });
+  run("std::set_difference", [&] { v.clear(); std::set_difference(s.begin(), s.end(), y.begin(), y.end(), std::back_inserter(v)); return v.size(); });
+  run("copy", [&] { T r(s); return r.size(); });
+  run("union_with", [&] { T r(s); r.union_with(y); return r.size(); });
+  run("intersect_with", [&] { T r(s); r.intersect_with(y); return r.size(); });
+  run("subtract", [&] { T r(s); r.subtract(y); return r.size(); });
+  std::cout << "set algebra sum: " << sum << std::endl;
+}
+
+// Sets which may be used from several threads without a lock.
+template<typename T>
+struct is_concurrent_set : std::false_type {};
+
+template<>
+struct is_concurrent_set<OlcBtree> : std::true_type {};
+
+// A set shared by the threads of the mt phases, guarded by a single lock
+// unless it is concurrent itself.
+template<typename T>
+class shared_set
+{
+public:
+  explicit shared_set(T& s) : _s(s) {}
+  bool find(test_t v) { return guarded([&] { return is_set(_s, v); }); }
+  void insert(test_t v) { guarded([&] { do_set(_s, v); return true; }); }
+
+private:
+  template<typename F>
+  bool guarded(F f)
+  {
+    if (is_concurrent_set<T>::value)
+    {
+      return f();
+    }
+    std::lock_guard<std::mutex> lock(_lock);
+    return f();
+  }
+
+  T& _s;
+  std::mutex _lock;
+};
+
+// Every thread looks up its share of the populated values; in the mixed
+// phase every 5th operation inserts a new random value instead.
+template<typename T>
+void mt_test(T& s)
+{
+  std::vector<test_t> values(populate_count);
+  auto rnd = key_values();
+  std::default_random_engine gen(5489);
+  for (auto& v : values)
+  {
+    v = rnd(gen);
+  }
+  shared_set<T> shared(s);
+  std::atomic<size_t> found(0);
+  auto run = [&](const char* name, bool mixed)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < mt_threads; ++t)
+    {
+      workers.emplace_back([&, t]
+      {
+        std::default_random_engine g(static_cast<unsigned>(t + 1));
+        size_t cnt = 0;
+        auto last = values.size() * (t + 1) / mt_threads;
+        for (auto i = values.size() * t / mt_threads; i < last; ++i)
+        {
+          if (mixed && i % 5 == 0)
+          {
+            shared.insert(rnd(g));
+          }
+          else
+          {
+            cnt += shared.find(values[i]) ? 1 : 0;
+          }
+        }
+        found += cnt;
+      });
+    }
+    for (auto& w : workers)
+    {
+      w.join();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    elapsed(name, end, start);
+  };
+  run("mt read", false);
+  run("mt mixed", true);
+  std::cout << "mt threads: " << mt_threads << " found: " << found << std::endl;
+}
+
+template<class Probe, class H = std::hash<test_t>>
+using DenseImage = google::dense_hash_image<test_t, H, std::equal_to<test_t>, Probe>;
+
+// Sets which the image phases write to an image, sorted sets to a
+// btree_image_set, dense hash sets to a dense_hash_image.
+template<typename T>
+struct has_image : std::false_type {};
+
+template<typename C, typename A, int N, bool R>
+struct has_image<btree::btree_set<test_t, C, A, N, R>> : std::true_type
+{
+  typedef btree_image_set<test_t> image;
+};
+
+template<>
+struct has_image<BtreeBulk> : std::true_type
+{
+  typedef btree_image_set<test_t> image;
+};
+
+template<class Probe, class A, class H>
+struct has_image<DenseOf<Probe, A, H>> : std::true_type
+{
+  typedef DenseImage<Probe, H> image;
+};
+
+const char* image_path = "TestSet.img";
+
+template<typename T>
+void save_image(btree_image_set<test_t>&, const T& s)
+{
+  btree_image_set<test_t>::save(image_path, s);
+}
+
+template<class Probe, class A, class H>
+void save_image(DenseImage<Probe, H>&, const DenseOf<Probe, A, H>& s)
+{
+  if (!DenseImage<Probe, H>::save(image_path, s))
+  {
+    throw std::runtime_error(std::string("dense_hash_image: cannot write ") + image_path);
+  }
+}
+
+void open_image(btree_image_set<test_t>& image)
+{
+  image.open(image_path);
+}
+
+template<class Probe, class H>
+void open_image(DenseImage<Probe, H>& image)
+{
+  if (!image.open(image_path))
+  {
+    throw std::runtime_error(std::string("dense_hash_image: cannot map ") + image_path);
+  }
+}
+
+void report_image(const btree_image_set<test_t>& image)
+{
+  std::cout << "Image: height " << image.height() << " bytes " << image.bytes_used() << std::endl;
+}
+
+template<class Probe, class H>
+void report_image(const DenseImage<Probe, H>& image)
+{
+  std::cout << "Image: buckets " << image.bucket_count() << " bytes " << image.bytes_used() << std::endl;
+}
+
+// Writes the cached pages of a file back and drops them, so that the next
+// access has to read the disk. On Windows the cache is left as it is.
+void evict_file(const char* path)
+{
+#ifdef POSIX_FADV_DONTNEED
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0)
+  {
+    fsync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+#endif
+}
+
+template<typename T>
+void image_test(const T& s, std::false_type) {}
+
+// Saves the set as an image, maps it and looks up the populated values: the
+// very first lookup is timed on its own, the first pass faults the pages in
+// from disk, the following ones find them in memory.
+template<typename T>
+void image_test(const T& s, std::true_type)
+{
+  typename has_image<T>::image image;
+  auto start = std::chrono::high_resolution_clock::now();
+  save_image(image, s);
+  auto end = std::chrono::high_resolution_clock::now();
+  elapsed("image save", end, start);
+  evict_file(image_path);
+  start = std::chrono::high_resolution_clock::now();
+  open_image(image);
+  end = std::chrono::high_resolution_clock::now();
+  elapsed("image open", end, start);
+  report_image(image);
+  auto rnd = key_values();
+  {
+    std::default_random_engine gen(5489);
+    auto v = rnd(gen);
+    start = std::chrono::high_resolution_clock::now();
+    auto found = image.count(v);
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << "image first hit, us: " << std::fixed << std::setprecision(3) <<
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1000.0 << " found " << found <<
+      std::endl;
+  }
+  size_t cnt = 0;
+  auto run = [&](const char* name, size_t steps)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto h = 0; h < steps; ++h)
+    {
+      std::default_random_engine gen(5489);
+      for (auto n = 0; n < populate_count; ++n)
+      {
+        cnt += image.count(rnd(gen));
+      }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    elapsed(name, end, start);
+  };
+  run("image cold hit", 1);
+  run("image warm hit", image_count);
+  image.close();
+  std::remove(image_path);
+  std::cout << "image hit count: " << cnt << std::endl;
+}
+
+// Hash sets which insert and count many values at once with insert_batch()
+// and count_batch().
+template<typename T>
+struct has_batch_insert : std::false_type {};
+
+template<class Probe, class A, class H>
+struct has_batch_insert<DenseOf<Probe, A, H>> : std::true_type {};
+
+template<class A, class H>
+struct has_batch_insert<SparseOf<A, H>> : std::true_type {};
+
+template<class H>
+struct has_batch_insert<ClosedWith<H>> : std::true_type {};
+
+// Sets which look up many values at once, btree sets with contains_batch().
+template<typename T>
+struct has_batch_lookup : has_batch_insert<T> {};
+
+template<typename C, typename A, int N, bool R>
+struct has_batch_lookup<btree::btree_set<test_t, C, A, N, R>> : std::true_type {};
+
+template<>
+struct has_batch_lookup<BtreeBulk> : std::true_type {};
+
+// Sets populate_count values drawn from gen.
+template<typename T, typename R, typename G>
+void populate(T& s, R& rnd, G& gen, std::false_type)
+{
+  for (auto n = 0; n < populate_count; ++n)
+  {
+    do_set(s, rnd(gen));
+  }
+}
+
+// The same values, batch_size of them at a time.
+template<typename T, typename R, typename G>
+void populate(T& s, R& rnd, G& gen, std::true_type)
+{
+  if (batch_size <= 1)
+  {
+    populate(s, rnd, gen, std::false_type());
+    return;
+  }
+  std::vector<test_t> values(batch_size);
+  for (size_t n = 0; n < populate_count; n += batch_size)
+  {
+    auto m = std::min(batch_size, populate_count - n);
+    for (size_t i = 0; i < m; ++i)
+    {
+      values[i] = rnd(gen);
+    }
+    s.insert_batch(values.data(), m, nullptr);
+  }
+}
+
+// How many of the n values are set, found and counts are scratch space for n results. The sum goes into the
+// hit and miss counts, so the lookups cannot be optimized away.
+template<typename T>
+size_t count_batch(T& s, const test_t* values, size_t n, bool* found, size_t*, std::false_type)
+{
+  s.contains_batch(values, n, found);
+  return std::count(found, found + n, true);
+}
+
+template<typename T>
+size_t count_batch(T& s, const test_t* values, size_t n, bool*, size_t* counts, std::true_type)
+{
+  s.count_batch(values, n, counts);
+  return std::accumulate(counts, counts + n, size_t(0));
+}
+
+// Looks up populate_count values drawn from gen, returns how many are set.
+template<typename T, typename R, typename G>
+size_t lookup(T& s, R& rnd, G& gen, std::false_type)
+{
+  size_t cnt = 0;
+  for (auto n = 0; n < populate_count; ++n)
+  {
+    cnt += is_set(s, rnd(gen)) ? 1 : 0;
+  }
+  return cnt;
+}
+
+// The same values, batch_size of them at a time.
+template<typename T, typename R, typename G>
+size_t lookup(T& s, R& rnd, G& gen, std::true_type)
+{
+  if (batch_size <= 1)
+  {
+    return lookup(s, rnd, gen, std::false_type());
+  }
+  std::vector<test_t> values(batch_size);
+  std::unique_ptr<bool[]> found(new bool[batch_size]);
+  std::unique_ptr<size_t[]> counts(new size_t[batch_size]);
+  size_t cnt = 0;
+  for (size_t n = 0; n < populate_count; n += batch_size)
+  {
+    auto m = std::min(batch_size, populate_count - n);
+    for (size_t i = 0; i < m; ++i)
+    {
+      values[i] = rnd(gen);
+    }
+    cnt += count_batch(s, values.data(), m, found.get(), counts.get(), has_batch_insert<T>());
+  }
+  return cnt;
+}
+
+// Resident set size of the process, 0 where it is not known.
+size_t resident_bytes()
+{
+#ifdef _MSC_VER
+  PROCESS_MEMORY_COUNTERS counters;
+  return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.WorkingSetSize : 0;
+#else
+  size_t pages = 0;
+  size_t resident = 0;
+  auto f = fopen("/proc/self/statm", "r");
+  if (f != nullptr)
+  {
+    if (fscanf(f, "%zu %zu", &pages, &resident) != 2)
+    {
+      resident = 0;
+    }
+    fclose(f);
+  }
+  return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+// Highest resident set size of the process so far, 0 where it is not known.
+size_t peak_resident_bytes()
+{
+#ifdef _MSC_VER
+  PROCESS_MEMORY_COUNTERS counters;
+  return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+  size_t peak = 0;
+  auto f = fopen("/proc/self/status", "r");
+  if (f != nullptr)
+  {
+    char line[256];
+    while (fgets(line, sizeof(line), f) != nullptr)
+    {
+      if (sscanf(line, "VmHWM: %zu kB", &peak) == 1)
+      {
+        break;
+      }
+    }
+    fclose(f);
+  }
+  return peak * 1024;
+#endif
+}
+
+// Growth of the resident set since start, which unlike the pool counters
+// includes the overhead of the memory manager, and its peak, which
+// includes the old and the new table of a set while it grows.
+void report_rss(size_t start)
+{
+  auto rss = resident_bytes();
+  Pool::report("RSS", 0, rss > start ? rss - start : 0);
+  auto peak = peak_resident_bytes();
+  Pool::report("Peak RSS", 0, peak > start ? peak - start : 0);
+}
+
+// Hash sets which can be compacted in idle time.
+template<typename T>
+struct has_compact : std::false_type {};
+
+template<class Probe, class A, class H>
+struct has_compact<DenseOf<Probe, A, H>> : std::true_type {};
+
+template<class A, class H>
+struct has_compact<SparseOf<A, H>> : std::true_type {};
+
+template<typename T>
+void report_debris(const char* when, const T& s)
+{
+  std::cout << "Debris " << when << ": ratio " << std::fixed << std::setprecision(3) << s.debris_ratio() <<
+    " buckets " << s.bucket_count() << " size " << s.size() << std::endl;
+}
+
+template<typename T, typename R>
+void compact_test(T& s, R& rnd, std::false_type) {}
+
+// Erases erase_percent of the populated values, then calls compact() with a
+// budget of compact_budget us until it is done, as in the idle time between
+// bursts of requests. The populated values are looked up with the debris and
+// after the compaction.
+template<typename T, typename R>
+void compact_test(T& s, R& rnd, std::true_type)
+{
+  s.set_deleted_key(std::numeric_limits<test_t>::max());
+  {
+    std::default_random_engine gen(5489);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t n = 0; n < populate_count * erase_percent / 100; ++n)
+    {
+      s.erase(rnd(gen));
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    elapsed("erase", end, start);
+  }
+  report_debris("before", s);
+  auto run = [&](const char* name)
+  {
+    std::default_random_engine gen(5489);
+    auto start = std::chrono::high_resolution_clock::now();
+    auto cnt = lookup(s, rnd, gen, has_batch_lookup<T>());
+    auto end = std::chrono::high_resolution_clock::now();
+    elapsed(name, end, start);
+    return cnt;
+  };
+  auto debris_cnt = run("debris hit");
+  size_t calls = 0;
+  std::chrono::high_resolution_clock::duration slowest{};
+  auto start = std::chrono::high_resolution_clock::now();
+  for (auto done = false; !done; ++calls)
+  {
+    auto before = std::chrono::high_resolution_clock::now();
+    done = s.compact(std::chrono::microseconds(compact_budget));
+    slowest = std::max(slowest, std::chrono::high_resolution_clock::now() - before);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  elapsed("compact", end, start);
+  std::cout << "compact calls: " << calls << " slowest, us: " << std::fixed << std::setprecision(3) <<
+    std::chrono::duration_cast<std::chrono::nanoseconds>(slowest).count() / 1000.0 << std::endl;
+  report_debris("after", s);
+  auto compacted_cnt = run("compacted hit");
+  std::cout << "compact hit count: " << debris_cnt << " " << compacted_cnt << std::endl;
+}
+
+// Sets which erase single values by key in the remove phase.
+template<typename T>
+struct has_erase : std::false_type {};
+
+template<class C, class A>
+struct has_erase<std::set<test_t, C, A>> : std::true_type {};
+
+template<class C, class A, int N, bool R>
+struct has_erase<btree::btree_set<test_t, C, A, N, R>> : std::true_type {};
+
+template<class A>
+struct has_erase<art_set<test_t, A>> : std::true_type {};
+
+template<class A, int L>
+struct has_erase<compressed_btree_set<test_t, A, L>> : std::true_type {};
+
+template<typename T, typename R>
+void remove_test(T& s, R& rnd, std::false_type) {}
+
+// Erases erase_percent of the populated values, looks all of them up and
+// iterates the set, then inserts the erased values again, remove_count times.
+// The counts show whether erase left the set consistent.
+template<typename T, typename R>
+void remove_test(T& s, R& rnd, std::true_type)
+{
+  auto erase_count = populate_count * erase_percent / 100;
+  size_t erased = 0;
+  size_t removed_cnt = 0;
+  size_t sum = 0;
+  std::chrono::high_resolution_clock::duration remove{}, hit{}, reinsert{};
+  for (auto m = 0; m < remove_count; ++m)
+  {
+    std::default_random_engine gen(5489);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t n = 0; n < erase_count; ++n)
+    {
+      erased += s.erase(rnd(gen));
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    remove += end - start;
+    gen.seed(5489);
+    start = std::chrono::high_resolution_clock::now();
+    removed_cnt += lookup(s, rnd, gen, std::false_type());
+    sum += scan_set(s, 0);
+    end = std::chrono::high_resolution_clock::now();
+    hit += end - start;
+    gen.seed(5489);
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t n = 0; n < erase_count; ++n)
+    {
+      do_set(s, rnd(gen));
+    }
+    end = std::chrono::high_resolution_clock::now();
+    reinsert += end - start;
+  }
+  elapsed("remove", remove, decltype(remove)());
+  elapsed("removed hit", hit, decltype(hit)());
+  elapsed("reinsert", reinsert, decltype(reinsert)());
+  std::cout << "remove count: " << erased << " " << removed_cnt << " " << s.size() << " sum " << sum << std::endl;
+}
+
+std::string test_name;
+
+template<typename T>
+void test()
+{
+  auto incremental = is_dense_set<T>::value && dense_step > 0 ? "/i" + std::to_string(dense_step) : std::string();
+  auto batch = has_batch_lookup<T>::value && batch_size > 1 ? "/b" + std::to_string(batch_size) : std::string();
+  auto shift = key_shift > 0 ? "/s" + std::to_string(key_shift) : std::string();
+  auto load = has_load_factor<T>::value && max_load > 0 ? "/l" + std::to_string(max_load) : std::string();
+  auto reserve = has_load_factor<T>::value && reserve_count > 0 ? "/r" + std::to_string(reserve_count) : std::string();
+  auto compact = has_compact<T>::value && compact_budget > 0 ? "/c" + std::to_string(compact_budget) : std::string();
+  std::cout << "Testing: " << test_name << incremental << batch << shift << load << reserve << compact << " max " << max_value << " bits " << 64 - __builtin_clzll(max_value) << " cnt " << populate_count;
+#ifdef WRAP_ALLOC
+  std::cout << " wrap_alloc";
+#endif
+#ifdef USE_POOL
+  std::cout << " pool";
+#endif
+  std::cout << std::endl;
+  auto rnd = key_values();
+  pool.reset_counters();
+  auto rss_start = resident_bytes();
+  T s;
+  init_set(s);
+  tune_set(s, has_load_factor<T>());
+  std::default_random_engine generator(5489);
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    if (latency_count == 0)
+    {
+      populate(s, rnd, generator, has_batch_insert<T>());
+    }
+    else
     {
+      // Growing the table inside a single insert shows up as its latency.
+      std::chrono::high_resolution_clock::duration slowest{};
       for (auto n = 0; n < populate_count; ++n)
       {
-        cnt += is_set(s, rnd(generator)) ? 1 : 0;
+        auto v = rnd(generator);
+        auto before = std::chrono::high_resolution_clock::now();
+        do_set(s, v);
+        slowest = std::max(slowest, std::chrono::high_resolution_clock::now() - before);
       }
+      std::cout << "max insert latency, us: " << std::fixed << std::setprecision(3) <<
+        std::chrono::duration_cast<std::chrono::nanoseconds>(slowest).count() / 1000.0 << std::endl;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    if (!is_static_set<T>::value)
+    {
+      pool.report(populate_count * sizeof(test_t));
+      report_rss(rss_start);
+      report_set(s);
+    }
+    elapsed("population", end, start);
+  }
+  if (is_static_set<T>::value)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    build_set(s);
+    auto end = std::chrono::high_resolution_clock::now();
+    pool.report(populate_count * sizeof(test_t));
+    report_rss(rss_start);
+    report_set(s);
+    elapsed("build", end, start);
+  }
+  size_t cnt = 0;
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto h = 0; h < pop_hit_count; ++h)
+    {
+      std::default_random_engine gen(5489);
+      populate(s, rnd, gen, has_batch_insert<T>());
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    elapsed("population hit", end, start);
+  }
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto h = 0; h < hit_count; ++h)
+    {
+      std::default_random_engine gen(5489);
+      cnt += lookup(s, rnd, gen, has_batch_lookup<T>());
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    elapsed("hit", end, start);
+    std::cout << "hit lookups: " << hit_count * populate_count << std::endl;
+  }
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto m = 0; m < miss_count; ++m)
+    {
+      cnt += lookup(s, rnd, generator, has_batch_lookup<T>());
     }
     auto end = std::chrono::high_resolution_clock::now();
     elapsed("miss", end, start);
   }
+  if (scan_count > 0)
+  {
+    size_t sum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto n = 0; n < scan_count; ++n)
+    {
+      sum += scan_set(s, 0);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    elapsed("scan", end, start);
+    std::cout << "scan sum: " << sum << std::endl;
+  }
+  if (rank_count > 0)
+  {
+    rank_test(s, has_order_statistics<T>());
+  }
+  if (setops_count > 0)
+  {
+    set_algebra_test(s, has_set_algebra<T>());
+  }
+  if (mt_threads > 0 && !is_static_set<T>::value)
+  {
+    mt_test(s);
+  }
+  if (image_count > 0)
+  {
+    image_test(s, has_image<T>());
+  }
+  if (remove_count > 0)
+  {
+    remove_test(s, rnd, has_erase<T>());
+  }
+  if (compact_budget > 0)
+  {
+    compact_test(s, rnd, has_compact<T>());
+  }
   std::cout << "hit count: " << cnt << std::endl;
 }
 
+const size_t btree_node_sizes[] = { 128, 256, 512, 1024, 2048, 4096 };
+
+// Node size and alignment other than the default 256 / 0 are appended to the
+// name, e.g. btree::btree_set/1024/a64.
+template<int NodeSize>
+void test_btree()
+{
+  auto name = std::string("btree::btree_set");
+  if (NodeSize != 256 || btree_align != 0)
+  {
+    name += "/" + std::to_string(NodeSize);
+  }
+  if (btree_align != 0)
+  {
+    name += "/a" + std::to_string(btree_align);
+  }
+  test_name = name;
+  switch (btree_align)
+  {
+  case 0: test<typename BtreeOf<NodeSize, 0>::type>(); break;
+  case 64: test<typename BtreeOf<NodeSize, 64>::type>(); break;
+  case 4096: test<typename BtreeOf<NodeSize, 4096>::type>(); break;
+  default: throw std::invalid_argument("align must be 0, 64 or 4096");
+  }
+}
+
+void test_btree(size_t node_size)
+{
+  switch (node_size)
+  {
+  case 128: test_btree<128>(); break;
+  case 256: test_btree<256>(); break;
+  case 512: test_btree<512>(); break;
+  case 1024: test_btree<1024>(); break;
+  case 2048: test_btree<2048>(); break;
+  case 4096: test_btree<4096>(); break;
+  default: throw std::invalid_argument("node must be 128, 256, 512, 1024, 2048 or 4096");
+  }
+}
+
+// With the hash option the set S<H> with the hash function it names, which is
+// appended to the name, e.g. google::dense_hash_set/xxh3, else Default.
+template<template<class> class S, class Default>
+void test_hash()
+{
+  if (hash_function.empty())
+  {
+    test<Default>();
+    return;
+  }
+  test_name += "/" + hash_function;
+  if (hash_function == "std")
+  {
+    test<S<std::hash<test_t>>>();
+  }
+  else if (hash_function == "identity")
+  {
+    test<S<identity_hash<test_t>>>();
+  }
+  else if (hash_function == "multiply_shift")
+  {
+    test<S<multiply_shift_hash<test_t>>>();
+  }
+  else if (hash_function == "murmur3")
+  {
+    test<S<murmur3_hash<test_t>>>();
+  }
+  else if (hash_function == "xxh3")
+  {
+    test<S<xxh3_hash<test_t>>>();
+  }
+  else if (hash_function == "crc32c")
+  {
+    test<S<crc32c_hash<test_t>>>();
+  }
+  else
+  {
+    throw std::invalid_argument("hash must be std, identity, multiply_shift, murmur3, xxh3 or crc32c");
+  }
+}
+
+// Runs f once or, with load_sweep n, once for each max load of n, 2n, ...
+// below 100 percent.
+template<typename F>
+void sweep_loads(const F& f)
+{
+  if (load_sweep == 0)
+  {
+    f();
+    return;
+  }
+  auto name = test_name;
+  auto load = max_load;
+  for (max_load = load_sweep; max_load < 100; max_load += load_sweep)
+  {
+    test_name = name;
+    f();
+  }
+  max_load = load;
+}
+
 struct cmp_by_length {
   template<class T>
   bool operator()(T const &a, T const &b) const {
@@ -546,8 +2007,20 @@ int main(int argc, char** argv)
     option _std = { "s", "set", "std::set" };
     option unordered = { "u", "unordered", "unordered_set", "std::unordered_set" };
     option btree = { "b", "btree", "btree_set", "btree::btree_set" };
+    option btree_bulk = { "bb", "btree_bulk" };
+    option btree_sweep = { "bs", "btree_sweep" };
+    option btree_counted = { "bc", "btree_counted" };
+    option btree_slab = { "bsl", "btree_slab" };
+    option btree_slab_huge = { "bslh", "btree_slab_huge" };
+    option olc_btree = { "olc", "olc_btree", "olc_btree_set" };
     option sparse = { "sp", "sparse", "sparse_hash_set", "google::sparse_hash_set" };
     option dense = { "d", "dense", "dense_hash_set", "google::dense_hash_set" };
+    option dense_linear = { "dl", "dense_linear" };
+    option dense_robin_hood = { "drh", "dense_robin_hood" };
+    option dense_mmap = { "dm", "dense_mmap" };
+    option dense_mmap_huge = { "dmh", "dense_mmap_huge" };
+    option sparse_mmap = { "spm", "sparse_mmap" };
+    option sparse_arena = { "spa", "sparse_arena" };
     option closed = { "c", "closed", "closed_hash_set", "mct::closed_hash_set" };
     option forward = { "f", "forward", "forward_hash_set", "mct::forward_hash_set" };
     option huge_forward = { "hf", "huge_forward", "huge_forward_hash_set", "mct::huge_forward_hash_set" };
@@ -559,16 +2032,35 @@ int main(int argc, char** argv)
     option _unordered_sparse_set = { "uss", "unordered_sparse_set" };
     option concise_set = { "cs", "concise_set" };
     option spp = { "spp", "spp::sparse_hash_set" };
+    option spp_mmap = { "sppm", "spp_mmap" };
     option boost_unordered = { "bu", "boost::unordered_set" };
     option flat_set = { "fs", "flat_set", "boost::flat_set" };
+    option mphf = { "mphf", "mphf_set" };
+    option eytzinger = { "ey", "eytzinger", "eytzinger_set" };
+    option art = { "art", "art_set" };
+    option pgm = { "pgm", "pgm_set" };
+    option quotient = { "qs", "quotient", "quotient_set" };
+    option compressed_btree = { "cb", "compressed_btree", "compressed_btree_set" };
     if (argc == 1)
     {
       std::cout << "Usage: test [<cnt>] [hit <multiplier>] [miss <multiplier>] <type> " << std::endl;
       _std.help();
       unordered.help();
       btree.help();
+      btree_bulk.help();
+      btree_sweep.help();
+      btree_counted.help();
+      btree_slab.help();
+      btree_slab_huge.help();
+      olc_btree.help();
       sparse.help();
       dense.help();
+      dense_linear.help();
+      dense_robin_hood.help();
+      dense_mmap.help();
+      dense_mmap_huge.help();
+      sparse_mmap.help();
+      sparse_arena.help();
       closed.help();
       forward.help();
       huge_forward.help();
@@ -580,17 +2072,63 @@ int main(int argc, char** argv)
       _unordered_sparse_set.help();
       concise_set.help();
       spp.help();
+      spp_mmap.help();
       boost_unordered.help();
       flat_set.help();
+      mphf.help();
+      eytzinger.help();
+      art.help();
+      pgm.help();
+      quotient.help();
+      compressed_btree.help();
       std::cout << " cnt - number of values in set, default: " << amount << std::endl;
       std::cout << " pop_hit cnt  - number of population hit steps, default: 0" << std::endl;
       std::cout << " hit cnt  - number of hit steps, default: 0" << std::endl;
       std::cout << " miss cnt - number of miss steps, default: 0" << std::endl;
+      std::cout << " batch cnt - values per contains_batch call in the hit and miss steps of btree sets, per "
+        "insert_batch and count_batch call in all steps of dense, sparse and closed, default: " << batch_size << std::endl;
+      std::cout << " depth cnt - values dense, sparse and closed hash ahead of a batched lookup: 1 ... 64, default: " <<
+        prefetch_depth << std::endl;
+      std::cout << " scan cnt - number of full iterations over the set, default: 0" << std::endl;
+      std::cout << " rank cnt - number of rank and select steps (btree_counted, bit_vector), default: 0" << std::endl;
+      std::cout << " setops cnt - number of union, intersection and difference steps of btree sets with a second set, "
+        "against std::set_union and friends, default: 0" << std::endl;
+      std::cout << " mt cnt - threads for the shared read and mixed phases, sets other than olc_btree are locked, "
+        "default: 0 (off)" << std::endl;
+      std::cout << " image cnt - save btree and dense sets to " << image_path << ", map it and run one cold and cnt warm hit "
+        "steps, default: 0 (off)" << std::endl;
       std::cout << " max_val cnt - max value in sequence" << std::endl;
       std::cout << " max_bit cnt - max value in sequence = 2^max_bit - 1" << std::endl;
+      std::cout << " eps cnt - error bound of pgm_set model, default: " << pgm_epsilon << std::endl;
+      std::cout << " fill cnt - btree_bulk node fill in percent, default: " << bulk_fill << std::endl;
+      std::cout << " threads cnt - btree_bulk leaf fill threads, dense and sparse rehash threads, default: " <<
+        bulk_threads << std::endl;
+      std::cout << " node cnt - btree_set node size in bytes: 128 ... 4096, default: " << btree_node_size << std::endl;
+      std::cout << " align cnt - btree_set node alignment: 0 (allocator default), 64 or 4096, default: " <<
+        btree_align << std::endl;
+      std::cout << " incremental cnt - dense_hash_set buckets moved per operation while growing, default: 0 (all at "
+        "once)" << std::endl;
+      std::cout << " latency cnt - time each insert of the population step and report the slowest, default: 0 (off)" <<
+        std::endl;
+      std::cout << " hash name - hash function of unordered, dense, dense_linear, dense_robin_hood, sparse, closed, spp "
+        "and boost::unordered_set: std, identity, multiply_shift, murmur3, xxh3 or crc32c, default: the set's own" <<
+        std::endl;
+      std::cout << " shift cnt - use values which are multiples of 2^cnt, default: 0" << std::endl;
+      std::cout << " load cnt - max load factor of hash sets in percent, below 100 but for unordered and "
+        "boost::unordered_set, default: 0 (the set's own)" << std::endl;
+      std::cout << " load_sweep cnt - run each following hash set with a max load factor of cnt, 2 cnt, ... below 100 "
+        "percent, default: 0 (off)" << std::endl;
+      std::cout << " reserve cnt - make room for cnt values in hash sets before the population step, default: 0" <<
+        std::endl;
+      std::cout << " compact us - erase values from dense and sparse hash sets at the end, then compact them with "
+        "calls which take about us microseconds each, default: 0 (off)" << std::endl;
+      std::cout << " remove cnt - number of remove steps, which erase values from std::set, btree sets, art_set and "
+        "compressed_btree, look them up, iterate the set and insert them again, default: 0 (off)" << std::endl;
+      std::cout << " erase cnt - percent of the values the compact and remove steps erase, default: 90" << std::endl;
       return 0;
     }
-    enum CntType { Cnt, PopHit, Hit, Miss, MaxVal, MaxBit } cntType = Cnt;
+    enum CntType { Cnt, PopHit, Hit, Miss, MaxVal, MaxBit, Epsilon, Fill, Threads, Scan, Rank, SetOps, Mt, Image, Batch, Node, Align,
+      Incremental, Latency, Depth, Shift, Load, LoadSweep, Reserve, Compact, Remove, Erase, Hash } cntType = Cnt;
     for (int i = 1; i < argc; ++i)
     {
       std::string s(argv[i]);
@@ -600,35 +2138,86 @@ int main(int argc, char** argv)
       }
       else if (unordered.contains(s))
       {
-        test<std::unordered_set<test_t, std::hash<test_t>, std::equal_to<test_t>, PoolAllocator<test_t>>>();
+        sweep_loads([] { test_hash<UnorderedWith, UnorderedWith<std::hash<test_t>>>(); });
       }
       else if (btree.contains(s))
       {
-        test<btree::btree_set<test_t, std::less<test_t>, PoolAllocator<test_t>>>();
+        test_btree(btree_node_size);
+      }
+      else if (btree_bulk.contains(s))
+      {
+        test<BtreeBulk>();
+      }
+      else if (btree_sweep.contains(s))
+      {
+        for (auto node_size : btree_node_sizes)
+        {
+          test_btree(node_size);
+        }
+      }
+      else if (btree_counted.contains(s))
+      {
+        test<BtreeCounted>();
+      }
+      else if (btree_slab.contains(s))
+      {
+        test<BtreeSlab>();
+      }
+      else if (btree_slab_huge.contains(s))
+      {
+        test<BtreeSlabHuge>();
+      }
+      else if (olc_btree.contains(s))
+      {
+        test<OlcBtree>();
       }
       else if (sparse.contains(s))
       {
-        test<google::sparse_hash_set<test_t, std::hash<test_t>, std::equal_to<test_t>, Reallocator<test_t>>>();
+        sweep_loads([] { test_hash<SparseWith, Sparse>(); });
       }
       else if (dense.contains(s))
       {
-        test<Dense>();
+        sweep_loads([] { test_hash<DenseWith, Dense>(); });
+      }
+      else if (dense_linear.contains(s))
+      {
+        sweep_loads([] { test_hash<DenseLinearWith, DenseLinear>(); });
+      }
+      else if (dense_robin_hood.contains(s))
+      {
+        sweep_loads([] { test_hash<DenseRobinHoodWith, DenseRobinHood>(); });
+      }
+      else if (dense_mmap.contains(s))
+      {
+        sweep_loads([] { test<DenseMmap>(); });
+      }
+      else if (dense_mmap_huge.contains(s))
+      {
+        sweep_loads([] { test<DenseMmapHuge>(); });
+      }
+      else if (sparse_mmap.contains(s))
+      {
+        sweep_loads([] { test<SparseMmap>(); });
+      }
+      else if (sparse_arena.contains(s))
+      {
+        sweep_loads([] { test<SparseArena>(); });
       }
       else if (closed.contains(s))
       {
-        test<mct::closed_hash_set<test_t, std::hash<test_t>, std::equal_to<test_t>, PoolAllocator<test_t>>>();
+        sweep_loads([] { test_hash<ClosedWith, Closed>(); });
       }
       else if (forward.contains(s))
       {
-        test<mct::forward_hash_set<test_t, std::hash<test_t>, std::equal_to<test_t>, PoolAllocator<test_t>>>();
+        sweep_loads([] { test<mct::forward_hash_set<test_t, std::hash<test_t>, std::equal_to<test_t>, PoolAllocator<test_t>>>(); });
       }
       else if (huge_forward.contains(s))
       {
-        test<mct::huge_forward_hash_set<test_t, std::hash<test_t>, std::equal_to<test_t>, PoolAllocator<test_t>>>();
+        sweep_loads([] { test<mct::huge_forward_hash_set<test_t, std::hash<test_t>, std::equal_to<test_t>, PoolAllocator<test_t>>>(); });
       }
       else if (huge_linked.contains(s))
       {
-        test<mct::huge_linked_hash_set<test_t, std::hash<test_t>, std::equal_to<test_t>, PoolAllocator<test_t>>>();
+        sweep_loads([] { test<mct::huge_linked_hash_set<test_t, std::hash<test_t>, std::equal_to<test_t>, PoolAllocator<test_t>>>(); });
       }
       else if (bit_vector.contains(s))
       {
@@ -656,16 +2245,44 @@ int main(int argc, char** argv)
       }
       else if (spp.contains(s))
       {
-        test<spp::sparse_hash_set<test_t, spp::spp_hash<test_t>, std::equal_to<test_t>, SppAllocator<test_t>>>();
+        sweep_loads([] { test_hash<SppWith, Spp>(); });
+      }
+      else if (spp_mmap.contains(s))
+      {
+        sweep_loads([] { test<SppMmap>(); });
       }
       else if (boost_unordered.contains(s))
       {
-        test<boost::unordered_set<test_t, boost::hash<test_t>, std::equal_to<test_t>, PoolAllocator<test_t>>>();
+        sweep_loads([] { test_hash<BoostUnorderedWith, BoostUnorderedWith<boost::hash<test_t>>>(); });
       }
       else if (flat_set.contains(s))
       {
         test<Flat>();
       }
+      else if (mphf.contains(s))
+      {
+        test<Mphf>();
+      }
+      else if (eytzinger.contains(s))
+      {
+        test<Eytzinger>();
+      }
+      else if (art.contains(s))
+      {
+        test<art_set<test_t, PoolAllocator<test_t>>>();
+      }
+      else if (pgm.contains(s))
+      {
+        test<Pgm>();
+      }
+      else if (quotient.contains(s))
+      {
+        test<Quotient>();
+      }
+      else if (compressed_btree.contains(s))
+      {
+        test<CompressedBtree>();
+      }
       else if (s == "pop_hit")
       {
         cntType = PopHit;
@@ -686,6 +2303,99 @@ int main(int argc, char** argv)
       {
         cntType = MaxBit;
       }
+      else if (s == "eps")
+      {
+        cntType = Epsilon;
+      }
+      else if (s == "fill")
+      {
+        cntType = Fill;
+      }
+      else if (s == "threads")
+      {
+        cntType = Threads;
+      }
+      else if (s == "scan")
+      {
+        cntType = Scan;
+      }
+      else if (s == "rank")
+      {
+        cntType = Rank;
+      }
+      else if (s == "setops")
+      {
+        cntType = SetOps;
+      }
+      else if (s == "mt")
+      {
+        cntType = Mt;
+      }
+      else if (s == "image")
+      {
+        cntType = Image;
+      }
+      else if (s == "batch")
+      {
+        cntType = Batch;
+      }
+      else if (s == "node")
+      {
+        cntType = Node;
+      }
+      else if (s == "align")
+      {
+        cntType = Align;
+      }
+      else if (s == "incremental")
+      {
+        cntType = Incremental;
+      }
+      else if (s == "latency")
+      {
+        cntType = Latency;
+      }
+      else if (s == "depth")
+      {
+        cntType = Depth;
+      }
+      else if (s == "shift")
+      {
+        cntType = Shift;
+      }
+      else if (s == "load")
+      {
+        cntType = Load;
+      }
+      else if (s == "load_sweep")
+      {
+        cntType = LoadSweep;
+      }
+      else if (s == "reserve")
+      {
+        cntType = Reserve;
+      }
+      else if (s == "compact")
+      {
+        cntType = Compact;
+      }
+      else if (s == "remove")
+      {
+        cntType = Remove;
+      }
+      else if (s == "erase")
+      {
+        cntType = Erase;
+      }
+      else if (s == "hash")
+      {
+        cntType = Hash;
+      }
+      else if (cntType == Hash)
+      {
+        hash_function = s;
+        cntType = Cnt;
+      }
       else
       {
         auto n = std::stoull(s);
@@ -696,7 +2406,41 @@ int main(int argc, char** argv)
         case Hit: hit_count = n; break;
         case Miss: miss_count = n; break;
         case MaxVal: max_value = static_cast<test_t>(n); break;
-        case MaxBit: max_value = static_cast<test_t>(n > 63 ? std::numeric_limits<uint64_t>::max() : (1 << n) - 1); break;
+        case MaxBit: max_value = static_cast<test_t>(n > 63 ? std::numeric_limits<uint64_t>::max() : (1ULL << n) - 1); break;
+        case Epsilon: pgm_epsilon = n; break;
+        case Fill: bulk_fill = n; break;
+        case Threads: bulk_threads = n; break;
+        case Scan: scan_count = n; break;
+        case Rank: rank_count = n; break;
+        case SetOps: setops_count = n; break;
+        case Mt: mt_threads = n; break;
+        case Image: image_count = n; break;
+        case Batch: batch_size = n; break;
+        case Node: btree_node_size = n; break;
+        case Align: btree_align = n; break;
+        case Incremental: dense_step = n; break;
+        case Latency: latency_count = n; break;
+        case Depth: prefetch_depth = n; break;
+        case Shift:
+          if (n >= 8 * sizeof(test_t))
+          {
+            throw std::invalid_argument("shift must be less than the bits of a value");
+          }
+          key_shift = n;
+          break;
+        case Load: max_load = n; break;
+        case LoadSweep: load_sweep = n; break;
+        case Reserve: reserve_count = n; break;
+        case Compact: compact_budget = n; break;
+        case Remove: remove_count = n; break;
+        case Erase:
+          if (n > 100)
+          {
+            throw std::invalid_argument("erase must be at most 100 percent");
+          }
+          erase_percent = n;
+          break;
+        case Hash: break;
         }
         cntType = Cnt;
       }
@@ -0,0 +1,867 @@
+// Adaptive radix tree (ART) set of integral keys.
+//
+// Keys are treated as 8 big-endian bytes, so the order of the tree is the
+// order of the keys. Inner nodes grow and shrink between four layouts
+// (Node4, Node16, Node48 and Node256) as children are added and removed, and
+// every node remembers the whole key prefix above it, so chains of single
+// child nodes are never created (path compression). Leaves are not
+// allocated: a child slot of a node branching on byte d holds the remaining
+// 7 - d key bytes tagged with the low bit. Memory therefore falls as keys
+// cluster and the tree never holds more than 8 levels.
+//
+// Supports insert, find, erase, lower_bound and ordered iteration.
+
+#ifndef ART_SET_H
+#define ART_SET_H
+
+#include <stdint.h>
+#include <string.h>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ART_SSE2 1
+#endif
+
+namespace art
+{
+  enum node_type : uint8_t { node4_type, node16_type, node48_type, node256_type };
+
+  struct node
+  {
+    uint8_t type;
+    // Index of the key byte this node branches on.
+    uint8_t depth;
+    uint16_t count;
+    // Key bytes before depth, the lower bytes are zero.
+    uint64_t prefix;
+  };
+
+  // A child slot is 0 when empty, a leaf when the low bit is set and a node
+  // pointer otherwise.
+  typedef uint64_t slot;
+
+  struct node4 : node
+  {
+    uint8_t keys[4];
+    slot children[4];
+  };
+
+  struct node16 : node
+  {
+    uint8_t keys[16];
+    slot children[16];
+  };
+
+  struct node48 : node
+  {
+    // Position + 1 in children, 0 for a missing byte.
+    uint8_t index[256];
+    slot children[48];
+  };
+
+  struct node256 : node
+  {
+    slot children[256];
+  };
+
+  inline unsigned ctz(uint32_t x)
+  {
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanForward(&r, x);
+    return r;
+#else
+    return __builtin_ctz(x);
+#endif
+  }
+
+  inline unsigned clz(uint64_t x)
+  {
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanReverse64(&r, x);
+    return 63 - r;
+#else
+    return __builtin_clzll(x);
+#endif
+  }
+
+  inline unsigned popcount(uint32_t x)
+  {
+#ifdef _MSC_VER
+    return __popcnt(x);
+#else
+    return __builtin_popcount(x);
+#endif
+  }
+
+  // Mask of the first bytes of a key.
+  inline uint64_t high_mask(unsigned bytes) { return bytes == 0 ? 0 : ~0ULL << (64 - 8 * bytes); }
+  // Mask of the last bytes of a key.
+  inline uint64_t low_mask(unsigned bytes) { return bytes >= 8 ? ~0ULL : (1ULL << (8 * bytes)) - 1; }
+  inline unsigned key_byte(uint64_t k, unsigned depth) { return static_cast<uint8_t>(k >> (56 - 8 * depth)); }
+
+  inline bool is_leaf(slot s) { return (s & 1) != 0; }
+  inline node* to_node(slot s) { return reinterpret_cast<node*>(static_cast<uintptr_t>(s)); }
+  inline slot to_slot(node* n) { return static_cast<slot>(reinterpret_cast<uintptr_t>(n)); }
+  // Leaf under a node branching on byte depth.
+  inline slot make_leaf(uint64_t k, unsigned depth) { return ((k & low_mask(7 - depth)) << 1) | 1; }
+  inline uint64_t leaf_key(const node* n, unsigned byte, slot s)
+  {
+    return n->prefix | (static_cast<uint64_t>(byte) << (56 - 8 * n->depth)) | (s >> 1);
+  }
+
+  inline size_t node_size(uint8_t type)
+  {
+    switch (type)
+    {
+    case node4_type: return sizeof(node4);
+    case node16_type: return sizeof(node16);
+    case node48_type: return sizeof(node48);
+    default: return sizeof(node256);
+    }
+  }
+
+  // Position of the child for byte b, -1 if none. Positions are indexes for
+  // Node4/Node16 and byte values for Node48/Node256.
+  inline int child_find(const node* n, unsigned b)
+  {
+    switch (n->type)
+    {
+    case node4_type:
+    {
+      auto p = static_cast<const node4*>(n);
+      for (int i = 0; i < p->count; ++i)
+      {
+        if (p->keys[i] == b)
+        {
+          return i;
+        }
+      }
+      return -1;
+    }
+    case node16_type:
+    {
+      auto p = static_cast<const node16*>(n);
+#ifdef ART_SSE2
+      auto cmp = _mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(b)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p->keys)));
+      auto mask = static_cast<uint32_t>(_mm_movemask_epi8(cmp)) & ((1u << p->count) - 1);
+      return mask ? static_cast<int>(ctz(mask)) : -1;
+#else
+      for (int i = 0; i < p->count; ++i)
+      {
+        if (p->keys[i] == b)
+        {
+          return i;
+        }
+      }
+      return -1;
+#endif
+    }
+    case node48_type:
+      return static_cast<const node48*>(n)->index[b] ? static_cast<int>(b) : -1;
+    default:
+      return static_cast<const node256*>(n)->children[b] ? static_cast<int>(b) : -1;
+    }
+  }
+
+  // Position of the first child with byte >= b, -1 if none.
+  inline int child_lower(const node* n, unsigned b)
+  {
+    switch (n->type)
+    {
+    case node4_type:
+    {
+      auto p = static_cast<const node4*>(n);
+      for (int i = 0; i < p->count; ++i)
+      {
+        if (p->keys[i] >= b)
+        {
+          return i;
+        }
+      }
+      return -1;
+    }
+    case node16_type:
+    {
+      auto p = static_cast<const node16*>(n);
+#ifdef ART_SSE2
+      // Unsigned compare through the sign bit flip.
+      auto bias = _mm_set1_epi8(static_cast<char>(0x80));
+      auto keys = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p->keys)), bias);
+      auto probe = _mm_xor_si128(_mm_set1_epi8(static_cast<char>(b)), bias);
+      auto less = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmplt_epi8(keys, probe))) & ((1u << p->count) - 1);
+      int i = static_cast<int>(popcount(less));
+      return i < p->count ? i : -1;
+#else
+      for (int i = 0; i < p->count; ++i)
+      {
+        if (p->keys[i] >= b)
+        {
+          return i;
+        }
+      }
+      return -1;
+#endif
+    }
+    case node48_type:
+    {
+      auto p = static_cast<const node48*>(n);
+      for (; b < 256; ++b)
+      {
+        if (p->index[b])
+        {
+          return static_cast<int>(b);
+        }
+      }
+      return -1;
+    }
+    default:
+    {
+      auto p = static_cast<const node256*>(n);
+      for (; b < 256; ++b)
+      {
+        if (p->children[b])
+        {
+          return static_cast<int>(b);
+        }
+      }
+      return -1;
+    }
+    }
+  }
+
+  // Position of the child after pos, -1 if none.
+  inline int child_next(const node* n, int pos)
+  {
+    if (n->type == node4_type || n->type == node16_type)
+    {
+      return pos + 1 < n->count ? pos + 1 : -1;
+    }
+    return pos < 255 ? child_lower(n, pos + 1) : -1;
+  }
+
+  inline unsigned byte_at(const node* n, int pos)
+  {
+    switch (n->type)
+    {
+    case node4_type: return static_cast<const node4*>(n)->keys[pos];
+    case node16_type: return static_cast<const node16*>(n)->keys[pos];
+    default: return static_cast<unsigned>(pos);
+    }
+  }
+
+  inline slot* child_slot(node* n, int pos)
+  {
+    switch (n->type)
+    {
+    case node4_type: return &static_cast<node4*>(n)->children[pos];
+    case node16_type: return &static_cast<node16*>(n)->children[pos];
+    case node48_type:
+    {
+      auto p = static_cast<node48*>(n);
+      return &p->children[p->index[pos] - 1];
+    }
+    default: return &static_cast<node256*>(n)->children[pos];
+    }
+  }
+
+  inline slot child_at(const node* n, int pos) { return *child_slot(const_cast<node*>(n), pos); }
+
+  // Sorted insert into the arrays of a Node4/Node16 with room left.
+  template<class N>
+  void insert_sorted(N* p, unsigned b, slot child)
+  {
+    int i = p->count;
+    while (i > 0 && p->keys[i - 1] > b)
+    {
+      p->keys[i] = p->keys[i - 1];
+      p->children[i] = p->children[i - 1];
+      --i;
+    }
+    p->keys[i] = static_cast<uint8_t>(b);
+    p->children[i] = child;
+    ++p->count;
+  }
+
+  template<class N>
+  void remove_sorted(N* p, int pos)
+  {
+    for (int i = pos + 1; i < p->count; ++i)
+    {
+      p->keys[i - 1] = p->keys[i];
+      p->children[i - 1] = p->children[i];
+    }
+    --p->count;
+    p->children[p->count] = 0;
+  }
+} // art
+
+template<class Key = uint64_t, class Alloc = std::allocator<Key>>
+class art_set
+{
+  static_assert(std::is_integral<Key>::value && sizeof(Key) <= 8, "art_set supports integral keys up to 64 bits");
+
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<char> char_allocator;
+
+  // Signed keys are biased so that byte order matches key order.
+  static uint64_t to_bits(Key k)
+  {
+    return std::is_signed<Key>::value ?
+      static_cast<uint64_t>(static_cast<int64_t>(k)) ^ (1ULL << 63) : static_cast<uint64_t>(k);
+  }
+  static Key from_bits(uint64_t k)
+  {
+    return std::is_signed<Key>::value ?
+      static_cast<Key>(static_cast<int64_t>(k ^ (1ULL << 63))) : static_cast<Key>(k);
+  }
+
+public:
+  typedef Key key_type;
+  typedef Key value_type;
+  typedef size_t size_type;
+
+  class const_iterator
+  {
+    struct frame
+    {
+      const art::node* n;
+      int pos;
+    };
+
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Key value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const Key* pointer;
+    typedef const Key& reference;
+
+    reference operator*() const { return _value; }
+    pointer operator->() const { return &_value; }
+    const_iterator& operator++()
+    {
+      advance();
+      return *this;
+    }
+    const_iterator operator++(int)
+    {
+      auto tmp = *this;
+      advance();
+      return tmp;
+    }
+    bool operator==(const const_iterator& x) const
+    {
+      return _size == x._size && (_size == 0 ||
+        (_stack[_size - 1].n == x._stack[_size - 1].n && _stack[_size - 1].pos == x._stack[_size - 1].pos));
+    }
+    bool operator!=(const const_iterator& x) const { return !(*this == x); }
+
+  private:
+    friend class art_set;
+
+    void push(const art::node* n, int pos)
+    {
+      _stack[_size].n = n;
+      _stack[_size].pos = pos;
+      ++_size;
+    }
+
+    void set_key()
+    {
+      auto& f = _stack[_size - 1];
+      _key = art::leaf_key(f.n, art::byte_at(f.n, f.pos), art::child_at(f.n, f.pos));
+      _value = from_bits(_key);
+    }
+
+    void descend_min(const art::node* n)
+    {
+      for (;;)
+      {
+        auto pos = art::child_lower(n, 0);
+        push(n, pos);
+        auto c = art::child_at(n, pos);
+        if (art::is_leaf(c))
+        {
+          set_key();
+          return;
+        }
+        n = art::to_node(c);
+      }
+    }
+
+    void advance()
+    {
+      while (_size > 0)
+      {
+        auto& f = _stack[_size - 1];
+        auto pos = art::child_next(f.n, f.pos);
+        if (pos >= 0)
+        {
+          f.pos = pos;
+          auto c = art::child_at(f.n, pos);
+          if (art::is_leaf(c))
+          {
+            set_key();
+          }
+          else
+          {
+            descend_min(art::to_node(c));
+          }
+          return;
+        }
+        --_size;
+      }
+    }
+
+    // Every node branches on a later byte than its parent.
+    frame _stack[8];
+    int _size = 0;
+    uint64_t _key = 0;
+    Key _value = Key();
+  };
+  typedef const_iterator iterator;
+
+  art_set(const Alloc& alloc = Alloc()) : _alloc(alloc) {}
+  art_set(const art_set&) = delete;
+  art_set& operator=(const art_set&) = delete;
+  ~art_set() { clear(); }
+
+  bool insert(const Key& key)
+  {
+    auto k = to_bits(key);
+    if (_root == 0)
+    {
+      auto n = new_node<art::node4>(art::node4_type, 7, k & art::high_mask(7));
+      art::insert_sorted(n, art::key_byte(k, 7), art::make_leaf(k, 7));
+      _root = art::to_slot(n);
+      ++_size;
+      return true;
+    }
+    auto s = &_root;
+    int parent_depth = -1;
+    for (;;)
+    {
+      auto c = *s;
+      if (art::is_leaf(c))
+      {
+        auto existing = (k & art::high_mask(parent_depth + 1)) | (c >> 1);
+        if (existing == k)
+        {
+          return false;
+        }
+        auto depth = art::clz(existing ^ k) / 8;
+        auto n = new_node<art::node4>(art::node4_type, depth, k & art::high_mask(depth));
+        art::insert_sorted(n, art::key_byte(existing, depth), art::make_leaf(existing, depth));
+        art::insert_sorted(n, art::key_byte(k, depth), art::make_leaf(k, depth));
+        *s = art::to_slot(n);
+        ++_size;
+        return true;
+      }
+      auto n = art::to_node(c);
+      auto diff = (k ^ n->prefix) & art::high_mask(n->depth);
+      if (diff != 0)
+      {
+        // The key leaves the compressed path above n: split it. The root may
+        // be a Node4 holding a single leaf, which goes under the new node as
+        // that leaf, so that every node below the root keeps two children
+        // and erase never leaves an empty one behind.
+        auto depth = art::clz(diff) / 8;
+        auto p = new_node<art::node4>(art::node4_type, depth, k & art::high_mask(depth));
+        auto b = art::key_byte(n->prefix, depth);
+        if (n->type == art::node4_type && n->count == 1 && art::is_leaf(art::child_at(n, 0)))
+        {
+          auto q = static_cast<art::node4*>(n);
+          c = art::make_leaf(art::leaf_key(q, q->keys[0], q->children[0]), depth);
+          free_node(q);
+        }
+        art::insert_sorted(p, b, c);
+        art::insert_sorted(p, art::key_byte(k, depth), art::make_leaf(k, depth));
+        *s = art::to_slot(p);
+        ++_size;
+        return true;
+      }
+      auto b = art::key_byte(k, n->depth);
+      auto pos = art::child_find(n, b);
+      if (pos < 0)
+      {
+        add_child(s, n, b, art::make_leaf(k, n->depth));
+        ++_size;
+        return true;
+      }
+      s = art::child_slot(n, pos);
+      parent_depth = n->depth;
+    }
+  }
+
+  size_type erase(const Key& key)
+  {
+    auto k = to_bits(key);
+    auto s = &_root;
+    int parent_depth = -1;
+    while (*s != 0)
+    {
+      auto n = art::to_node(*s);
+      if (((k ^ n->prefix) & art::high_mask(n->depth)) != 0)
+      {
+        return 0;
+      }
+      auto b = art::key_byte(k, n->depth);
+      auto pos = art::child_find(n, b);
+      if (pos < 0)
+      {
+        return 0;
+      }
+      auto cs = art::child_slot(n, pos);
+      if (art::is_leaf(*cs))
+      {
+        if (*cs != art::make_leaf(k, n->depth))
+        {
+          return 0;
+        }
+        remove_child(s, n, pos, parent_depth);
+        --_size;
+        return 1;
+      }
+      s = cs;
+      parent_depth = n->depth;
+    }
+    return 0;
+  }
+
+  const_iterator find(const Key& key) const
+  {
+    auto k = to_bits(key);
+    const_iterator it;
+    auto c = _root;
+    while (c != 0)
+    {
+      auto n = art::to_node(c);
+      if (((k ^ n->prefix) & art::high_mask(n->depth)) != 0)
+      {
+        break;
+      }
+      auto pos = art::child_find(n, art::key_byte(k, n->depth));
+      if (pos < 0)
+      {
+        break;
+      }
+      it.push(n, pos);
+      c = art::child_at(n, pos);
+      if (art::is_leaf(c))
+      {
+        if (c == art::make_leaf(k, n->depth))
+        {
+          it._key = k;
+          it._value = key;
+          return it;
+        }
+        break;
+      }
+    }
+    return end();
+  }
+
+  size_type count(const Key& key) const { return find(key) != end() ? 1 : 0; }
+
+  // First key not less than key.
+  const_iterator lower_bound(const Key& key) const
+  {
+    auto k = to_bits(key);
+    const_iterator it;
+    if (_root == 0)
+    {
+      return it;
+    }
+    auto n = art::to_node(_root);
+    for (;;)
+    {
+      auto node_prefix = n->prefix;
+      auto key_prefix = k & art::high_mask(n->depth);
+      if (node_prefix != key_prefix)
+      {
+        // The whole subtree is either above or below the key.
+        if (node_prefix > key_prefix)
+        {
+          it.descend_min(n);
+        }
+        else
+        {
+          it.advance();
+        }
+        return it;
+      }
+      auto b = art::key_byte(k, n->depth);
+      auto pos = art::child_lower(n, b);
+      if (pos < 0)
+      {
+        it.advance();
+        return it;
+      }
+      it.push(n, pos);
+      auto c = art::child_at(n, pos);
+      if (art::is_leaf(c))
+      {
+        it.set_key();
+        if (it._key < k)
+        {
+          it.advance();
+        }
+        return it;
+      }
+      if (art::byte_at(n, pos) > b)
+      {
+        it.descend_min(art::to_node(c));
+        return it;
+      }
+      n = art::to_node(c);
+    }
+  }
+
+  const_iterator begin() const
+  {
+    const_iterator it;
+    if (_root != 0)
+    {
+      it.descend_min(art::to_node(_root));
+    }
+    return it;
+  }
+  const_iterator end() const { return const_iterator(); }
+
+  size_type size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  void clear()
+  {
+    if (_root != 0)
+    {
+      clear(art::to_node(_root));
+    }
+    _root = 0;
+    _size = 0;
+  }
+
+  size_t bytes_used() const { return sizeof(*this) + _bytes; }
+
+private:
+  template<class N>
+  N* new_node(art::node_type type, unsigned depth, uint64_t prefix)
+  {
+    auto n = reinterpret_cast<N*>(_alloc.allocate(sizeof(N)));
+    memset(n, 0, sizeof(N));
+    n->type = type;
+    n->depth = static_cast<uint8_t>(depth);
+    n->prefix = prefix;
+    _bytes += sizeof(N);
+    return n;
+  }
+
+  void free_node(art::node* n)
+  {
+    auto sz = art::node_size(n->type);
+    _bytes -= sz;
+    _alloc.deallocate(reinterpret_cast<char*>(n), sz);
+  }
+
+  void clear(art::node* n)
+  {
+    for (auto pos = art::child_lower(n, 0); pos >= 0; pos = art::child_next(n, pos))
+    {
+      auto c = art::child_at(n, pos);
+      if (!art::is_leaf(c))
+      {
+        clear(art::to_node(c));
+      }
+    }
+    free_node(n);
+  }
+
+  // Adds a child to the node in slot s, growing the node when it is full.
+  void add_child(art::slot* s, art::node* n, unsigned b, art::slot child)
+  {
+    switch (n->type)
+    {
+    case art::node4_type:
+    {
+      auto p = static_cast<art::node4*>(n);
+      if (p->count < 4)
+      {
+        art::insert_sorted(p, b, child);
+        return;
+      }
+      auto g = new_node<art::node16>(art::node16_type, p->depth, p->prefix);
+      memcpy(g->keys, p->keys, sizeof(p->keys));
+      memcpy(g->children, p->children, sizeof(p->children));
+      g->count = p->count;
+      art::insert_sorted(g, b, child);
+      *s = art::to_slot(g);
+      free_node(p);
+      return;
+    }
+    case art::node16_type:
+    {
+      auto p = static_cast<art::node16*>(n);
+      if (p->count < 16)
+      {
+        art::insert_sorted(p, b, child);
+        return;
+      }
+      auto g = new_node<art::node48>(art::node48_type, p->depth, p->prefix);
+      for (int i = 0; i < p->count; ++i)
+      {
+        g->index[p->keys[i]] = static_cast<uint8_t>(i + 1);
+        g->children[i] = p->children[i];
+      }
+      g->count = p->count;
+      *s = art::to_slot(g);
+      free_node(p);
+      add_child(s, g, b, child);
+      return;
+    }
+    case art::node48_type:
+    {
+      auto p = static_cast<art::node48*>(n);
+      if (p->count < 48)
+      {
+        int i = 0;
+        while (p->children[i] != 0)
+        {
+          ++i;
+        }
+        p->children[i] = child;
+        p->index[b] = static_cast<uint8_t>(i + 1);
+        ++p->count;
+        return;
+      }
+      auto g = new_node<art::node256>(art::node256_type, p->depth, p->prefix);
+      for (int i = 0; i < 256; ++i)
+      {
+        if (p->index[i])
+        {
+          g->children[i] = p->children[p->index[i] - 1];
+        }
+      }
+      g->count = p->count;
+      *s = art::to_slot(g);
+      free_node(p);
+      add_child(s, g, b, child);
+      return;
+    }
+    default:
+    {
+      auto p = static_cast<art::node256*>(n);
+      p->children[b] = child;
+      ++p->count;
+      return;
+    }
+    }
+  }
+
+  // Removes the child at pos from the node in slot s, shrinking the node or
+  // collapsing it into its parent slot when it gets too small.
+  void remove_child(art::slot* s, art::node* n, int pos, int parent_depth)
+  {
+    switch (n->type)
+    {
+    case art::node4_type:
+    {
+      auto p = static_cast<art::node4*>(n);
+      art::remove_sorted(p, pos);
+      if (p->count == 0)
+      {
+        *s = 0;
+        free_node(p);
+      }
+      else if (p->count == 1)
+      {
+        auto c = p->children[0];
+        if (!art::is_leaf(c))
+        {
+          *s = c;
+          free_node(p);
+        }
+        else if (parent_depth >= 0)
+        {
+          *s = art::make_leaf(art::leaf_key(p, p->keys[0], c), parent_depth);
+          free_node(p);
+        }
+        // The root keeps a single leaf in a Node4, which insert turns into a
+        // leaf once the root moves below a new node.
+      }
+      return;
+    }
+    case art::node16_type:
+    {
+      auto p = static_cast<art::node16*>(n);
+      art::remove_sorted(p, pos);
+      if (p->count <= 3)
+      {
+        auto g = new_node<art::node4>(art::node4_type, p->depth, p->prefix);
+        memcpy(g->keys, p->keys, sizeof(g->keys));
+        memcpy(g->children, p->children, sizeof(g->children));
+        g->count = p->count;
+        *s = art::to_slot(g);
+        free_node(p);
+      }
+      return;
+    }
+    case art::node48_type:
+    {
+      auto p = static_cast<art::node48*>(n);
+      p->children[p->index[pos] - 1] = 0;
+      p->index[pos] = 0;
+      --p->count;
+      if (p->count <= 12)
+      {
+        auto g = new_node<art::node16>(art::node16_type, p->depth, p->prefix);
+        for (int i = 0; i < 256; ++i)
+        {
+          if (p->index[i])
+          {
+            g->keys[g->count] = static_cast<uint8_t>(i);
+            g->children[g->count] = p->children[p->index[i] - 1];
+            ++g->count;
+          }
+        }
+        *s = art::to_slot(g);
+        free_node(p);
+      }
+      return;
+    }
+    default:
+    {
+      auto p = static_cast<art::node256*>(n);
+      p->children[pos] = 0;
+      --p->count;
+      if (p->count <= 36)
+      {
+        auto g = new_node<art::node48>(art::node48_type, p->depth, p->prefix);
+        for (int i = 0; i < 256; ++i)
+        {
+          if (p->children[i])
+          {
+            g->children[g->count] = p->children[i];
+            g->index[i] = static_cast<uint8_t>(++g->count);
+          }
+        }
+        *s = art::to_slot(g);
+        free_node(p);
+      }
+      return;
+    }
+    }
+  }
+
+  char_allocator _alloc;
+  art::slot _root = 0;
+  size_t _size = 0;
+  size_t _bytes = 0;
+};
+
+#endif // ART_SET_H
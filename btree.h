@@ -102,6 +102,7 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 #include <algorithm>
@@ -113,13 +114,36 @@
 #include <new>
 #include <ostream>
 #include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #if defined(_MSC_VER)
 #include <BaseTsd.h>
+#include <intrin.h>
 typedef SSIZE_T ssize_t;
 #endif
 
+// Define BTREE_SIMD to search nodes of 4 and 8 byte integral keys with
+// vector compares. It needs a target with AVX2 (-mavx2 or -march=native,
+// /arch:AVX2 with MSVC, which Build.cmd does not pass) or, with gcc and
+// clang, SSE4.2; otherwise the scalar searches are used. It is off by
+// default: it pays off while the tree fits in the cache, but on 20M keys
+// it was slower than the scalar linear search.
+#if defined(BTREE_SIMD) && defined(__AVX2__)
+#define BTREE_AVX2 1
+#include <immintrin.h>
+#elif defined(BTREE_SIMD) && defined(__SSE4_2__)
+#define BTREE_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#define BTREE_PREFETCH(p) _mm_prefetch(reinterpret_cast<const char*>(p), _MM_HINT_T0)
+#else
+#define BTREE_PREFETCH(p) __builtin_prefetch(p)
+#endif
+
 #ifndef NDEBUG
 #define NDEBUG 1
 #endif
@@ -272,8 +296,22 @@ static bool btree_compare_keys(
   return key_comparer::bool_compare(comp, x, y);
 }
 
+// Passes the node sizes of a btree to an allocator which keeps a size class
+// for each of them, see btree_slab_allocator.h. Allocators without
+// set_node_sizes() are left alone.
+template <typename Alloc>
+static auto btree_set_node_sizes(Alloc *alloc, size_t leaf, size_t internal,
+                                 int)
+    -> decltype(alloc->set_node_sizes(leaf, internal), void()) {
+  alloc->set_node_sizes(leaf, internal);
+}
+template <typename Alloc>
+static void btree_set_node_sizes(Alloc*, size_t, size_t, long) {
+}
+
 template <typename Key, typename Compare,
-          typename Alloc, int TargetNodeSize, int ValueSize>
+          typename Alloc, int TargetNodeSize, int ValueSize,
+          bool Counted = false>
 struct btree_common_params {
   // If Compare is derived from btree_key_compare_to_tag then use it as the
   // key_compare type. Otherwise, use btree_key_compare_to_adapter<> which will
@@ -293,6 +331,10 @@ struct btree_common_params {
   enum {
     kTargetNodeSize = TargetNodeSize,
 
+    // Whether internal nodes keep the number of values below each child,
+    // which is what rank() and select() need.
+    kCounted = Counted,
+
     // Available space for values.  This is largest for leaf nodes,
     // which has overhead no fewer than two pointers.
     kNodeValueSpace = TargetNodeSize - 2 * sizeof(void*),
@@ -334,10 +376,11 @@ struct btree_map_params
 };
 
 // A parameters structure for holding the type parameters for a btree_set.
-template <typename Key, typename Compare, typename Alloc, int TargetNodeSize>
+template <typename Key, typename Compare, typename Alloc, int TargetNodeSize,
+          bool Counted = false>
 struct btree_set_params
     : public btree_common_params<Key, Compare, Alloc, TargetNodeSize,
-                                 sizeof(Key)> {
+                                 sizeof(Key), Counted> {
   typedef std::false_type data_type;
   typedef std::false_type mapped_type;
   typedef Key value_type;
@@ -425,6 +468,163 @@ struct btree_binary_search_compare_to {
   }
 };
 
+#if defined(BTREE_AVX2) || defined(BTREE_SSE42)
+
+// Index of the lowest set bit of x, which must not be 0.
+inline int btree_ctz(unsigned x) {
+#if defined(_MSC_VER)
+  unsigned long i;
+  _BitScanForward(&i, x);
+  return static_cast<int>(i);
+#else
+  return __builtin_ctz(x);
+#endif
+}
+
+// Vector operations on keys of Size bytes. greater() returns a bit per lane,
+// set where the lane of a is greater than the lane of b as signed integers.
+template <int Size>
+struct btree_simd_lanes;
+
+#if defined(BTREE_AVX2)
+template <>
+struct btree_simd_lanes<8> {
+  typedef __m256i vec;
+  enum { kLanes = 4, kMask = 0xf };
+  static const uint64_t kSignBit = 1ULL << 63;
+  static vec set1(uint64_t x) {
+    return _mm256_set1_epi64x(static_cast<long long>(x));
+  }
+  static vec load(const void *p) {
+    return _mm256_loadu_si256(static_cast<const __m256i*>(p));
+  }
+  static vec bit_xor(vec a, vec b) { return _mm256_xor_si256(a, b); }
+  static int greater(vec a, vec b) {
+    return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(a, b)));
+  }
+};
+
+template <>
+struct btree_simd_lanes<4> {
+  typedef __m256i vec;
+  enum { kLanes = 8, kMask = 0xff };
+  static const uint64_t kSignBit = 1ULL << 31;
+  static vec set1(uint64_t x) {
+    return _mm256_set1_epi32(static_cast<int>(x));
+  }
+  static vec load(const void *p) {
+    return _mm256_loadu_si256(static_cast<const __m256i*>(p));
+  }
+  static vec bit_xor(vec a, vec b) { return _mm256_xor_si256(a, b); }
+  static int greater(vec a, vec b) {
+    return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(a, b)));
+  }
+};
+#else
+template <>
+struct btree_simd_lanes<8> {
+  typedef __m128i vec;
+  enum { kLanes = 2, kMask = 0x3 };
+  static const uint64_t kSignBit = 1ULL << 63;
+  static vec set1(uint64_t x) {
+    return _mm_set1_epi64x(static_cast<long long>(x));
+  }
+  static vec load(const void *p) {
+    return _mm_loadu_si128(static_cast<const __m128i*>(p));
+  }
+  static vec bit_xor(vec a, vec b) { return _mm_xor_si128(a, b); }
+  static int greater(vec a, vec b) {
+    return _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(a, b)));
+  }
+};
+
+template <>
+struct btree_simd_lanes<4> {
+  typedef __m128i vec;
+  enum { kLanes = 4, kMask = 0xf };
+  static const uint64_t kSignBit = 1ULL << 31;
+  static vec set1(uint64_t x) {
+    return _mm_set1_epi32(static_cast<int>(x));
+  }
+  static vec load(const void *p) {
+    return _mm_loadu_si128(static_cast<const __m128i*>(p));
+  }
+  static vec bit_xor(vec a, vec b) { return _mm_xor_si128(a, b); }
+  static int greater(vec a, vec b) {
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a, b)));
+  }
+};
+#endif
+
+// True for btree_set nodes of 4 or 8 byte integral keys ordered by
+// std::less, the only nodes whose keys can be compared as a packed array.
+template <typename Key, typename Value, typename Compare>
+struct btree_is_simd_searchable {
+  enum {
+    value = std::is_integral<Key>::value &&
+        (sizeof(Key) == 4 || sizeof(Key) == 8) &&
+        std::is_same<Key, Value>::value &&
+        (std::is_same<Compare, std::less<Key> >::value ||
+         std::is_same<Compare,
+             btree_key_compare_to_adapter<std::less<Key> > >::value)
+  };
+};
+
+// Dispatch helper class for searching integral keys with vector compares.
+// Every step compares a vector of keys with the probe. As the keys are
+// sorted, the lanes not sorting before it are a suffix of the vector, and
+// the first vector which has one holds the position: the ctz of its
+// movemask. Like the scalar linear search it stops there, so only the
+// lines of the node up to the position are read. The tail which does not
+// fill a vector is searched one key at a time, nothing is read past the
+// last value of the node.
+template <typename K, typename N, typename Compare>
+struct btree_simd_search_plain_compare {
+  static int lower_bound(const K &k, const N &n, Compare) {
+    return search<false>(k, n);
+  }
+  static int upper_bound(const K &k, const N &n, Compare) {
+    return search<true>(k, n);
+  }
+
+  template <bool Upper>
+  static int search(const K &k, const N &n) {
+    typedef btree_simd_lanes<sizeof(K)> lanes;
+    typedef typename lanes::vec vec;
+    const K *keys = &n.key(0);
+    const int count = n.count();
+    // Unsigned keys are compared as signed after flipping the sign bit.
+    const vec bias =
+        lanes::set1(std::is_signed<K>::value ? 0 : lanes::kSignBit);
+    const vec x = lanes::bit_xor(lanes::set1(static_cast<uint64_t>(k)), bias);
+    int i = 0;
+    for (; i + lanes::kLanes <= count; i += lanes::kLanes) {
+      const vec v = lanes::bit_xor(lanes::load(keys + i), bias);
+      // Lanes at or after the position: key > k for Upper, else key >= k.
+      const int mask = Upper ? lanes::greater(v, x)
+                             : ~lanes::greater(x, v) & lanes::kMask;
+      if (mask != 0) {
+        return i + btree_ctz(mask);
+      }
+    }
+    for (; i < count; ++i) {
+      if (Upper ? k < keys[i] : !(keys[i] < k)) {
+        break;
+      }
+    }
+    return i;
+  }
+};
+#else
+template <typename Key, typename Value, typename Compare>
+struct btree_is_simd_searchable {
+  enum { value = false };
+};
+
+template <typename K, typename N, typename Compare>
+struct btree_simd_search_plain_compare;
+#endif
+
 // A node in the btree holding. The same node type is used for both internal
 // and leaf nodes in the btree, though the nodes are allocated in such a way
 // that the children array is only valid in internal nodes.
@@ -471,7 +671,14 @@ class btree_node {
   typedef typename if_<
     std::is_integral<key_type>::value ||
     std::is_floating_point<key_type>::value,
-    linear_search_type, binary_search_type>::type search_type;
+    linear_search_type, binary_search_type>::type scalar_search_type;
+  // With BTREE_SIMD, integral keys of btree_set nodes are searched with
+  // vector compares when the target supports them.
+  typedef btree_simd_search_plain_compare<
+    key_type, self_type, key_compare> simd_search_type;
+  typedef typename if_<
+    btree_is_simd_searchable<key_type, value_type, key_compare>::value,
+    simd_search_type, scalar_search_type>::type search_type;
 
   struct base_fields {
     typedef typename Params::node_count_type field_type;
@@ -509,13 +716,29 @@ class btree_node {
     mutable_value_type values[kNodeValues];
   };
 
-  struct internal_fields : public leaf_fields {
+  struct plain_internal_fields : public leaf_fields {
     // The array of child pointers. The keys in children_[i] are all less than
     // key(i). The keys in children_[i + 1] are all greater than key(i). There
     // are always count + 1 children.
     btree_node *children[kNodeValues + 1];
+
+    // Subtree sizes are not kept, see counted_internal_fields.
+    size_type child_count(int /*i*/) const { return 0; }
+    void set_child_count(int /*i*/, size_type /*v*/) {}
+  };
+
+  struct counted_internal_fields : public plain_internal_fields {
+    // The number of values in the subtree of children[i].
+    size_type child_counts[kNodeValues + 1];
+
+    size_type child_count(int i) const { return child_counts[i]; }
+    void set_child_count(int i, size_type v) { child_counts[i] = v; }
   };
 
+  typedef typename if_<
+    params_type::kCounted,
+    counted_internal_fields, plain_internal_fields>::type internal_fields;
+
   struct root_fields : public internal_fields {
     btree_node *rightmost;
     size_type size;
@@ -573,13 +796,51 @@ class btree_node {
     params_type::swap(mutable_value(i), x->mutable_value(j));
   }
 
-  // Getters/setter for the child at position i in the node.
-  btree_node* child(int i) const { return fields_.children[i]; }
-  btree_node** mutable_child(int i) { return &fields_.children[i]; }
+  // Getter/setter for the number of values in the subtree of child i. Only
+  // kept when params_type::kCounted, 0 otherwise.
+  size_type child_count(int i) const { return internal()->child_count(i); }
+  void set_child_count(int i, size_type v) {
+    internal()->set_child_count(i, v);
+  }
+
+  // The number of values in the subtree of this node.
+  size_type subtree_count() const {
+    size_type n = count();
+    if (!leaf()) {
+      for (int i = 0; i <= count(); ++i) {
+        n += child_count(i);
+      }
+    }
+    return n;
+  }
+
+  // Recomputes the subtree size kept for this node in its parent.
+  void update_parent_count() {
+    if (params_type::kCounted && !is_root()) {
+      parent()->set_child_count(position(), subtree_count());
+    }
+  }
+
+  // Prefetches the header and the values, the part of the node which
+  // lower_bound() reads.
+  void prefetch() const {
+    const char *p = reinterpret_cast<const char*>(this);
+    for (size_t i = 0; i < sizeof(leaf_fields); i += 64) {
+      BTREE_PREFETCH(p + i);
+    }
+  }
+
+  // Getters/setter for the child at position i in the node. fields_ is a
+  // root_fields, larger than what a leaf or an internal node is allocated
+  // with, so the children array and the fields of c are reached through
+  // pointers to the fields the node really has.
+  btree_node* child(int i) const { return internal()->children[i]; }
+  btree_node** mutable_child(int i) { return &internal()->children[i]; }
   void set_child(int i, btree_node *c) {
     *mutable_child(i) = c;
-    c->fields_.parent = this;
-    c->fields_.position = i;
+    base_fields *f = &c->fields_;
+    f->parent = this;
+    f->position = i;
   }
 
   // Returns the position of the first value whose key is not less than k.
@@ -732,6 +993,9 @@ class btree_node {
   }
 
  private:
+  const internal_fields* internal() const { return &fields_; }
+  internal_fields* internal() { return &fields_; }
+
   root_fields fields_;
 
  private:
@@ -875,9 +1139,11 @@ class btree : public Params::key_compare {
   enum {
     kNodeValues = node_type::kNodeValues,
     kMinNodeValues = kNodeValues / 2,
+    kCounted = Params::kCounted,
     kValueSize = node_type::kValueSize,
     kExactMatch = node_type::kExactMatch,
     kMatchMask = node_type::kMatchMask,
+    kBatchGroup = 16,
   };
 
   // A helper class to get the empty base class optimization for 0-size
@@ -917,6 +1183,7 @@ class btree : public Params::key_compare {
   typedef typename Params::data_type data_type;
   typedef typename Params::mapped_type mapped_type;
   typedef typename Params::value_type value_type;
+  typedef typename Params::mutable_value_type mutable_value_type;
   typedef typename Params::key_compare key_compare;
   typedef typename Params::pointer pointer;
   typedef typename Params::const_pointer const_pointer;
@@ -1025,6 +1292,23 @@ class btree : public Params::key_compare {
   template <typename InputIterator>
   void insert_unique(InputIterator b, InputIterator e);
 
+  // Replaces the contents of the btree with the sorted range [b, e), which
+  // must not contain equal keys. Instead of going through the split path the
+  // tree is built bottom-up: the leaves are packed with fill * kNodeValues
+  // values each and every internal level is built from the values left
+  // between the nodes of the level below. With threads > 1 the leaves are
+  // filled concurrently, each thread taking a contiguous run of them; all
+  // nodes are still allocated on the calling thread. A forward range is
+  // counted first and spread evenly over the leaves; an input range is read
+  // once, filling one leaf after the other, and threads is ignored.
+  template <typename InputIterator>
+  void bulk_load_unique(InputIterator b, InputIterator e,
+                        double fill = 1.0, int threads = 1) {
+    internal_bulk_load_unique(
+        b, e, fill, threads,
+        typename std::iterator_traits<InputIterator>::iterator_category());
+  }
+
   // Inserts a value into the btree. The ValuePointer type is used to avoid
   // instatiating the value unless the key is being inserted. Value is not
   // dereferenced if the key already exists in the btree. See
@@ -1084,6 +1368,40 @@ class btree : public Params::key_compare {
         internal_find_multi(key, const_iterator(root(), 0)));
   }
 
+  // Batched find_unique(): out[i] is set to find_unique(keys[i]) for the n
+  // keys. Groups of kBatchGroup keys descend the tree in lock-step and the
+  // node every key visits next is prefetched before the group searches its
+  // current nodes, so the cache misses of one level overlap instead of
+  // following one another. Sorted keys share the nodes of the upper levels,
+  // a node reached by consecutive keys is prefetched once.
+  void find_unique_batch(const key_type *keys, size_type n,
+                         iterator *out) {
+    internal_find_unique_batch(keys, n, out, iterator(root(), 0));
+    for (size_type i = 0; i < n; ++i) {
+      out[i] = internal_end(out[i]);
+    }
+  }
+  void find_unique_batch(const key_type *keys, size_type n,
+                         const_iterator *out) const {
+    internal_find_unique_batch(keys, n, out, const_iterator(root(), 0));
+    for (size_type i = 0; i < n; ++i) {
+      out[i] = internal_end(out[i]);
+    }
+  }
+  // Sets out[i] to whether keys[i] is in the btree.
+  void contains_unique_batch(const key_type *keys, size_type n,
+                             bool *out) const {
+    const_iterator found[kBatchGroup];
+    for (size_type first = 0; first < n; first += kBatchGroup) {
+      const size_type m = std::min<size_type>(kBatchGroup, n - first);
+      internal_find_unique_batch(keys + first, m, found,
+                                 const_iterator(root(), 0));
+      for (size_type i = 0; i < m; ++i) {
+        out[first + i] = found[i].node != NULL;
+      }
+    }
+  }
+
   // Returns a count of the number of times the key appears in the btree.
   size_type count_unique(const key_type &key) const {
     const_iterator begin = internal_find_unique(
@@ -1099,6 +1417,25 @@ class btree : public Params::key_compare {
     return distance(lower_bound(key), upper_bound(key));
   }
 
+  // Order statistics, these require params_type::kCounted and visit one node
+  // per level. rank() returns the number of values whose key is less than
+  // key.
+  size_type rank(const key_type &key) const;
+  // Returns the value at position k in key order (counting from 0), or end()
+  // if k >= size().
+  iterator select(size_type k) {
+    return internal_select(k, iterator(root(), 0), end());
+  }
+  const_iterator select(size_type k) const {
+    return internal_select(k, const_iterator(root(), 0), end());
+  }
+  // Returns the number of values whose key is in [lo, hi).
+  size_type count_range(const key_type &lo, const key_type &hi) const {
+    const size_type l = rank(lo);
+    const size_type h = rank(hi);
+    return h > l ? h - l : 0;
+  }
+
   // Clear the btree, deleting all of the values it contains.
   void clear();
 
@@ -1143,6 +1480,9 @@ class btree : public Params::key_compare {
     return root()->size();
   }
   size_type max_size() const { return std::numeric_limits<size_type>::max(); }
+  allocator_type get_allocator() const {
+    return allocator_type(internal_allocator());
+  }
   bool empty() const { return root() == NULL; }
 
   // The height of the btree. An empty tree will have height 0.
@@ -1243,6 +1583,11 @@ class btree : public Params::key_compare {
     return *static_cast<const internal_allocator_type*>(&root_);
   }
 
+  void set_node_sizes() {
+    btree_set_node_sizes(mutable_internal_allocator(), sizeof(leaf_fields),
+                         sizeof(internal_fields), 0);
+  }
+
   // Node creation/deletion routines.
   node_type* new_internal_node(node_type *parent) {
     internal_fields *p = reinterpret_cast<internal_fields*>(
@@ -1299,6 +1644,23 @@ class btree : public Params::key_compare {
   // Tries to shrink the height of the tree by 1.
   void try_shrink();
 
+  // Adds delta to the subtree sizes kept on the path from node to the root.
+  static void update_path_counts(node_type *node, int delta) {
+    if (kCounted) {
+      for (; !node->is_root(); node = node->parent()) {
+        node_type *parent = node->parent();
+        parent->set_child_count(
+            node->position(), parent->child_count(node->position()) + delta);
+      }
+    }
+  }
+
+  // Descends from the root in iter to the value at position k, returns
+  // end_iter if there is none.
+  template <typename IterType>
+  IterType internal_select(size_type k, IterType iter,
+                           IterType end_iter) const;
+
   iterator internal_end(iterator iter) {
     return iter.node ? iter : end();
   }
@@ -1310,6 +1672,41 @@ class btree : public Params::key_compare {
   // key(v) <= iter.key() and (--iter).key() <= key(v).
   iterator internal_insert(iterator iter, const value_type &v);
 
+  // The bulk loads of forward and of input ranges.
+  template <typename ForwardIterator>
+  void internal_bulk_load_unique(ForwardIterator b, ForwardIterator e,
+                                 double fill, int threads,
+                                 std::forward_iterator_tag);
+  template <typename InputIterator>
+  void internal_bulk_load_unique(InputIterator b, InputIterator e,
+                                 double fill, int threads,
+                                 std::input_iterator_tag);
+
+  // Values per node of a bulk load.
+  static int bulk_per_node(double fill) {
+    // Every internal node needs at least 2 children, which holds for any
+    // level as long as a node takes 2 or more values.
+    return std::max<int>(
+        2, std::min<int>(kNodeValues, static_cast<int>(fill * kNodeValues)));
+  }
+
+  // Builds the internal levels of a bulk load of n values over the leaves in
+  // nodes, which are separated by the values separators point to, and makes
+  // them the tree.
+  template <typename SeparatorIterator>
+  void bulk_build_levels(std::vector<node_type*> *nodes,
+                         std::vector<SeparatorIterator> *separators,
+                         int per_node, size_type n);
+
+  // Fills the leaves [first, last) of a bulk load. Leaf j takes the next
+  // per_leaf (+1 for the first extra leaves) values of the range starting at
+  // b, the value following it is recorded in separators[j].
+  template <typename ForwardIterator>
+  static void bulk_fill_leaves(ForwardIterator b, node_type **leaves,
+                               ForwardIterator *separators,
+                               size_type first, size_type last, size_type k,
+                               size_type per_leaf, size_type extra);
+
   // Returns an iterator pointing to the first value >= the value "iter" is
   // pointing at. Note that "iter" might be pointing to an invalid location as
   // iter.position == iter.node->count(). This routine simply moves iter up in
@@ -1351,6 +1748,12 @@ class btree : public Params::key_compare {
   IterType internal_find_unique(
       const key_type &key, IterType iter) const;
 
+  // Internal routine which implements find_unique_batch(). Keys which are
+  // not found are left as IterType(NULL, 0) in out.
+  template <typename IterType>
+  void internal_find_unique_batch(const key_type *keys, size_type n,
+                                  IterType *out, IterType root_iter) const;
+
   // Internal routine which implements find_multi().
   template <typename IterType>
   IterType internal_find_multi(
@@ -1434,9 +1837,11 @@ inline void btree_node<P>::insert_value(int i, const value_type &x) {
     ++i;
     for (int j = count(); j > i; --j) {
       *mutable_child(j) = child(j - 1);
+      set_child_count(j, child_count(j - 1));
       child(j)->set_position(j);
     }
     *mutable_child(i) = NULL;
+    set_child_count(i, 0);
   }
 }
 
@@ -1446,6 +1851,7 @@ inline void btree_node<P>::remove_value(int i) {
     assert(child(i + 1)->count() == 0);
     for (int j = i + 1; j < count(); ++j) {
       *mutable_child(j) = child(j + 1);
+      set_child_count(j, child_count(j + 1));
       child(j)->set_position(j);
     }
     *mutable_child(count()) = NULL;
@@ -1492,10 +1898,12 @@ void btree_node<P>::rebalance_right_to_left(btree_node *src, int to_move) {
     // Move the child pointers from the right to the left node.
     for (int i = 0; i < to_move; ++i) {
       set_child(1 + count() + i, src->child(i));
+      set_child_count(1 + count() + i, src->child_count(i));
     }
     for (int i = 0; i <= src->count() - to_move; ++i) {
       assert(i + to_move <= src->max_count());
       src->set_child(i, src->child(i + to_move));
+      src->set_child_count(i, src->child_count(i + to_move));
       *src->mutable_child(i + to_move) = NULL;
     }
   }
@@ -1503,6 +1911,8 @@ void btree_node<P>::rebalance_right_to_left(btree_node *src, int to_move) {
   // Fixup the counts on the src and dest nodes.
   set_count(count() + to_move);
   src->set_count(src->count() - to_move);
+  update_parent_count();
+  src->update_parent_count();
 }
 
 template <typename P>
@@ -1537,10 +1947,12 @@ void btree_node<P>::rebalance_left_to_right(btree_node *dest, int to_move) {
     // Move the child pointers from the left to the right node.
     for (int i = dest->count(); i >= 0; --i) {
       dest->set_child(i + to_move, dest->child(i));
+      dest->set_child_count(i + to_move, dest->child_count(i));
       *dest->mutable_child(i) = NULL;
     }
     for (int i = 1; i <= to_move; ++i) {
       dest->set_child(i - 1, child(count() - to_move + i));
+      dest->set_child_count(i - 1, child_count(count() - to_move + i));
       *mutable_child(count() - to_move + i) = NULL;
     }
   }
@@ -1548,6 +1960,8 @@ void btree_node<P>::rebalance_left_to_right(btree_node *dest, int to_move) {
   // Fixup the counts on the src and dest nodes.
   set_count(count() - to_move);
   dest->set_count(dest->count() + to_move);
+  update_parent_count();
+  dest->update_parent_count();
 }
 
 template <typename P>
@@ -1586,9 +2000,12 @@ void btree_node<P>::split(btree_node *dest, int insert_position) {
     for (int i = 0; i <= dest->count(); ++i) {
       assert(child(count() + i + 1) != NULL);
       dest->set_child(i, child(count() + i + 1));
+      dest->set_child_count(i, child_count(count() + i + 1));
       *mutable_child(count() + i + 1) = NULL;
     }
   }
+  update_parent_count();
+  dest->update_parent_count();
 }
 
 template <typename P>
@@ -1611,6 +2028,7 @@ void btree_node<P>::merge(btree_node *src) {
     // Move the child pointers from the right to the left node.
     for (int i = 0; i <= src->count(); ++i) {
       set_child(1 + count() + i, src->child(i));
+      set_child_count(1 + count() + i, src->child_count(i));
       *src->mutable_child(i) = NULL;
     }
   }
@@ -1621,6 +2039,7 @@ void btree_node<P>::merge(btree_node *src) {
 
   // Remove the value on the parent node.
   parent()->remove_value(position());
+  update_parent_count();
 }
 
 template <typename P>
@@ -1649,6 +2068,9 @@ void btree_node<P>::swap(btree_node *x) {
     // Swap the child pointers.
     for (int i = 0; i <= n; ++i) {
       btree_swap_helper(*mutable_child(i), *x->mutable_child(i));
+      size_type c = child_count(i);
+      set_child_count(i, x->child_count(i));
+      x->set_child_count(i, c);
     }
     for (int i = 0; i <= count(); ++i) {
       x->child(i)->fields_.parent = x;
@@ -1733,6 +2155,7 @@ template <typename P>
 btree<P>::btree(const key_compare &comp, const allocator_type &alloc)
     : key_compare(comp),
       root_(alloc, NULL) {
+  set_node_sizes();
 }
 
 template <typename P>
@@ -1798,6 +2221,186 @@ void btree<P>::insert_unique(InputIterator b, InputIterator e) {
   }
 }
 
+template <typename P> template <typename ForwardIterator>
+void btree<P>::internal_bulk_load_unique(ForwardIterator b, ForwardIterator e,
+                                         double fill, int threads,
+                                         std::forward_iterator_tag) {
+  clear();
+  const size_type n = std::distance(b, e);
+  if (n == 0) {
+    return;
+  }
+  const int per_node = bulk_per_node(fill);
+  if (n <= static_cast<size_type>(per_node)) {
+    *mutable_root() = new_leaf_root_node(static_cast<int>(n));
+    for (; b != e; ++b) {
+      root()->insert_value(root()->count(), *b);
+    }
+    return;
+  }
+
+  // The fewest leaves which hold n values when each one but the last is
+  // followed by a separator: k * per_node + (k - 1) >= n.
+  const size_type k = (n + per_node + 1) / (per_node + 1);
+  std::vector<node_type*> nodes(k);
+  for (size_type j = 0; j < k; ++j) {
+    nodes[j] = new_leaf_node(NULL);
+  }
+  std::vector<ForwardIterator> separators(k - 1);
+  const size_type leaf_values = n - (k - 1);
+  const size_type per_leaf = leaf_values / k;
+  const size_type extra = leaf_values % k;
+  if (threads > 1 && k >= static_cast<size_type>(2 * threads)) {
+    std::vector<std::thread> workers;
+    const size_type step = (k + threads - 1) / threads;
+    for (size_type first = 0; first < k; first += step) {
+      const size_type last = std::min(k, first + step);
+      workers.push_back(std::thread(
+          &self_type::template bulk_fill_leaves<ForwardIterator>, b,
+          nodes.data(), separators.data(), first, last, k, per_leaf, extra));
+    }
+    for (size_t t = 0; t < workers.size(); ++t) {
+      workers[t].join();
+    }
+  } else {
+    bulk_fill_leaves(b, nodes.data(), separators.data(), 0, k, k, per_leaf,
+                     extra);
+  }
+
+  bulk_build_levels(&nodes, &separators, per_node, n);
+}
+
+template <typename P> template <typename SeparatorIterator>
+void btree<P>::bulk_build_levels(std::vector<node_type*> *nodes,
+                                 std::vector<SeparatorIterator> *separators,
+                                 int per_node, size_type n) {
+  // Each level is built the same way from the nodes and separators of the
+  // level below until a single node, the root, is left.
+  node_type *leftmost_leaf = nodes->front();
+  node_type *rightmost_leaf = nodes->back();
+  for (;;) {
+    const size_type children = nodes->size();
+    const size_type m = (children + per_node) / (per_node + 1);
+    const size_type per_parent = children / m;
+    const size_type extra_children = children % m;
+    std::vector<node_type*> parents(m);
+    std::vector<SeparatorIterator> up;
+    up.reserve(m - 1);
+    size_type c = 0, s = 0;
+    for (size_type j = 0; j < m; ++j) {
+      node_type *p;
+      if (m == 1) {
+        root_fields *f = reinterpret_cast<root_fields*>(
+            mutable_internal_allocator()->allocate(sizeof(root_fields)));
+        p = node_type::init_root(f, leftmost_leaf);
+      } else {
+        p = new_internal_node(NULL);
+      }
+      const size_type count = per_parent + (j < extra_children ? 1 : 0);
+      p->set_child(0, (*nodes)[c++]);
+      for (size_type i = 1; i < count; ++i) {
+        p->insert_value(static_cast<int>(i - 1), *(*separators)[s++]);
+        p->set_child(static_cast<int>(i), (*nodes)[c++]);
+      }
+      if (params_type::kCounted) {
+        for (int i = 0; i <= p->count(); ++i) {
+          p->set_child_count(i, p->child(i)->subtree_count());
+        }
+      }
+      if (j + 1 < m) {
+        up.push_back((*separators)[s++]);
+      }
+      parents[j] = p;
+    }
+    nodes->swap(parents);
+    separators->swap(up);
+    if (m == 1) {
+      break;
+    }
+  }
+  *mutable_root() = nodes->front();
+  *mutable_rightmost() = rightmost_leaf;
+  *mutable_size() = n;
+}
+
+template <typename P> template <typename InputIterator>
+void btree<P>::internal_bulk_load_unique(InputIterator b, InputIterator e,
+                                         double fill, int /*threads*/,
+                                         std::input_iterator_tag) {
+  clear();
+  const int per_node = bulk_per_node(fill);
+  // Each leaf takes per_node values and the value after it separates it
+  // from the next one.
+  std::vector<node_type*> nodes;
+  std::vector<mutable_value_type> values;
+  size_type n = 0;
+  for (; b != e; ++b, ++n) {
+    if (values.size() < nodes.size() && nodes.back()->count() == per_node) {
+      values.push_back(*b);
+      continue;
+    }
+    if (values.size() == nodes.size()) {
+      nodes.push_back(new_leaf_node(NULL));
+    }
+    nodes.back()->insert_value(nodes.back()->count(), *b);
+  }
+  if (n == 0) {
+    return;
+  }
+  if (values.size() == nodes.size()) {
+    // The range ended on a separator: it goes into a leaf of its own, which
+    // the last value of the leaf before separates.
+    node_type *prev = nodes.back();
+    nodes.push_back(new_leaf_node(NULL));
+    nodes.back()->insert_value(0, values.back());
+    values.back() = prev->value(prev->count() - 1);
+    prev->remove_value(prev->count() - 1);
+  }
+  if (nodes.size() == 1) {
+    *mutable_root() = new_leaf_root_node(nodes.front()->count());
+    root()->swap(nodes.front());
+    delete_leaf_node(nodes.front());
+    return;
+  }
+  // The last leaf takes what was left, move values over from the leaf
+  // before it until the two are about even.
+  node_type *prev = nodes[nodes.size() - 2];
+  node_type *last = nodes.back();
+  while (last->count() + 1 < prev->count()) {
+    last->insert_value(0, values.back());
+    values.back() = prev->value(prev->count() - 1);
+    prev->remove_value(prev->count() - 1);
+  }
+  std::vector<typename std::vector<mutable_value_type>::const_iterator>
+      separators;
+  separators.reserve(values.size());
+  for (typename std::vector<mutable_value_type>::const_iterator it =
+           values.begin(); it != values.end(); ++it) {
+    separators.push_back(it);
+  }
+  bulk_build_levels(&nodes, &separators, per_node, n);
+}
+
+template <typename P> template <typename ForwardIterator>
+void btree<P>::bulk_fill_leaves(ForwardIterator b, node_type **leaves,
+                                ForwardIterator *separators,
+                                size_type first, size_type last, size_type k,
+                                size_type per_leaf, size_type extra) {
+  std::advance(b, static_cast<difference_type>(
+      first * (per_leaf + 1) + std::min(first, extra)));
+  for (size_type j = first; j < last; ++j) {
+    node_type *leaf = leaves[j];
+    const size_type count = per_leaf + (j < extra ? 1 : 0);
+    for (size_type i = 0; i < count; ++i, ++b) {
+      leaf->insert_value(static_cast<int>(i), *b);
+    }
+    if (j + 1 < k) {
+      separators[j] = b;
+      ++b;
+    }
+  }
+}
+
 template <typename P> template <typename ValuePointer>
 typename btree<P>::iterator
 btree<P>::insert_multi(const key_type &key, ValuePointer value) {
@@ -1848,6 +2451,7 @@ void btree<P>::assign(const self_type &x) {
 
   *mutable_key_comp() = x.key_comp();
   *mutable_internal_allocator() = x.internal_allocator();
+  set_node_sizes();
 
   // Assignment can avoid key comparisons because we know the order of the
   // values is the same order we'll store them in.
@@ -1880,6 +2484,7 @@ typename btree<P>::iterator btree<P>::erase(iterator iter) {
 
   // Delete the key from the leaf.
   iter.node->remove_value(iter.position);
+  update_path_counts(iter.node, -1);
 
   // We want to return the next value after the one we just erased. If we
   // erased from an internal node (internal_delete == true), then the next
@@ -1957,6 +2562,53 @@ int btree<P>::erase_multi(const key_type &key) {
   return erase(begin, end);
 }
 
+template <typename P>
+typename btree<P>::size_type btree<P>::rank(const key_type &key) const {
+  static_assert(kCounted, "rank() requires counted btree params");
+  size_type r = 0;
+  for (const node_type *node = root(); node != NULL; ) {
+    const int pos = node->lower_bound(key, key_comp()) & kMatchMask;
+    r += pos;
+    if (node->leaf()) {
+      break;
+    }
+    for (int i = 0; i < pos; ++i) {
+      r += node->child_count(i);
+    }
+    node = node->child(pos);
+  }
+  return r;
+}
+
+template <typename P> template <typename IterType>
+IterType btree<P>::internal_select(
+    size_type k, IterType iter, IterType end_iter) const {
+  static_assert(kCounted, "select() requires counted btree params");
+  if (iter.node == NULL || k < 0 || k >= size()) {
+    return end_iter;
+  }
+  for (;;) {
+    if (iter.node->leaf()) {
+      iter.position = static_cast<int>(k);
+      return iter;
+    }
+    int i = 0;
+    for (;; ++i) {
+      const size_type c = iter.node->child_count(i);
+      if (k < c) {
+        break;
+      }
+      k -= c;
+      if (k == 0) {
+        iter.position = i;
+        return iter;
+      }
+      --k;
+    }
+    iter.node = iter.node->child(i);
+  }
+}
+
 template <typename P>
 void btree<P>::clear() {
   if (root() != NULL) {
@@ -2227,6 +2879,7 @@ btree<P>::internal_insert(iterator iter, const value_type &v) {
     ++*mutable_size();
   }
   iter.node->insert_value(iter.position, v);
+  update_path_counts(iter.node, 1);
   return iter;
 }
 
@@ -2317,6 +2970,53 @@ IterType btree<P>::internal_find_unique(
   return IterType(NULL, 0);
 }
 
+template <typename P> template <typename IterType>
+void btree<P>::internal_find_unique_batch(
+    const key_type *keys, size_type n, IterType *out,
+    IterType root_iter) const {
+  for (size_type first = 0; first < n; first += kBatchGroup) {
+    const int m = static_cast<int>(
+        std::min<size_type>(kBatchGroup, n - first));
+    const key_type *key = keys + first;
+    IterType *iter = out + first;
+    // The keys still descending, their iterators hold the node to search.
+    int pending[kBatchGroup];
+    int count = 0;
+    for (int i = 0; i < m; ++i) {
+      iter[i] = root_iter;
+      if (root_iter.node) {
+        pending[count++] = i;
+      }
+    }
+    while (count > 0) {
+      int next = 0;
+      const node_type *last = NULL;
+      for (int j = 0; j < count; ++j) {
+        const int i = pending[j];
+        const int res = iter[i].node->lower_bound(key[i], key_comp());
+        iter[i].position = res & kMatchMask;
+        if (res & kExactMatch) {
+          continue;
+        }
+        if (iter[i].node->leaf()) {
+          iter[i] = internal_last(iter[i]);
+          if (iter[i].node && compare_keys(key[i], iter[i].key())) {
+            iter[i] = IterType(NULL, 0);
+          }
+          continue;
+        }
+        iter[i].node = iter[i].node->child(iter[i].position);
+        if (iter[i].node != last) {
+          iter[i].node->prefetch();
+          last = iter[i].node;
+        }
+        pending[next++] = i;
+      }
+      count = next;
+    }
+  }
+}
+
 template <typename P> template <typename IterType>
 IterType btree<P>::internal_find_multi(
     const key_type &key, IterType iter) const {
@@ -2385,10 +3085,12 @@ int btree<P>::internal_verify(
       assert(node->child(i) != NULL);
       assert(node->child(i)->parent() == node);
       assert(node->child(i)->position() == i);
-      count += internal_verify(
+      int child_count = internal_verify(
           node->child(i),
           (i == 0) ? lo : &node->key(i - 1),
           (i == node->count()) ? hi : &node->key(i));
+      assert(!kCounted || node->child_count(i) == child_count);
+      count += child_count;
     }
   }
   return count;
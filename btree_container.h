@@ -15,8 +15,11 @@
 #ifndef UTIL_BTREE_BTREE_CONTAINER_H__
 #define UTIL_BTREE_BTREE_CONTAINER_H__
 
+#include <algorithm>
 #include <iosfwd>
+#include <iterator>
 #include <utility>
+#include <vector>
 
 #include "btree.h"
 
@@ -86,6 +89,20 @@ class btree_container {
     return tree_.equal_range(key);
   }
 
+  // Order statistics, only for trees with counted params.
+  size_type rank(const key_type &key) const {
+    return tree_.rank(key);
+  }
+  iterator select(size_type k) {
+    return tree_.select(k);
+  }
+  const_iterator select(size_type k) const {
+    return tree_.select(k);
+  }
+  size_type count_range(const key_type &lo, const key_type &hi) const {
+    return tree_.count_range(lo, hi);
+  }
+
   // Utility routines.
   void clear() {
     tree_.clear();
@@ -103,6 +120,7 @@ class btree_container {
   // Size routines.
   size_type size() const { return tree_.size(); }
   size_type max_size() const { return tree_.max_size(); }
+  allocator_type get_allocator() const { return tree_.get_allocator(); }
   bool empty() const { return tree_.empty(); }
   size_type height() const { return tree_.height(); }
   size_type internal_nodes() const { return tree_.internal_nodes(); }
@@ -149,6 +167,7 @@ class btree_unique_container : public btree_container<Tree> {
   typedef btree_container<Tree> super_type;
 
  public:
+  typedef typename Tree::params_type params_type;
   typedef typename Tree::key_type key_type;
   typedef typename Tree::value_type value_type;
   typedef typename Tree::size_type size_type;
@@ -188,6 +207,19 @@ class btree_unique_container : public btree_container<Tree> {
   size_type count(const key_type &key) const {
     return this->tree_.count_unique(key);
   }
+  // Batched lookups of n keys, out[i] receives find(keys[i]) or whether
+  // keys[i] is present. Faster than single lookups once the tree no longer
+  // fits into the cache.
+  void find_batch(const key_type *keys, size_type n, iterator *out) {
+    this->tree_.find_unique_batch(keys, n, out);
+  }
+  void find_batch(const key_type *keys, size_type n,
+                  const_iterator *out) const {
+    this->tree_.find_unique_batch(keys, n, out);
+  }
+  void contains_batch(const key_type *keys, size_type n, bool *out) const {
+    this->tree_.contains_unique_batch(keys, n, out);
+  }
 
   // Insertion routines.
   std::pair<iterator,bool> insert(const value_type &x) {
@@ -201,6 +233,102 @@ class btree_unique_container : public btree_container<Tree> {
     this->tree_.insert_unique(b, e);
   }
 
+  // Bulk loading routines. Both replace the contents of the container and
+  // build the tree bottom-up with every node filled to fill of its
+  // capacity, the leaves are filled by up to threads threads.
+  // bulk_load_sorted() requires a range sorted by key without equal keys.
+  template <typename ForwardIterator>
+  void bulk_load_sorted(ForwardIterator b, ForwardIterator e,
+                        double fill = 1.0, int threads = 1) {
+    this->tree_.bulk_load_unique(b, e, fill, threads);
+  }
+  // bulk_load() accepts any range: it sorts a copy and keeps the first of
+  // equal keys, like insert() would.
+  template <typename InputIterator>
+  void bulk_load(InputIterator b, InputIterator e,
+                 double fill = 1.0, int threads = 1) {
+    typedef typename params_type::mutable_value_type mutable_value_type;
+    std::vector<mutable_value_type> values(b, e);
+    const Tree &tree = this->tree_;
+    std::stable_sort(values.begin(), values.end(),
+        [&tree](const mutable_value_type &x, const mutable_value_type &y) {
+          return tree.compare_keys(params_type::key(x), params_type::key(y));
+        });
+    values.erase(std::unique(values.begin(), values.end(),
+        [&tree](const mutable_value_type &x, const mutable_value_type &y) {
+          return !tree.compare_keys(params_type::key(x), params_type::key(y));
+        }), values.end());
+    this->tree_.bulk_load_unique(values.begin(), values.end(), fill, threads);
+  }
+
+  // Set algebra routines. The assign_ variants replace the contents with the
+  // union, intersection or difference of x and y: both trees are walked in
+  // order and the leaves are bulk loaded straight from the merge, which
+  // takes O(x.size() + y.size()) instead of an O(log n) insert per value. Of
+  // equal keys the value of x is kept. x or y may be the container itself.
+  void assign_union(const self_type &x, const self_type &y,
+                    double fill = 1.0) {
+    assign_merge(x, y, true, true, true, fill);
+  }
+  void assign_intersection(const self_type &x, const self_type &y,
+                           double fill = 1.0) {
+    assign_merge(x, y, false, true, false, fill);
+  }
+  void assign_difference(const self_type &x, const self_type &y,
+                         double fill = 1.0) {
+    assign_merge(x, y, true, false, false, fill);
+  }
+
+  // In-place set algebra with x. When the key ranges of the two containers
+  // do not overlap the result is known without merging: union_with()
+  // appends or prepends the values of x through the hinted insert,
+  // intersect_with() clears and subtract() does nothing. When x is much
+  // smaller than the container its values are inserted or erased one by
+  // one, otherwise the result is merged and bulk loaded as above.
+  void union_with(const self_type &x, double fill = 1.0) {
+    if (x.empty() || &x == this) {
+      return;
+    }
+    if (!this->empty() && (disjoint(x) || small_update(x))) {
+      iterator hint = this->end();
+      if (before(x, *this)) {
+        hint = this->begin();
+      }
+      for (const_iterator it = x.begin(); it != x.end(); ++it) {
+        hint = insert(hint, *it);
+        ++hint;
+      }
+      return;
+    }
+    assign_union(*this, x, fill);
+  }
+  void intersect_with(const self_type &x, double fill = 1.0) {
+    if (&x == this) {
+      return;
+    }
+    if (x.empty() || this->empty() || disjoint(x)) {
+      this->clear();
+      return;
+    }
+    assign_intersection(*this, x, fill);
+  }
+  void subtract(const self_type &x, double fill = 1.0) {
+    if (x.empty() || this->empty() || disjoint(x)) {
+      return;
+    }
+    if (&x == this) {
+      this->clear();
+      return;
+    }
+    if (small_update(x)) {
+      for (const_iterator it = x.begin(); it != x.end(); ++it) {
+        erase(params_type::key(*it));
+      }
+      return;
+    }
+    assign_difference(*this, x, fill);
+  }
+
   // Deletion routines.
   int erase(const key_type &key) {
     return this->tree_.erase_unique(key);
@@ -214,6 +342,134 @@ class btree_unique_container : public btree_container<Tree> {
   void erase(const iterator &first, const iterator &last) {
     this->tree_.erase(first, last);
   }
+
+ private:
+  // Input iterator over the values of a merge of x and y which are found
+  // only in x, in both or only in y as requested, in key order.
+  class merge_iterator {
+   public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef typename Tree::value_type value_type;
+    typedef typename Tree::difference_type difference_type;
+    typedef const value_type* pointer;
+    typedef const value_type& reference;
+
+    merge_iterator(const Tree *tree, const_iterator xi, const_iterator xe,
+                   const_iterator yi, const_iterator ye, bool only_x,
+                   bool both, bool only_y)
+        : tree_(tree), xi_(xi), xe_(xe), yi_(yi), ye_(ye), only_x_(only_x),
+          both_(both), only_y_(only_y), from_x_(false), equal_(false) {
+      settle();
+    }
+
+    reference operator*() const { return from_x_ ? *xi_ : *yi_; }
+    pointer operator->() const { return &**this; }
+    merge_iterator& operator++() {
+      if (from_x_) {
+        ++xi_;
+        if (equal_) {
+          ++yi_;
+        }
+      } else {
+        ++yi_;
+      }
+      settle();
+      return *this;
+    }
+    merge_iterator operator++(int) {
+      merge_iterator tmp = *this;
+      ++*this;
+      return tmp;
+    }
+    bool operator==(const merge_iterator &x) const {
+      return xi_ == x.xi_ && yi_ == x.yi_;
+    }
+    bool operator!=(const merge_iterator &x) const { return !(*this == x); }
+
+   private:
+    // Skips the values which are not kept. Once one side is done the rest
+    // of the other is either kept as it is or skipped at once.
+    void settle() {
+      equal_ = false;
+      for (;;) {
+        if (xi_ == xe_) {
+          if (!only_y_) {
+            yi_ = ye_;
+          }
+          from_x_ = false;
+          return;
+        }
+        if (yi_ == ye_) {
+          if (!only_x_) {
+            xi_ = xe_;
+          }
+          from_x_ = true;
+          return;
+        }
+        if (tree_->compare_keys(params_type::key(*xi_),
+                                params_type::key(*yi_))) {
+          if (only_x_) {
+            from_x_ = true;
+            return;
+          }
+          ++xi_;
+        } else if (tree_->compare_keys(params_type::key(*yi_),
+                                       params_type::key(*xi_))) {
+          if (only_y_) {
+            from_x_ = false;
+            return;
+          }
+          ++yi_;
+        } else {
+          if (both_) {
+            from_x_ = true;
+            equal_ = true;
+            return;
+          }
+          ++xi_;
+          ++yi_;
+        }
+      }
+    }
+
+    const Tree *tree_;
+    const_iterator xi_, xe_;
+    const_iterator yi_, ye_;
+    bool only_x_, both_, only_y_;
+    // Whether the current value comes from x, and whether y holds it too.
+    bool from_x_, equal_;
+  };
+
+  // Bulk loads the values merge_iterator keeps, which fill the leaves as the
+  // merge produces them. As x or y may be this container, the result is
+  // built in a tree of its own and swapped in.
+  void assign_merge(const self_type &x, const self_type &y, bool only_x,
+                    bool both, bool only_y, double fill) {
+    const Tree &tree = this->tree_;
+    merge_iterator b(&tree, x.begin(), x.end(), y.begin(), y.end(),
+                     only_x, both, only_y);
+    merge_iterator e(&tree, x.end(), x.end(), y.end(), y.end(),
+                     only_x, both, only_y);
+    Tree result(tree.key_comp(), tree.get_allocator());
+    result.bulk_load_unique(b, e, fill);
+    this->tree_.swap(result);
+  }
+
+  // True if every key of x is less than every key of y, both non-empty.
+  bool before(const self_type &x, const self_type &y) const {
+    return this->tree_.compare_keys(params_type::key(*x.rbegin()),
+                                    params_type::key(*y.begin()));
+  }
+  bool disjoint(const self_type &x) const {
+    return before(*this, x) || before(x, *this);
+  }
+
+  // A hinted insert or an erase walks down the tree and costs about as much
+  // as merging 16 values, so per value updates win for x below 1/16 of the
+  // container.
+  bool small_update(const self_type &x) const {
+    return x.size() * 16 < this->size();
+  }
 };
 
 // A common base class for btree_map and safe_btree_map.
@@ -0,0 +1,378 @@
+// Read-only ordered set of integral keys served straight from a file image.
+//
+// save() writes the keys of any sorted container, e.g. a btree::btree_set, as
+// a position independent B+ tree: a header, all keys in one sorted array
+// whose blocks of NodeSize bytes are the leaves, then the internal nodes
+// level by level. Internal nodes hold separators - the first key of each
+// child but the first - and the byte offsets of their children in the file
+// instead of pointers, so the image needs no fixups when it is loaded.
+//
+// open() maps the file read-only. Lookups descend from the root node through
+// the mapping and only touch the pages on their path, nothing is copied or
+// rebuilt, which makes opening a file of any size instant. Iterators are
+// plain pointers into the mapped key array, so scans run at memory speed.
+//
+// Keys are stored in native byte order, open() rejects images written with a
+// different key type or node size.
+
+#ifndef BTREE_IMAGE_H
+#define BTREE_IMAGE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+template<class Key = uint64_t, int NodeSize = 256>
+class btree_image_set
+{
+  static_assert(std::is_integral<Key>::value, "btree_image_set supports integral keys only");
+
+  static constexpr int node_keys = NodeSize / sizeof(Key);
+  static_assert(node_keys >= 2, "NodeSize is too small");
+
+  struct header
+  {
+    char magic[8];
+    uint32_t key_size;
+    uint32_t key_signed;
+    uint32_t node_keys;
+    uint32_t height;
+    uint64_t size;
+    uint64_t root;
+    uint64_t file_size;
+  };
+
+  // Child 0 holds the keys below keys[0], child i the keys from keys[i - 1]
+  // up to keys[i].
+  struct inner
+  {
+    uint64_t count;
+    Key keys[node_keys];
+    uint64_t children[node_keys + 1];
+  };
+
+  // The key array starts on a cache line.
+  static constexpr uint64_t keys_offset = 64;
+  static_assert(sizeof(header) <= keys_offset, "header does not fit");
+
+  static void magic(char* m) { memcpy(m, "BTIMG001", 8); }
+
+public:
+  typedef Key key_type;
+  typedef Key value_type;
+  typedef size_t size_type;
+  typedef const Key* const_iterator;
+  typedef const_iterator iterator;
+
+  btree_image_set() {}
+  explicit btree_image_set(const char* path) { open(path); }
+  btree_image_set(const btree_image_set&) = delete;
+  btree_image_set& operator=(const btree_image_set&) = delete;
+  ~btree_image_set() { close(); }
+
+  // Writes the image of a sorted range of unique keys. Throws
+  // std::runtime_error if the file cannot be written.
+  template<class InputIterator>
+  static void save(const char* path, InputIterator first, InputIterator last)
+  {
+    file f(path);
+    header h = {};
+    f.write(&h, sizeof(h));
+    f.pad(keys_offset);
+
+    // Leaves, the first key of every leaf is kept for the level above.
+    std::vector<uint64_t> offsets;
+    std::vector<Key> firsts;
+    uint64_t n = 0;
+    for (; first != last; ++first, ++n)
+    {
+      Key k = *first;
+      if (n % node_keys == 0)
+      {
+        offsets.push_back(keys_offset + n * sizeof(Key));
+        firsts.push_back(k);
+      }
+      f.write(&k, sizeof(k));
+    }
+
+    // Internal levels, children are spread evenly over the fewest nodes.
+    uint32_t height = 1;
+    uint64_t root = 0;
+    while (offsets.size() > 1)
+    {
+      f.pad((f.offset() + 63) / 64 * 64);
+      auto children = offsets.size();
+      auto m = (children + node_keys) / (node_keys + 1);
+      std::vector<uint64_t> up_offsets;
+      std::vector<Key> up_firsts;
+      size_t c = 0;
+      for (size_t j = 0; j < m; ++j)
+      {
+        auto count = children / m + (j < children % m ? 1 : 0);
+        inner node = {};
+        node.count = count - 1;
+        for (size_t i = 0; i < count; ++i, ++c)
+        {
+          if (i > 0)
+          {
+            node.keys[i - 1] = firsts[c];
+          }
+          node.children[i] = offsets[c];
+        }
+        up_offsets.push_back(f.offset());
+        up_firsts.push_back(firsts[c - count]);
+        f.write(&node, sizeof(node));
+      }
+      offsets.swap(up_offsets);
+      firsts.swap(up_firsts);
+      ++height;
+      root = offsets.front();
+    }
+
+    magic(h.magic);
+    h.key_size = sizeof(Key);
+    h.key_signed = std::is_signed<Key>::value;
+    h.node_keys = node_keys;
+    h.height = height;
+    h.size = n;
+    h.root = root;
+    h.file_size = f.offset();
+    f.rewrite_header(&h, sizeof(h));
+  }
+
+  template<class Container>
+  static void save(const char* path, const Container& c)
+  {
+    save(path, c.begin(), c.end());
+  }
+
+  // Maps an image written by save(). Throws std::runtime_error if the file
+  // cannot be mapped or was not written for this Key and NodeSize.
+  void open(const char* path)
+  {
+    close();
+    map(path);
+    header h = {};
+    memcpy(&h, _base, std::min(sizeof(h), _length));
+    char m[8];
+    magic(m);
+    if (memcmp(h.magic, m, 8) != 0 || h.key_size != sizeof(Key) ||
+      h.key_signed != static_cast<uint32_t>(std::is_signed<Key>::value) || h.node_keys != node_keys ||
+      h.file_size != _length)
+    {
+      close();
+      throw std::runtime_error(std::string("btree_image_set: incompatible image ") + path);
+    }
+    _size = h.size;
+    _height = h.height;
+    _root = h.root;
+    _keys = reinterpret_cast<const Key*>(_base + keys_offset);
+  }
+
+  void close()
+  {
+    if (_base != nullptr)
+    {
+#ifdef _WIN32
+      UnmapViewOfFile(_base);
+#else
+      munmap(const_cast<char*>(_base), _length);
+#endif
+    }
+    _base = nullptr;
+    _length = 0;
+    _keys = nullptr;
+    _size = 0;
+    _height = 0;
+    _root = 0;
+  }
+
+  bool is_open() const { return _base != nullptr; }
+
+  const_iterator find(const Key& k) const
+  {
+    auto it = lower_bound(k);
+    return it != end() && *it == k ? it : end();
+  }
+
+  size_type count(const Key& k) const { return find(k) != end() ? 1 : 0; }
+
+  // First key not less than k.
+  const_iterator lower_bound(const Key& k) const
+  {
+    if (_size == 0)
+    {
+      return end();
+    }
+    uint64_t first = 0;
+    if (_height > 1)
+    {
+      auto offset = _root;
+      for (uint32_t level = _height; level > 1; --level)
+      {
+        auto node = reinterpret_cast<const inner*>(_base + offset);
+        // Separators not greater than k, the loads are independent.
+        size_t i = 0;
+        for (size_t j = 0; j < node->count; ++j)
+        {
+          i += !(k < node->keys[j]);
+        }
+        offset = node->children[i];
+      }
+      first = (offset - keys_offset) / sizeof(Key);
+    }
+    auto leaf = _keys + first;
+    auto n = std::min<uint64_t>(node_keys, _size - first);
+    size_t pos = 0;
+    for (size_t j = 0; j < n; ++j)
+    {
+      pos += leaf[j] < k;
+    }
+    // The leaves are contiguous, a position past this leaf is the first key
+    // of the next one.
+    return leaf + pos;
+  }
+
+  // First key greater than k.
+  const_iterator upper_bound(const Key& k) const
+  {
+    auto it = lower_bound(k);
+    return it != end() && *it == k ? it + 1 : it;
+  }
+
+  const_iterator begin() const { return _keys; }
+  const_iterator end() const { return _keys + _size; }
+  size_type size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  size_t height() const { return _height; }
+  size_t bytes_used() const { return _length; }
+
+private:
+  // Sequential writer for save().
+  class file
+  {
+  public:
+    explicit file(const char* path) : _path(path), _f(fopen(path, "wb"))
+    {
+      if (_f == nullptr)
+      {
+        fail();
+      }
+    }
+    ~file()
+    {
+      if (_f != nullptr)
+      {
+        fclose(_f);
+      }
+    }
+
+    void write(const void* p, size_t n)
+    {
+      if (fwrite(p, 1, n, _f) != n)
+      {
+        fail();
+      }
+      _offset += n;
+    }
+
+    // Zero fills up to offset.
+    void pad(uint64_t offset)
+    {
+      static const char zeros[64] = {};
+      while (_offset < offset)
+      {
+        write(zeros, std::min<uint64_t>(sizeof(zeros), offset - _offset));
+      }
+    }
+
+    void rewrite_header(const void* p, size_t n)
+    {
+      if (fseek(_f, 0, SEEK_SET) != 0 || fwrite(p, 1, n, _f) != n || fclose(_f) != 0)
+      {
+        _f = nullptr;
+        fail();
+      }
+      _f = nullptr;
+    }
+
+    uint64_t offset() const { return _offset; }
+
+  private:
+    void fail() { throw std::runtime_error(std::string("btree_image_set: cannot write ") + _path); }
+
+    std::string _path;
+    FILE* _f;
+    uint64_t _offset = 0;
+  };
+
+  void map(const char* path)
+  {
+    auto fail = [path]() { throw std::runtime_error(std::string("btree_image_set: cannot map ") + path); };
+#ifdef _WIN32
+    auto f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (f == INVALID_HANDLE_VALUE)
+    {
+      fail();
+    }
+    LARGE_INTEGER length;
+    GetFileSizeEx(f, &length);
+    auto m = length.QuadPart > 0 ? CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    CloseHandle(f);
+    if (m == nullptr)
+    {
+      fail();
+    }
+    auto p = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(m);
+    if (p == nullptr)
+    {
+      fail();
+    }
+    _length = static_cast<size_t>(length.QuadPart);
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+      fail();
+    }
+    struct stat st;
+    void* p = fstat(fd, &st) == 0 && st.st_size > 0 ?
+      mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+      fail();
+    }
+    _length = st.st_size;
+#endif
+    _base = static_cast<const char*>(p);
+  }
+
+  const char* _base = nullptr;
+  size_t _length = 0;
+  const Key* _keys = nullptr;
+  uint64_t _size = 0;
+  uint32_t _height = 0;
+  uint64_t _root = 0;
+};
+
+#endif // BTREE_IMAGE_H
@@ -16,6 +16,10 @@
 // interface (a.k.a set<>) using a btree. A btree_multiset<> implements the STL
 // multiple sorted associative container interface (a.k.a multiset<>) using a
 // btree. See btree.h for details of the btree implementation and caveats.
+//
+// With Counted set the internal nodes also keep the size of every child
+// subtree, which adds rank(), select() and count_range() in O(log n) at the
+// price of larger internal nodes and some bookkeeping on insert and erase.
 
 #ifndef UTIL_BTREE_BTREE_SET_H__
 #define UTIL_BTREE_BTREE_SET_H__
@@ -33,12 +37,14 @@ namespace btree {
 template <typename Key,
           typename Compare = std::less<Key>,
           typename Alloc = std::allocator<Key>,
-          int TargetNodeSize = 256>
+          int TargetNodeSize = 256,
+          bool Counted = false>
 class btree_set : public btree_unique_container<
-  btree<btree_set_params<Key, Compare, Alloc, TargetNodeSize> > > {
+  btree<btree_set_params<Key, Compare, Alloc, TargetNodeSize, Counted> > > {
 
-  typedef btree_set<Key, Compare, Alloc, TargetNodeSize> self_type;
-  typedef btree_set_params<Key, Compare, Alloc, TargetNodeSize> params_type;
+  typedef btree_set<Key, Compare, Alloc, TargetNodeSize, Counted> self_type;
+  typedef btree_set_params<Key, Compare, Alloc, TargetNodeSize, Counted>
+      params_type;
   typedef btree<params_type> btree_type;
   typedef btree_unique_container<btree_type> super_type;
 
@@ -67,8 +73,8 @@ class btree_set : public btree_unique_container<
   }
 };
 
-template <typename K, typename C, typename A, int N>
-inline void swap(btree_set<K, C, A, N> &x, btree_set<K, C, A, N> &y) {
+template <typename K, typename C, typename A, int N, bool R>
+inline void swap(btree_set<K, C, A, N, R> &x, btree_set<K, C, A, N, R> &y) {
   x.swap(y);
 }
 
@@ -76,12 +82,15 @@ inline void swap(btree_set<K, C, A, N> &x, btree_set<K, C, A, N> &y) {
 template <typename Key,
           typename Compare = std::less<Key>,
           typename Alloc = std::allocator<Key>,
-          int TargetNodeSize = 256>
+          int TargetNodeSize = 256,
+          bool Counted = false>
 class btree_multiset : public btree_multi_container<
-  btree<btree_set_params<Key, Compare, Alloc, TargetNodeSize> > > {
+  btree<btree_set_params<Key, Compare, Alloc, TargetNodeSize, Counted> > > {
 
-  typedef btree_multiset<Key, Compare, Alloc, TargetNodeSize> self_type;
-  typedef btree_set_params<Key, Compare, Alloc, TargetNodeSize> params_type;
+  typedef btree_multiset<Key, Compare, Alloc, TargetNodeSize, Counted>
+      self_type;
+  typedef btree_set_params<Key, Compare, Alloc, TargetNodeSize, Counted>
+      params_type;
   typedef btree<params_type> btree_type;
   typedef btree_multi_container<btree_type> super_type;
 
@@ -110,9 +119,9 @@ class btree_multiset : public btree_multi_container<
   }
 };
 
-template <typename K, typename C, typename A, int N>
-inline void swap(btree_multiset<K, C, A, N> &x,
-                 btree_multiset<K, C, A, N> &y) {
+template <typename K, typename C, typename A, int N, bool R>
+inline void swap(btree_multiset<K, C, A, N, R> &x,
+                 btree_multiset<K, C, A, N, R> &y) {
   x.swap(y);
 }
 
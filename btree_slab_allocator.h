@@ -0,0 +1,285 @@
+// A node allocator for btree_set, btree_multiset and the other btree
+// containers:
+//
+//   btree::btree_set<int64_t, std::less<int64_t>,
+//                    btree::btree_slab_allocator<int64_t> > s;
+//
+// A btree allocates two kinds of nodes, leaves and internal nodes, each of a
+// fixed size. The btree reports both sizes through set_node_sizes() and the
+// pool gives each one a size class of its own, so a node takes exactly its
+// size rounded up to the alignment, without the header and size class
+// rounding of malloc. A class carves slabs of whole pages, each big enough
+// for kMinSlots nodes, out of chunks of kChunkSize bytes mapped from the OS.
+// Erased nodes go on the free list of their class and are reused first.
+// Other requests, the root node and the small root leaf of a tree holding
+// only a few values, are passed to operator new.
+//
+// With HugePages the chunks are aligned to 2 MB and backed by transparent
+// huge pages (Linux) or large pages (Windows, needs SeLockMemoryPrivilege,
+// falls back to normal pages without it), which saves TLB misses when the
+// tree is much larger than the cache.
+//
+// Memory goes back to the OS only when the last allocator sharing the pool
+// is destroyed. Copies of an allocator share the pool, which is not thread
+// safe.
+
+#ifndef UTIL_BTREE_BTREE_SLAB_ALLOCATOR_H__
+#define UTIL_BTREE_BTREE_SLAB_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace btree {
+
+class btree_slab_pool {
+ public:
+  enum {
+    kPageSize = 4096,
+    kChunkSize = 2 << 20,
+    kMinSlots = 8,
+  };
+
+  explicit btree_slab_pool(bool huge_pages)
+      : huge_pages_(huge_pages) {
+  }
+  ~btree_slab_pool() {
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+      release_chunk(chunks_[i]);
+    }
+  }
+
+  // Sets up the two size classes. Later calls, from trees sharing the pool,
+  // keep the classes of the first one.
+  void set_node_sizes(size_t leaf, size_t internal) {
+    if (classes_[0].size == 0 && classes_[1].size == 0) {
+      init_class(&classes_[0], leaf);
+      init_class(&classes_[1], internal);
+    }
+  }
+
+  void* allocate(size_t n) {
+    size_class *c = find_class(n);
+    if (c == NULL) {
+      return ::operator new(n);
+    }
+    ++c->used;
+    if (c->free != NULL) {
+      free_slot *p = c->free;
+      c->free = p->next;
+      return p;
+    }
+    if (c->end - c->next < static_cast<ptrdiff_t>(c->slot)) {
+      new_slab(c);
+    }
+    void *p = c->next;
+    c->next += c->slot;
+    return p;
+  }
+
+  void deallocate(void *p, size_t n) {
+    size_class *c = find_class(n);
+    if (c == NULL) {
+      ::operator delete(p);
+      return;
+    }
+    --c->used;
+    free_slot *s = static_cast<free_slot*>(p);
+    s->next = c->free;
+    c->free = s;
+  }
+
+  // Bytes mapped from the OS.
+  size_t bytes_reserved() const { return chunks_.size() * kChunkSize; }
+  // Bytes taken by live nodes of both classes, including slot rounding.
+  size_t bytes_used() const {
+    return classes_[0].used * classes_[0].slot +
+        classes_[1].used * classes_[1].slot;
+  }
+  bool huge_pages() const { return huge_pages_; }
+
+ private:
+  struct free_slot {
+    free_slot *next;
+  };
+
+  struct size_class {
+    size_class()
+        : size(0), slot(0), slab(0), used(0),
+          next(NULL), end(NULL), free(NULL) {
+    }
+    size_t size;
+    size_t slot;
+    size_t slab;
+    size_t used;
+    char *next;
+    char *end;
+    free_slot *free;
+  };
+
+  static void init_class(size_class *c, size_t size) {
+    const size_t align = alignof(std::max_align_t);
+    const size_t slot = (size + align - 1) / align * align;
+    const size_t slab =
+        (slot * kMinSlots + kPageSize - 1) / kPageSize * kPageSize;
+    if (size < sizeof(free_slot) || slab > kChunkSize) {
+      return;
+    }
+    c->size = size;
+    c->slot = slot;
+    c->slab = slab;
+  }
+
+  size_class* find_class(size_t n) {
+    if (n == classes_[0].size) {
+      return &classes_[0];
+    }
+    if (n == classes_[1].size) {
+      return &classes_[1];
+    }
+    return NULL;
+  }
+
+  // Takes the next slab for c from the current chunk; the rest of a chunk
+  // too short for the slab is left unused.
+  void new_slab(size_class *c) {
+    if (chunk_end_ - chunk_next_ < static_cast<ptrdiff_t>(c->slab)) {
+      chunk_next_ = map_chunk();
+      chunks_.push_back(chunk_next_);
+      chunk_end_ = chunk_next_ + kChunkSize;
+    }
+    c->next = chunk_next_;
+    c->end = chunk_next_ + c->slab;
+    chunk_next_ += c->slab;
+  }
+
+  char* map_chunk() {
+#ifdef _WIN32
+    void *p = NULL;
+    if (huge_pages_) {
+      p = VirtualAlloc(NULL, kChunkSize,
+                       MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                       PAGE_READWRITE);
+    }
+    if (p == NULL) {
+      p = VirtualAlloc(NULL, kChunkSize, MEM_RESERVE | MEM_COMMIT,
+                       PAGE_READWRITE);
+    }
+    if (p == NULL) {
+      throw std::bad_alloc();
+    }
+    return static_cast<char*>(p);
+#else
+    // A huge page chunk is cut out of a mapping twice its size, so that it
+    // starts on a 2 MB boundary.
+    const size_t length = huge_pages_ ? 2 * kChunkSize : kChunkSize;
+    void *m = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    char *p = static_cast<char*>(m);
+    if (huge_pages_) {
+      const size_t head = (kChunkSize -
+          reinterpret_cast<uintptr_t>(p) % kChunkSize) % kChunkSize;
+      if (head > 0) {
+        munmap(p, head);
+      }
+      munmap(p + head + kChunkSize, kChunkSize - head);
+      p += head;
+#ifdef MADV_HUGEPAGE
+      madvise(p, kChunkSize, MADV_HUGEPAGE);
+#endif
+    }
+    return p;
+#endif
+  }
+
+  static void release_chunk(char *p) {
+#ifdef _WIN32
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, kChunkSize);
+#endif
+  }
+
+  bool huge_pages_;
+  size_class classes_[2];
+  std::vector<char*> chunks_;
+  char *chunk_next_ = NULL;
+  char *chunk_end_ = NULL;
+};
+
+template <typename T, bool HugePages = false>
+class btree_slab_allocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <typename U>
+  struct rebind {
+    typedef btree_slab_allocator<U, HugePages> other;
+  };
+
+  btree_slab_allocator()
+      : pool_(std::make_shared<btree_slab_pool>(HugePages)) {
+  }
+  template <typename U>
+  btree_slab_allocator(const btree_slab_allocator<U, HugePages> &x)
+      : pool_(x.pool()) {
+  }
+
+  T* allocate(size_type n) {
+    return static_cast<T*>(pool_->allocate(n * sizeof(T)));
+  }
+  void deallocate(T *p, size_type n) {
+    pool_->deallocate(p, n * sizeof(T));
+  }
+  size_type max_size() const {
+    return std::numeric_limits<size_type>::max() / sizeof(T);
+  }
+
+  // Called by the btree with the sizes of its leaf and internal nodes.
+  void set_node_sizes(size_t leaf, size_t internal) {
+    pool_->set_node_sizes(leaf, internal);
+  }
+
+  const std::shared_ptr<btree_slab_pool>& pool() const { return pool_; }
+
+ private:
+  std::shared_ptr<btree_slab_pool> pool_;
+};
+
+template <typename T, typename U, bool H>
+bool operator==(const btree_slab_allocator<T, H> &x,
+                const btree_slab_allocator<U, H> &y) {
+  return x.pool() == y.pool();
+}
+
+template <typename T, typename U, bool H>
+bool operator!=(const btree_slab_allocator<T, H> &x,
+                const btree_slab_allocator<U, H> &y) {
+  return x.pool() != y.pool();
+}
+
+} // namespace btree
+
+#endif  // UTIL_BTREE_BTREE_SLAB_ALLOCATOR_H__
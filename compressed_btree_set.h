@@ -0,0 +1,505 @@
+// Ordered set of integral keys with frame-of-reference compressed leaves.
+//
+// Keys live in leaves of up to LeafKeys keys. A leaf stores its smallest key
+// as a base and every key as a delta from it, bit-packed with the width of
+// the largest delta, so the width adapts to how densely the leaf is
+// populated: random 64 bit keys in a set of millions still need 40 odd bits,
+// clustered identifiers often less than 16. Leaves are indexed by a
+// btree::btree_set of (lowest key covered, leaf) entries, which keeps lookups
+// logarithmic; a leaf is searched by binary search over the packed deltas,
+// decoding one field at a time.
+//
+// Insert and erase decode the leaf, change it and encode it again with a
+// possibly different base and width. A full leaf is split in halves, a leaf
+// left empty by erase is released. bulk_load() builds packed leaves and the
+// index directly from a sorted range.
+
+#ifndef COMPRESSED_BTREE_SET_H
+#define COMPRESSED_BTREE_SET_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include "btree_set.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace compressed_btree
+{
+  inline unsigned bit_width(uint64_t x)
+  {
+#ifdef _MSC_VER
+    unsigned long r;
+    return _BitScanReverse64(&r, x) ? r + 1 : 0;
+#else
+    return x == 0 ? 0 : 64 - __builtin_clzll(x);
+#endif
+  }
+
+  // Field i of width bits, fields may straddle two words.
+  inline uint64_t get(const uint64_t* words, unsigned width, size_t i)
+  {
+    if (width == 0)
+    {
+      return 0;
+    }
+    auto bit = i * width;
+    auto word = bit >> 6;
+    auto offset = bit & 63;
+    auto v = words[word] >> offset;
+    if (offset + width > 64)
+    {
+      v |= words[word + 1] << (64 - offset);
+    }
+    return width == 64 ? v : v & ((1ULL << width) - 1);
+  }
+
+  // Stores field i into zeroed words.
+  inline void put(uint64_t* words, unsigned width, size_t i, uint64_t v)
+  {
+    if (width == 0)
+    {
+      return;
+    }
+    auto bit = i * width;
+    auto word = bit >> 6;
+    auto offset = bit & 63;
+    words[word] |= v << offset;
+    if (offset + width > 64)
+    {
+      words[word + 1] |= v >> (64 - offset);
+    }
+  }
+} // compressed_btree
+
+template<class Key = uint64_t, class Alloc = std::allocator<Key>, int LeafKeys = 128>
+class compressed_btree_set
+{
+  static_assert(std::is_integral<Key>::value, "compressed_btree_set supports integral keys only");
+  static_assert(LeafKeys >= 2 && LeafKeys <= 65535, "LeafKeys must be in [2, 65535]");
+
+  // Header of a leaf, followed by words of packed deltas.
+  struct leaf
+  {
+    uint64_t base;
+    uint32_t count;
+    uint16_t width;
+    uint16_t words;
+  };
+  static_assert(sizeof(leaf) == 2 * sizeof(uint64_t), "leaf header must take two words");
+
+  struct entry
+  {
+    uint64_t key;
+    // Replaced when the leaf is reallocated, not part of the ordering.
+    mutable leaf* node;
+    bool operator<(const entry& x) const { return key < x.key; }
+  };
+
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<uint64_t> word_allocator;
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<entry> entry_allocator;
+  typedef btree::btree_set<entry, std::less<entry>, entry_allocator> index;
+  typedef typename index::const_iterator index_iterator;
+
+  // Unsigned keys keep their order as uint64_t, signed ones after flipping
+  // the sign bit.
+  static constexpr uint64_t bias = std::is_signed<Key>::value ? 1ULL << 63 : 0;
+  static uint64_t to_u(const Key& k) { return static_cast<uint64_t>(k) ^ bias; }
+  static Key from_u(uint64_t u) { return static_cast<Key>(u ^ bias); }
+
+  static uint64_t* data(leaf* l) { return reinterpret_cast<uint64_t*>(l + 1); }
+  static const uint64_t* data(const leaf* l) { return reinterpret_cast<const uint64_t*>(l + 1); }
+  static uint64_t at(const leaf* l, size_t i) { return l->base + compressed_btree::get(data(l), l->width, i); }
+
+public:
+  typedef Key key_type;
+  typedef Key value_type;
+  typedef size_t size_type;
+
+  class const_iterator
+  {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Key value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const Key* pointer;
+    typedef const Key& reference;
+
+    const_iterator() {}
+    const_iterator(index_iterator e, index_iterator end, size_t i) : _e(e), _end(end), _i(i) { settle(); }
+
+    reference operator*() const { return _key; }
+    pointer operator->() const { return &_key; }
+    const_iterator& operator++()
+    {
+      ++_i;
+      settle();
+      return *this;
+    }
+    const_iterator operator++(int)
+    {
+      auto tmp = *this;
+      ++*this;
+      return tmp;
+    }
+    bool operator==(const const_iterator& x) const { return _e == x._e && _i == x._i; }
+    bool operator!=(const const_iterator& x) const { return !(*this == x); }
+
+  private:
+    void settle()
+    {
+      if (_e != _end && _i == _e->node->count)
+      {
+        ++_e;
+        _i = 0;
+      }
+      if (_e != _end)
+      {
+        _key = from_u(at(_e->node, _i));
+      }
+    }
+
+    index_iterator _e;
+    index_iterator _end;
+    size_t _i = 0;
+    Key _key = Key();
+  };
+  typedef const_iterator iterator;
+
+  compressed_btree_set() {}
+  compressed_btree_set(const compressed_btree_set&) = delete;
+  compressed_btree_set& operator=(const compressed_btree_set&) = delete;
+  ~compressed_btree_set() { clear(); }
+
+  bool insert(const Key& k)
+  {
+    auto u = to_u(k);
+    if (_index.empty())
+    {
+      auto l = make_leaf(&u, 1, 0);
+      _index.insert(entry{ 0, l });
+      _size = 1;
+      return true;
+    }
+    auto e = locate(u);
+    auto l = e->node;
+    auto keys = scratch();
+    auto n = decode(l, keys);
+    size_t pos = std::lower_bound(keys, keys + n, u) - keys;
+    if (pos < n && keys[pos] == u)
+    {
+      return false;
+    }
+    std::copy_backward(keys + pos, keys + n, keys + n + 1);
+    keys[pos] = u;
+    ++n;
+    if (n <= LeafKeys)
+    {
+      e->node = encode(l, keys, n);
+    }
+    else
+    {
+      auto half = n / 2;
+      e->node = encode(l, keys, half);
+      _index.insert(entry{ keys[half], make_leaf(keys + half, n - half, 0) });
+    }
+    ++_size;
+    return true;
+  }
+
+  template<class InputIterator>
+  void insert(InputIterator b, InputIterator e)
+  {
+    for (; b != e; ++b)
+    {
+      insert(*b);
+    }
+  }
+
+  size_type erase(const Key& k)
+  {
+    if (_index.empty())
+    {
+      return 0;
+    }
+    auto u = to_u(k);
+    auto e = locate(u);
+    auto l = e->node;
+    auto keys = scratch();
+    auto n = decode(l, keys);
+    size_t pos = std::lower_bound(keys, keys + n, u) - keys;
+    if (pos == n || keys[pos] != u)
+    {
+      return 0;
+    }
+    std::copy(keys + pos + 1, keys + n, keys + pos);
+    --n;
+    if (n > 0)
+    {
+      e->node = encode(l, keys, n);
+    }
+    else
+    {
+      free_leaf(l);
+      auto first = e == _index.begin();
+      _index.erase(entry{ e->key, nullptr });
+      if (first && !_index.empty())
+      {
+        // The first leaf also covers every key below its own.
+        auto next = _index.begin()->node;
+        _index.erase(_index.begin());
+        _index.insert(entry{ 0, next });
+      }
+    }
+    --_size;
+    return 1;
+  }
+
+  const_iterator find(const Key& k) const
+  {
+    if (_index.empty())
+    {
+      return end();
+    }
+    auto u = to_u(k);
+    auto e = locate(u);
+    auto l = e->node;
+    if (u < l->base)
+    {
+      return end();
+    }
+    auto i = search(l, u);
+    return i < l->count && at(l, i) == u ? const_iterator(e, _index.end(), i) : end();
+  }
+
+  size_type count(const Key& k) const { return find(k) != end() ? 1 : 0; }
+
+  // First key not less than k.
+  const_iterator lower_bound(const Key& k) const
+  {
+    if (_index.empty())
+    {
+      return end();
+    }
+    auto u = to_u(k);
+    auto e = locate(u);
+    return const_iterator(e, _index.end(), search(e->node, u));
+  }
+
+  // First key greater than k.
+  const_iterator upper_bound(const Key& k) const
+  {
+    auto it = lower_bound(k);
+    return it != end() && *it == k ? ++it : it;
+  }
+
+  const_iterator begin() const { return const_iterator(_index.begin(), _index.end(), 0); }
+  const_iterator end() const { return const_iterator(_index.end(), _index.end(), 0); }
+  size_type size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  void clear()
+  {
+    for (auto& e : _index)
+    {
+      free_leaf(e.node);
+    }
+    _index.clear();
+    _size = 0;
+  }
+
+  // Replaces the contents with a sorted range of unique keys, every leaf
+  // but the last gets fill * LeafKeys keys.
+  template<class ForwardIterator>
+  void bulk_load_sorted(ForwardIterator first, ForwardIterator last, double fill = 1.0)
+  {
+    clear();
+    auto per_leaf = std::max<size_t>(1, std::min<size_t>(LeafKeys, static_cast<size_t>(fill * LeafKeys)));
+    std::vector<entry> entries;
+    auto keys = scratch();
+    size_t n = 0;
+    for (; first != last; ++first)
+    {
+      keys[n++] = to_u(*first);
+      if (n == per_leaf)
+      {
+        entries.push_back(entry{ keys[0], make_leaf(keys, n, 0) });
+        _size += n;
+        n = 0;
+      }
+    }
+    if (n > 0)
+    {
+      entries.push_back(entry{ keys[0], make_leaf(keys, n, 0) });
+      _size += n;
+    }
+    if (!entries.empty())
+    {
+      entries[0].key = 0;
+    }
+    _index.bulk_load_sorted(entries.begin(), entries.end());
+  }
+
+  // Replaces the contents with the keys of any range.
+  template<class InputIterator>
+  void bulk_load(InputIterator b, InputIterator e, double fill = 1.0)
+  {
+    std::vector<Key> keys(b, e);
+    std::sort(keys.begin(), keys.end(), [](const Key& x, const Key& y) { return to_u(x) < to_u(y); });
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    bulk_load_sorted(keys.begin(), keys.end(), fill);
+  }
+
+  static size_t leaf_keys() { return LeafKeys; }
+  size_t leaves() const { return _index.size(); }
+  size_t height() const { return _index.height() + (_index.empty() ? 0 : 1); }
+
+  // Share of the leaf slots in use.
+  double fullness() const
+  {
+    return _index.empty() ? 0.0 : static_cast<double>(_size) / (_index.size() * LeafKeys);
+  }
+
+  // Average number of bits per key in the packed deltas.
+  double average_width() const
+  {
+    uint64_t bits = 0;
+    for (auto& e : _index)
+    {
+      bits += static_cast<uint64_t>(e.node->width) * e.node->count;
+    }
+    return _size == 0 ? 0.0 : static_cast<double>(bits) / _size;
+  }
+
+  size_t bytes_used() const
+  {
+    return sizeof(*this) - sizeof(_index) + _index.bytes_used() + _leaf_bytes + _scratch.capacity() * sizeof(uint64_t);
+  }
+
+  // Bytes per key beyond the raw key size, negative when compressed below it.
+  double overhead() const
+  {
+    return _size == 0 ? 0.0 : (static_cast<double>(bytes_used()) - _size * sizeof(Key)) / _size;
+  }
+
+private:
+  // Entry of the leaf which holds u: the last one whose key is not greater.
+  // The key of the first entry is 0, so there always is one.
+  index_iterator locate(uint64_t u) const
+  {
+    auto it = _index.upper_bound(entry{ u, nullptr });
+    return --it;
+  }
+
+  // Position of the first key not less than u.
+  static size_t search(const leaf* l, uint64_t u)
+  {
+    if (u < l->base)
+    {
+      return 0;
+    }
+    auto d = u - l->base;
+    auto words = data(l);
+    size_t lo = 0;
+    size_t n = l->count;
+    while (n > 0)
+    {
+      auto half = n / 2;
+      if (compressed_btree::get(words, l->width, lo + half) < d)
+      {
+        lo += half + 1;
+        n -= half + 1;
+      }
+      else
+      {
+        n = half;
+      }
+    }
+    return lo;
+  }
+
+  static size_t decode(const leaf* l, uint64_t* keys)
+  {
+    auto words = data(l);
+    for (size_t i = 0; i < l->count; ++i)
+    {
+      keys[i] = l->base + compressed_btree::get(words, l->width, i);
+    }
+    return l->count;
+  }
+
+  // Room for the keys of a leaf and one more, which insert, erase and
+  // bulk_load_sorted decode into. It is kept with the set rather than on the
+  // stack, where up to 65535 keys would not fit safely.
+  uint64_t* scratch()
+  {
+    if (_scratch.empty())
+    {
+      _scratch.resize(LeafKeys + 1);
+    }
+    return _scratch.data();
+  }
+
+  static size_t words_for(size_t n, unsigned width) { return (n * width + 63) / 64; }
+
+  leaf* make_leaf(const uint64_t* keys, size_t n, size_t words)
+  {
+    auto width = compressed_btree::bit_width(keys[n - 1] - keys[0]);
+    words = std::max(words, words_for(n, width));
+    word_allocator a;
+    auto l = reinterpret_cast<leaf*>(a.allocate(2 + words));
+    l->words = static_cast<uint16_t>(words);
+    _leaf_bytes += (2 + words) * sizeof(uint64_t);
+    fill(l, keys, n, width);
+    return l;
+  }
+
+  void free_leaf(leaf* l)
+  {
+    _leaf_bytes -= (2 + l->words) * sizeof(uint64_t);
+    word_allocator a;
+    a.deallocate(reinterpret_cast<uint64_t*>(l), 2 + l->words);
+  }
+
+  static void fill(leaf* l, const uint64_t* keys, size_t n, unsigned width)
+  {
+    l->base = keys[0];
+    l->count = static_cast<uint32_t>(n);
+    l->width = static_cast<uint16_t>(width);
+    auto words = data(l);
+    std::fill(words, words + l->words, 0);
+    for (size_t i = 0; i < n; ++i)
+    {
+      compressed_btree::put(words, width, i, keys[i] - keys[0]);
+    }
+  }
+
+  // Stores keys into l, reallocating it when it is too small or mostly
+  // unused. Returns the leaf now holding the keys.
+  leaf* encode(leaf* l, const uint64_t* keys, size_t n)
+  {
+    auto width = compressed_btree::bit_width(keys[n - 1] - keys[0]);
+    auto need = words_for(n, width);
+    if (need > l->words || need + need / 2 + 2 < l->words)
+    {
+      // Leave room for a few more inserts before the next reallocation.
+      auto words = std::min(need + need / 8 + 1, words_for(LeafKeys, 64));
+      free_leaf(l);
+      return make_leaf(keys, n, words);
+    }
+    fill(l, keys, n, width);
+    return l;
+  }
+
+  index _index;
+  size_t _size = 0;
+  size_t _leaf_bytes = 0;
+  std::vector<uint64_t> _scratch;
+};
+
+#endif // COMPRESSED_BTREE_SET_H
@@ -0,0 +1,280 @@
+// Static sorted set of integral keys stored in Eytzinger (BFS) order.
+//
+// The keys of an implicit binary search tree are laid out level by level:
+// the root at index 1 and the children of node k at 2k and 2k + 1. Search is
+// branchless - every step is k = 2k + (key(k) < x) - and all descendants of
+// node k a few levels down share one cache line, so that line is prefetched
+// while the current levels are compared. On large sets this hides most of the
+// memory latency which dominates a plain binary search over a sorted array.
+//
+// The set is built once (from any range, or from an already sorted range) and
+// is read-only afterwards. Besides find() it supports lower_bound(), in-order
+// iteration and rank(), the number of keys less than a given key.
+
+#ifndef EYTZINGER_SET_H
+#define EYTZINGER_SET_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#define EYTZINGER_PREFETCH(p) _mm_prefetch(reinterpret_cast<const char*>(p), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define EYTZINGER_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define EYTZINGER_PREFETCH(p)
+#endif
+
+namespace eytzinger
+{
+  inline unsigned ctz(uint64_t x)
+  {
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanForward64(&r, x);
+    return r;
+#else
+    return __builtin_ctzll(x);
+#endif
+  }
+
+  inline unsigned log2(uint64_t x)
+  {
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanReverse64(&r, x);
+    return r;
+#else
+    return 63 - __builtin_clzll(x);
+#endif
+  }
+} // eytzinger
+
+template<class Key = uint64_t, class Alloc = std::allocator<Key>>
+class eytzinger_set
+{
+  static_assert(std::is_integral<Key>::value, "eytzinger_set supports integral keys only");
+
+  typedef std::vector<Key, Alloc> keys;
+
+  static constexpr size_t cache_line = 64;
+  static constexpr size_t keys_per_line = cache_line / sizeof(Key);
+
+public:
+  typedef Key key_type;
+  typedef Key value_type;
+  typedef size_t size_type;
+
+  // In-order iterator, walks the implicit tree from node to successor.
+  class const_iterator
+  {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Key value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const Key* pointer;
+    typedef const Key& reference;
+
+    const_iterator() {}
+    const_iterator(const eytzinger_set* s, size_t k) : _s(s), _k(k) {}
+
+    reference operator*() const { return _s->_b[_k]; }
+    pointer operator->() const { return &_s->_b[_k]; }
+    const_iterator& operator++()
+    {
+      _k = _s->successor(_k);
+      return *this;
+    }
+    const_iterator operator++(int)
+    {
+      auto tmp = *this;
+      ++*this;
+      return tmp;
+    }
+    bool operator==(const const_iterator& x) const { return _k == x._k; }
+    bool operator!=(const const_iterator& x) const { return _k != x._k; }
+
+    // Index of the key in Eytzinger order, 0 for end().
+    size_t index() const { return _k; }
+
+  private:
+    const eytzinger_set* _s = nullptr;
+    size_t _k = 0;
+  };
+  typedef const_iterator iterator;
+
+  eytzinger_set() {}
+  eytzinger_set(const eytzinger_set&) = delete;
+  eytzinger_set& operator=(const eytzinger_set&) = delete;
+
+  // Queues a key for the next build(). Keys already in the built set are
+  // rejected, duplicates among queued keys are removed by build().
+  bool insert(const Key& k)
+  {
+    if (_n != 0 && find(k) != end())
+    {
+      return false;
+    }
+    _pending.push_back(k);
+    return true;
+  }
+
+  template<class InputIterator>
+  void insert(InputIterator b, InputIterator e)
+  {
+    _pending.insert(_pending.end(), b, e);
+  }
+
+  // Sorts the built keys together with all queued keys and lays them out.
+  void build()
+  {
+    if (_pending.empty())
+    {
+      return;
+    }
+    keys all(std::move(_pending));
+    _pending = keys();
+    all.insert(all.end(), begin(), end());
+    std::sort(all.begin(), all.end());
+    all.erase(std::unique(all.begin(), all.end()), all.end());
+    build_sorted(all.begin(), all.end());
+  }
+
+  // Replaces the contents with a sorted range of unique keys.
+  template<class ForwardIterator>
+  void build_sorted(ForwardIterator first, ForwardIterator last)
+  {
+    _n = static_cast<size_t>(std::distance(first, last));
+    // b[0] is unused, the extra line leaves room to align _b to a cache line.
+    // Prefetches past the end are harmless, they never fault.
+    _data = keys();
+    _data.resize(_n + 1 + keys_per_line);
+    auto addr = reinterpret_cast<uintptr_t>(_data.data());
+    auto skew = (cache_line - addr % cache_line) % cache_line;
+    _b = _data.data() + skew / sizeof(Key);
+    layout(first, 1);
+  }
+
+  const_iterator find(const Key& x) const
+  {
+    auto k = search(x);
+    return k != 0 && _b[k] == x ? const_iterator(this, k) : end();
+  }
+
+  size_type count(const Key& x) const { return find(x) != end() ? 1 : 0; }
+
+  // First key not less than x.
+  const_iterator lower_bound(const Key& x) const { return const_iterator(this, search(x)); }
+
+  // Number of keys less than x.
+  size_type rank(const Key& x) const { return sorted_index(search(x)); }
+
+  // Number of keys in [lo, hi).
+  size_type count_range(const Key& lo, const Key& hi) const
+  {
+    auto l = rank(lo);
+    auto h = rank(hi);
+    return h > l ? h - l : 0;
+  }
+
+  const_iterator begin() const
+  {
+    if (_n == 0)
+    {
+      return end();
+    }
+    size_t k = 1;
+    while (2 * k <= _n)
+    {
+      k *= 2;
+    }
+    return const_iterator(this, k);
+  }
+  const_iterator end() const { return const_iterator(this, 0); }
+
+  size_type size() const { return _n; }
+  bool empty() const { return _n == 0; }
+
+  void clear()
+  {
+    _data = keys();
+    _pending = keys();
+    _b = nullptr;
+    _n = 0;
+  }
+
+  size_t bytes_used() const { return sizeof(*this) + _data.capacity() * sizeof(Key); }
+
+private:
+  template<class ForwardIterator>
+  ForwardIterator layout(ForwardIterator it, size_t k)
+  {
+    if (k <= _n)
+    {
+      it = layout(it, 2 * k);
+      _b[k] = *it++;
+      it = layout(it, 2 * k + 1);
+    }
+    return it;
+  }
+
+  // Returns the Eytzinger index of the first key not less than x, 0 if none.
+  size_t search(const Key& x) const
+  {
+    size_t k = 1;
+    while (k <= _n)
+    {
+      EYTZINGER_PREFETCH(_b + k * keys_per_line);
+      k = 2 * k + (_b[k] < x);
+    }
+    // Each step records a right turn as 1 and a left turn as 0. The path went
+    // left at the answer and then only right: drop the trailing 1s and that 0.
+    return k >> (eytzinger::ctz(~static_cast<uint64_t>(k)) + 1);
+  }
+
+  size_t successor(size_t k) const
+  {
+    if (2 * k + 1 <= _n)
+    {
+      k = 2 * k + 1;
+      while (2 * k <= _n)
+      {
+        k *= 2;
+      }
+      return k;
+    }
+    return k >> (eytzinger::ctz(~static_cast<uint64_t>(k)) + 1);
+  }
+
+  // Position of node k in sorted order. In a perfect tree of h levels the
+  // in-order position of a node at depth d follows from k directly, the
+  // missing slots of the partial last level are then subtracted.
+  size_t sorted_index(size_t k) const
+  {
+    if (k == 0)
+    {
+      return _n;
+    }
+    auto h = eytzinger::log2(_n) + 1;
+    auto d = eytzinger::log2(k);
+    size_t p = ((2 * (k - (size_t(1) << d)) + 1) << (h - 1 - d)) - 1;
+    size_t last = _n - ((size_t(1) << (h - 1)) - 1);
+    size_t before = (p + 1) / 2;
+    return before > last ? p - (before - last) : p;
+  }
+
+  keys _data;
+  keys _pending;
+  Key* _b = nullptr;
+  size_t _n = 0;
+};
+
+#endif // EYTZINGER_SET_H
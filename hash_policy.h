@@ -0,0 +1,164 @@
+// Hash functions for integral keys, to use with the hash sets in place of
+// std::hash:
+//
+//   google::dense_hash_set<uint64_t, xxh3_hash<uint64_t>> s;
+//
+// All of them return size_t, and the sets take the low bits of the hash as
+// the home bucket. std::hash of an integer is the identity on libstdc++, so
+// keys which differ only in their high bits share a home bucket there.
+//
+// identity_hash       the key itself, what libstdc++ does
+// multiply_shift_hash one multiplication, the high bits of the product,
+//                     which depend on all bits of the key, are byte swapped
+//                     to the bottom
+// murmur3_hash        the 64 bit finalizer of MurmurHash3, two
+//                     multiplications
+// xxh3_hash           XXH3_64bits() of the key bytes with the default secret
+//                     and seed 0, the same value as the xxHash library
+// crc32c_hash         CRC32-C of the key bytes, with the SSE 4.2 crc32
+//                     instruction where the compiler targets it and a table
+//                     otherwise, only the low 32 bits are set
+
+#ifndef HASH_POLICY_H
+#define HASH_POLICY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+#if defined(__SSE4_2__) || (defined(_M_X64) && !defined(OLD_CPU))
+#define HASH_POLICY_HW_CRC32 1
+#include <nmmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+
+namespace hash_policy_detail
+{
+  inline uint64_t rotl64(uint64_t x, unsigned r)
+  {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  inline uint64_t bswap64(uint64_t x)
+  {
+#ifdef _MSC_VER
+    return _byteswap_uint64(x);
+#else
+    return __builtin_bswap64(x);
+#endif
+  }
+
+  // The key bytes as XXH3 and CRC32-C read them, little endian, 4 or 8 of them.
+  template<class Key>
+  uint64_t key_bits(Key key)
+  {
+    static_assert(std::is_integral<Key>::value && (sizeof(Key) == 4 || sizeof(Key) == 8),
+      "hash policies support 32 and 64 bit integral keys only");
+    return sizeof(Key) == 4 ? static_cast<uint32_t>(key) : static_cast<uint64_t>(key);
+  }
+
+  struct crc32c_table
+  {
+    uint32_t entries[256];
+
+    crc32c_table()
+    {
+      for (uint32_t n = 0; n < 256; ++n)
+      {
+        uint32_t c = n;
+        for (int k = 0; k < 8; ++k)
+        {
+          c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+        }
+        entries[n] = c;
+      }
+    }
+  };
+
+  // Same as the crc32 instruction: no initial or final inversion.
+  inline uint32_t crc32c(uint64_t bits, size_t bytes)
+  {
+#ifdef HASH_POLICY_HW_CRC32
+    return bytes == 4 ? _mm_crc32_u32(0, static_cast<uint32_t>(bits))
+                      : static_cast<uint32_t>(_mm_crc32_u64(0, bits));
+#else
+    static const crc32c_table table;
+    uint32_t c = 0;
+    for (size_t i = 0; i < bytes; ++i, bits >>= 8)
+    {
+      c = (c >> 8) ^ table.entries[(c ^ bits) & 0xff];
+    }
+    return c;
+#endif
+  }
+}
+
+template<class Key>
+struct identity_hash
+{
+  size_t operator()(Key key) const
+  {
+    return static_cast<size_t>(key);
+  }
+};
+
+template<class Key>
+struct multiply_shift_hash
+{
+  size_t operator()(Key key) const
+  {
+    return static_cast<size_t>(
+      hash_policy_detail::bswap64(static_cast<uint64_t>(key) * 0x9e3779b97f4a7c15ULL));
+  }
+};
+
+template<class Key>
+struct murmur3_hash
+{
+  size_t operator()(Key key) const
+  {
+    uint64_t h = static_cast<uint64_t>(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+  }
+};
+
+// XXH3_len_4to8_64b() with seed 0, the bitflip is read from bytes 8 to 23 of
+// the default secret.
+template<class Key>
+struct xxh3_hash
+{
+  size_t operator()(Key key) const
+  {
+    const uint64_t bits = hash_policy_detail::key_bits(key);
+    const uint64_t len = sizeof(Key);
+    const uint64_t low = static_cast<uint32_t>(bits);
+    const uint64_t high = static_cast<uint32_t>(bits >> (len * 8 - 32));
+    const uint64_t bitflip = 0x1cad21f72c81017cULL ^ 0xdb979083e96dd4deULL;
+    uint64_t h = (high + (low << 32)) ^ bitflip;
+    h ^= hash_policy_detail::rotl64(h, 49) ^ hash_policy_detail::rotl64(h, 24);
+    h *= 0x9fb21c651e98df25ULL;
+    h ^= (h >> 35) + len;
+    h *= 0x9fb21c651e98df25ULL;
+    h ^= h >> 28;
+    return static_cast<size_t>(h);
+  }
+};
+
+template<class Key>
+struct crc32c_hash
+{
+  size_t operator()(Key key) const
+  {
+    return hash_policy_detail::crc32c(hash_policy_detail::key_bits(key), sizeof(Key));
+  }
+};
+
+#endif
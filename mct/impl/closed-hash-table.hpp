@@ -35,6 +35,7 @@
 #include <memory>
 #include <stdexcept>
 #include <utility>
+#include <vector>
 
 #if MCT_CXX0X_SUPPORTED
 # include <initializer_list>
@@ -2287,6 +2288,8 @@ namespace mct
     const float        DEFAULT_MAX_LOAD_FACTOR = 0.6f;
     const float        MIN_MAX_LOAD_FACTOR     = 0.01f;
     const float        MAX_MAX_LOAD_FACTOR     = 0.99f;
+    const std::size_t  DEFAULT_BATCH_DEPTH     = 16;
+    const std::size_t  MAX_BATCH_DEPTH         = 64;
 
 
     template <typename Bucket, typename Hash, typename Equal>
@@ -2341,19 +2344,23 @@ namespace mct
       typedef  typename bucket_type::container_type         _container_type;
 
 
-# if MCT_DEBUGGING_MEMBERS
-
+      // Lookup lengths are in buckets; a cluster is a run of non-empty buckets, debris
+      // included; 'var_home_elements' is the variance of the number of elements per home
+      // bucket, whose mean is the load factor.
       struct statistics
       {
         double     debris_ratio;
         double     avg_present_lookup;
+        double     var_present_lookup;
         size_type  max_present_lookup;
         double     avg_absent_lookup;
+        double     var_absent_lookup;
         size_type  max_absent_lookup;
+        double     avg_cluster;
+        size_type  max_cluster;
+        double     var_home_elements;
       };
 
-# endif
-
       // Not documented; used only in MCT tests.
       static  const bool  KEEPS_HASHES = bucket_type::KEEPS_HASHES;
 
@@ -2366,6 +2373,7 @@ namespace mct
       key_equal       _equal;
       allocator_type  _allocator;
       float           _max_load_factor;
+      size_type       _batch_depth;
 
 
       // This structure is used to simplify exception safety code.
@@ -2393,9 +2401,10 @@ namespace mct
 
       hash_table_base (size_type num_buckets, const hasher& hash, const key_equal& equal,
                        const allocator_type& allocator)
-        : _hash      (hash),
-          _equal     (equal),
-          _allocator (allocator)
+        : _hash        (hash),
+          _equal       (equal),
+          _allocator   (allocator),
+          _batch_depth (DEFAULT_BATCH_DEPTH)
       {
         postpone_bucket_allocation (_data, finalize_num_buckets (num_buckets));
         do_set_max_load_factor (DEFAULT_MAX_LOAD_FACTOR);
@@ -2414,7 +2423,8 @@ namespace mct
           _hash            (that.hash_function ()),
           _equal           (that.key_eq ()),
           _allocator       (that.get_allocator ()),
-          _max_load_factor (that.max_load_factor ())
+          _max_load_factor (that.max_load_factor ()),
+          _batch_depth     (that.batch_depth ())
       {
         that._data.buckets = 0;
         that._data.clear ();
@@ -2427,9 +2437,10 @@ namespace mct
       hash_table_base (std::initializer_list <value_type> initializer,
                        size_type num_buckets, const hasher& hash, const key_equal& equal,
                        const allocator_type& allocator)
-        : _hash      (hash),
-          _equal     (equal),
-          _allocator (allocator)
+        : _hash        (hash),
+          _equal       (equal),
+          _allocator   (allocator),
+          _batch_depth (DEFAULT_BATCH_DEPTH)
       {
         initialize_from_range (initializer.begin (), initializer.end (), num_buckets);
       }
@@ -2440,9 +2451,10 @@ namespace mct
       hash_table_base (InputIterator first, InputIterator last,
                        size_type num_buckets, const hasher& hash, const key_equal& equal,
                        const allocator_type& allocator)
-        : _hash      (hash),
-          _equal     (equal),
-          _allocator (allocator)
+        : _hash        (hash),
+          _equal       (equal),
+          _allocator   (allocator),
+          _batch_depth (DEFAULT_BATCH_DEPTH)
       {
         initialize_from_range (first, last, num_buckets);
       }
@@ -2594,6 +2606,24 @@ namespace mct
         return _data.num_used != 0 && lookup (key) != _data.end () ? 1 : 0;
       }
 
+      // Batched lookups: results[k] receives find (keys[k]) or count (keys[k]).  Keys are
+      // hashed and the first bucket each probes is prefetched batch_depth () keys at a
+      // time, before any of them is looked up, so that the cache misses overlap.
+      void  find_batch  (const key_type* keys, size_type num_keys, iterator* results);
+      void  find_batch  (const key_type* keys, size_type num_keys,
+                         const_iterator* results) const;
+      void  count_batch (const key_type* keys, size_type num_keys, size_type* results) const;
+
+      size_type
+      batch_depth () const
+      {  return _batch_depth;  }
+
+      void
+      batch_depth (size_type batch_depth)
+      {
+        _batch_depth = (std::max) (size_type (1), (std::min) (batch_depth, MAX_BATCH_DEPTH));
+      }
+
       std::pair <iterator, iterator>
       equal_range (const key_type& key)
       {
@@ -2675,10 +2705,13 @@ namespace mct
       }
 
       void        validate_integrity () const;
-      statistics  collect_statistics () const;
 
 #   endif  // MCT_DEBUGGING_MEMBERS
 
+      // Walks all buckets, for diagnostics, e.g. of how well the hash function spreads
+      // the keys.
+      statistics  collect_statistics () const;
+
 
     protected:
 
@@ -2691,13 +2724,34 @@ namespace mct
       {  return const_iterator (_data, bucket);  }
 
 
-      bucket_pointer  lookup (const key_type& key)  const;
+      bucket_pointer
+      lookup (const key_type& key) const
+      {  return lookup (key, bucket_type::postprocess_hash (_hash (key)));  }
+
+      bucket_pointer  lookup (const key_type& key, size_type hash)  const;
 
       // Templated for convenience of map's operator[].  Exact meaning of 'that' is up to
       // subclasses or, more specifically, to the bucket type.  For linked tables this is
       // 'before', for forward table it's 'after'.
       template <typename type>
-      std::pair <bucket_pointer, bool>  lookup_or_insert (type data, bucket_pointer that = 0);
+      std::pair <bucket_pointer, bool>
+      lookup_or_insert (type data, bucket_pointer that = 0)
+      {
+        const size_type  hash = bucket_type::postprocess_hash
+                                  (_hash (bucket_type::extract_key (data)));
+        return lookup_or_insert <type> (MCT_STD_FORWARD (type, data), hash, that);
+      }
+
+      // Same, with 'hash' already computed (and postprocessed) by the caller.
+      template <typename type>
+      std::pair <bucket_pointer, bool>  lookup_or_insert (type data, size_type hash,
+                                                          bucket_pointer that);
+
+      // Asks for the first bucket probed for 'hash', ahead of a lookup.  Buckets must be
+      // allocated.
+      void
+      prefetch_bucket (size_type hash) const
+      {  MCT_OPTIMIZATION_PREFETCH (&*(_data.buckets + _data.start_probing (hash)));  }
 
 
       void  do_set_max_load_factor (float max_load_factor);
@@ -2925,6 +2979,36 @@ namespace mct
           this->template lookup_or_insert <const value_type&> (*first);
       }
 
+      // Like insert (values, values + num_values), but hashes values and prefetches their
+      // first buckets batch_depth () at a time before inserting them, like find_batch().
+      // Unless 'inserted' is null, inserted[k] tells whether values[k] was inserted.
+      void
+      insert_batch (const value_type* values, size_type num_values, bool* inserted = 0)
+      {
+        size_type  hashes[MAX_BATCH_DEPTH];
+
+        this->rehash_for_insertion (num_values);
+        for (size_type first = 0; first < num_values; first += this->_batch_depth)
+          {
+            const size_type  num = (std::min) (num_values - first, this->_batch_depth);
+
+            for (size_type k = 0; k < num; ++k)
+              {
+                hashes[k] = bucket_type::postprocess_hash
+                              (this->_hash (bucket_type::extract_key (values[first + k])));
+                this->prefetch_bucket (hashes[k]);
+              }
+
+            for (size_type k = 0; k < num; ++k)
+              {
+                const bool  result = this->template lookup_or_insert <const value_type&>
+                                       (values[first + k], hashes[k], 0).second;
+                if (inserted)
+                  inserted[first + k] = result;
+              }
+          }
+      }
+
 #   if MCT_CXX0X_SUPPORTED
 
       std::pair <iterator, bool>
@@ -3809,7 +3893,8 @@ namespace mct
       : _hash            (that.hash_function ()),
         _equal           (that.key_eq ()),
         _allocator       (that.get_allocator ()),
-        _max_load_factor (that.max_load_factor ())
+        _max_load_factor (that.max_load_factor ()),
+        _batch_depth     (that.batch_depth ())
     {
       initialize_as_copy (that);
     }
@@ -3820,7 +3905,8 @@ namespace mct
       : _hash            (that.hash_function ()),
         _equal           (that.key_eq ()),
         _allocator       (allocator),
-        _max_load_factor (that.max_load_factor ())
+        _max_load_factor (that.max_load_factor ()),
+        _batch_depth     (that.batch_depth ())
     {
       initialize_as_copy (that);
     }
@@ -3949,6 +4035,7 @@ namespace mct
               this->_hash            = that._hash;
               this->_equal           = that._equal;
               this->_max_load_factor = that._max_load_factor;
+              this->_batch_depth     = that._batch_depth;
 
               that._data.buckets = 0;
               that._data.clear ();
@@ -3987,10 +4074,9 @@ namespace mct
     template <typename Bucket, typename Hash, typename Equal>
     typename hash_table_base <Bucket, Hash, Equal>::bucket_pointer
     hash_table_base <Bucket, Hash, Equal>::
-    lookup (const key_type& key) const
+    lookup (const key_type& key, size_type hash) const
     {
-      const size_type  hash    = bucket_type::postprocess_hash (_hash (key));
-      size_type        look_at = _data.start_probing (hash);
+      size_type  look_at = _data.start_probing (hash);
 
       const bucket_pointer     bucket = (_data.buckets + look_at);
       const bucket_usage_data  usage  = bucket->get_usage_data ();
@@ -4025,7 +4111,7 @@ namespace mct
     template <typename type>
     std::pair <typename hash_table_base <Bucket, Hash, Equal>::bucket_pointer, bool>
     hash_table_base <Bucket, Hash, Equal>::
-    lookup_or_insert (type data, bucket_pointer that)
+    lookup_or_insert (type data, size_type hash, bucket_pointer that)
     {
       // A little bit pessimistic: if we end up replacing debris, we didn't need to
       // resize.  However, it is simpler to resize now (at most we "lose" one bucket this
@@ -4035,7 +4121,6 @@ namespace mct
         that = clear_debris_or_grow (that);
 
       const key_type&  key     = bucket_type::extract_key (data);
-      const size_type  hash    = bucket_type::postprocess_hash (_hash (key));
       size_type        look_at = _data.start_probing (hash);
 
       const bucket_pointer     bucket = (_data.buckets + look_at);
@@ -4129,6 +4214,94 @@ namespace mct
     }
 
 
+    template <typename Bucket, typename Hash, typename Equal>
+    void
+    hash_table_base <Bucket, Hash, Equal>::
+    find_batch (const key_type* keys, size_type num_keys, iterator* results)
+    {
+      size_type  hashes[MAX_BATCH_DEPTH];
+
+      for (size_type first = 0; first < num_keys; first += _batch_depth)
+        {
+          const size_type  num = (std::min) (num_keys - first, _batch_depth);
+
+          if (_data.num_used == 0)
+            {
+              for (size_type k = 0; k < num; ++k)
+                results[first + k] = end ();
+              continue;
+            }
+
+          for (size_type k = 0; k < num; ++k)
+            {
+              hashes[k] = bucket_type::postprocess_hash (_hash (keys[first + k]));
+              prefetch_bucket (hashes[k]);
+            }
+
+          for (size_type k = 0; k < num; ++k)
+            results[first + k] = make_iterator (lookup (keys[first + k], hashes[k]));
+        }
+    }
+
+    template <typename Bucket, typename Hash, typename Equal>
+    void
+    hash_table_base <Bucket, Hash, Equal>::
+    find_batch (const key_type* keys, size_type num_keys, const_iterator* results) const
+    {
+      size_type  hashes[MAX_BATCH_DEPTH];
+
+      for (size_type first = 0; first < num_keys; first += _batch_depth)
+        {
+          const size_type  num = (std::min) (num_keys - first, _batch_depth);
+
+          if (_data.num_used == 0)
+            {
+              for (size_type k = 0; k < num; ++k)
+                results[first + k] = end ();
+              continue;
+            }
+
+          for (size_type k = 0; k < num; ++k)
+            {
+              hashes[k] = bucket_type::postprocess_hash (_hash (keys[first + k]));
+              prefetch_bucket (hashes[k]);
+            }
+
+          for (size_type k = 0; k < num; ++k)
+            results[first + k] = make_const_iterator (lookup (keys[first + k], hashes[k]));
+        }
+    }
+
+    template <typename Bucket, typename Hash, typename Equal>
+    void
+    hash_table_base <Bucket, Hash, Equal>::
+    count_batch (const key_type* keys, size_type num_keys, size_type* results) const
+    {
+      size_type  hashes[MAX_BATCH_DEPTH];
+
+      for (size_type first = 0; first < num_keys; first += _batch_depth)
+        {
+          const size_type  num = (std::min) (num_keys - first, _batch_depth);
+
+          if (_data.num_used == 0)
+            {
+              for (size_type k = 0; k < num; ++k)
+                results[first + k] = 0;
+              continue;
+            }
+
+          for (size_type k = 0; k < num; ++k)
+            {
+              hashes[k] = bucket_type::postprocess_hash (_hash (keys[first + k]));
+              prefetch_bucket (hashes[k]);
+            }
+
+          for (size_type k = 0; k < num; ++k)
+            results[first + k] = (lookup (keys[first + k], hashes[k]) != _data.end () ? 1 : 0);
+        }
+    }
+
+
     template <typename Bucket, typename Hash, typename Equal>
     void
     hash_table_base <Bucket, Hash, Equal>::
@@ -4186,6 +4359,7 @@ namespace mct
       swap (_hash,            that._hash);
       swap (_equal,           that._equal);
       swap (_max_load_factor, that._max_load_factor);
+      swap (_batch_depth,     that._batch_depth);
 
       MCT_VALIDATION (this->validate_integrity ());
       MCT_VALIDATION (that. validate_integrity ());
@@ -4402,6 +4576,9 @@ namespace mct
         bucket_type::template validate_links <bucket_type> (_data.sentinel (), num_used);
     }
 
+# endif  // MCT_DEBUGGING_MEMBERS
+
+
     template <typename Bucket, typename Hash, typename Equal>
     typename hash_table_base <Bucket, Hash, Equal>::statistics
     hash_table_base <Bucket, Hash, Equal>::
@@ -4411,9 +4588,14 @@ namespace mct
 
       stats.debris_ratio       = 0;
       stats.avg_present_lookup = 0;
+      stats.var_present_lookup = 0;
       stats.max_present_lookup = 0;
       stats.avg_absent_lookup  = 0;
+      stats.var_absent_lookup  = 0;
       stats.max_absent_lookup  = 0;
+      stats.avg_cluster        = 0;
+      stats.max_cluster        = 0;
+      stats.var_home_elements  = 0;
 
       if (_data.num_occupied != 0)
         {
@@ -4428,6 +4610,12 @@ namespace mct
         }
       else
         {
+          std::vector <unsigned>  home_elements (_data.num_buckets);
+          double                  present_squares = 0;
+          double                  absent_squares  = 0;
+          size_type               num_clusters    = 0;
+          size_type               cluster         = 0;
+
           for (bucket_pointer bucket (_data.buckets), _end (_data.storage_end ());
                bucket != _end; ++bucket)
             {
@@ -4437,11 +4625,14 @@ namespace mct
                   const size_type  hash    = _hash (bucket->key ());
                   size_type        look_at = _data.start_probing (hash);
 
+                  ++home_elements[look_at];
+
                   for (size_type iteration = 1; ; ++iteration)
                     {
                       if (_data.buckets + look_at == bucket)
                         {
                           stats.avg_present_lookup += iteration;
+                          present_squares          += static_cast <double> (iteration) * iteration;
                           stats.max_present_lookup  = (std::max) (stats.max_present_lookup,
                                                                   iteration);
                           break;
@@ -4451,6 +4642,16 @@ namespace mct
                     }
                 }
 
+              if (!bucket_type::is_empty (bucket->get_usage_data ()))
+                ++cluster;
+              else if (cluster != 0)
+                {
+                  ++num_clusters;
+                  stats.avg_cluster += cluster;
+                  stats.max_cluster  = (std::max) (stats.max_cluster, cluster);
+                  cluster            = 0;
+                }
+
               size_type  look_at = (bucket - _data.buckets);
 
               for (size_type iteration = 1; ; ++iteration)
@@ -4458,6 +4659,7 @@ namespace mct
                   if (bucket_type::is_empty ((_data.buckets + look_at)->get_usage_data ()))
                     {
                       stats.avg_absent_lookup += iteration;
+                      absent_squares          += static_cast <double> (iteration) * iteration;
                       stats.max_absent_lookup  = (std::max) (stats.max_absent_lookup, iteration);
                       break;
                     }
@@ -4466,17 +4668,35 @@ namespace mct
                 }
             }
 
-          if (_data.num_used != 0)
-            stats.avg_present_lookup /= _data.num_used;
+          if (cluster != 0)
+            {
+              ++num_clusters;
+              stats.avg_cluster += cluster;
+              stats.max_cluster  = (std::max) (stats.max_cluster, cluster);
+            }
+
+          stats.avg_present_lookup /= _data.num_used;
+          stats.var_present_lookup  = (present_squares / _data.num_used
+                                       - stats.avg_present_lookup * stats.avg_present_lookup);
 
           stats.avg_absent_lookup /= _data.num_buckets;
+          stats.var_absent_lookup  = (absent_squares / _data.num_buckets
+                                      - stats.avg_absent_lookup * stats.avg_absent_lookup);
+
+          if (num_clusters != 0)
+            stats.avg_cluster /= num_clusters;
+
+          double  home_squares = 0;
+          for (size_type k = 0; k != _data.num_buckets; ++k)
+            home_squares += static_cast <double> (home_elements[k]) * home_elements[k];
+
+          const double  home_mean = static_cast <double> (_data.num_used) / _data.num_buckets;
+          stats.var_home_elements = home_squares / _data.num_buckets - home_mean * home_mean;
         }
 
       return stats;
     }
 
-# endif  // MCT_DEBUGGING_MEMBERS
-
 
     template <typename Bucket, typename Hash, typename Equal>
     template <typename InputIterator>
@@ -39,6 +39,9 @@
 # define MCT_OPTIMIZATION_EXPECT(expression, value)     \
   __builtin_expect ((expression), (value))
 
+# define MCT_OPTIMIZATION_PREFETCH(address)             \
+  __builtin_prefetch (address)
+
 
 #else  // not defined __GNUC__
 
@@ -47,6 +50,14 @@
 # define MCT_OPTIMIZATION_UNLIKELY(condition)           (condition)
 # define MCT_OPTIMIZATION_EXPECT(expression, value)     (expression)
 
+# if defined (_MSC_VER)
+#   include <xmmintrin.h>
+#   define MCT_OPTIMIZATION_PREFETCH(address)                           \
+  _mm_prefetch (reinterpret_cast <const char*> (address), _MM_HINT_T0)
+# else
+#   define MCT_OPTIMIZATION_PREFETCH(address)           ((void) 0)
+# endif
+
 
 #endif
 
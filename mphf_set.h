@@ -0,0 +1,354 @@
+// Static set of integral keys addressed through a minimal perfect hash
+// function (BBHash style: a cascade of collision-free bit arrays).
+//
+// The set is built once from a batch of keys and is then read-only. Keys are
+// stored in a flat array of exactly size() slots, the slot of a key is the
+// rank of its bit in the cascade. With gamma = 2 the hash function costs
+// about 4 bits per key, so for uint64_t keys the whole structure stays close
+// to 1.06 of the raw data size.
+//
+// Lookups hash the key once per level (usually one or two levels) and compare
+// the stored key, so misses are exact as well.
+
+#ifndef MPHF_SET_H
+#define MPHF_SET_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace mphf
+{
+  inline uint64_t hash(uint64_t k, uint64_t seed)
+  {
+    // murmur3 finalizer
+    k ^= seed;
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+  }
+
+  // Maps a 64 bit hash onto [0, n) without a division.
+  inline uint64_t reduce(uint64_t h, uint64_t n)
+  {
+    return n <= 0xffffffffULL ? ((h >> 32) * n) >> 32 : h % n;
+  }
+
+  inline unsigned popcount(uint64_t x)
+  {
+#ifdef _MSC_VER
+    return static_cast<unsigned>(__popcnt64(x));
+#else
+    return static_cast<unsigned>(__builtin_popcountll(x));
+#endif
+  }
+
+  inline unsigned default_threads()
+  {
+    auto n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+  }
+
+  // Runs fn(begin, end, thread_index) over [0, n) split into equal ranges.
+  template<class Fn>
+  void parallel_for(unsigned threads, size_t n, Fn fn)
+  {
+    if (threads <= 1 || n < 4096)
+    {
+      fn(size_t(0), n, 0u);
+      return;
+    }
+    std::vector<std::thread> pool;
+    auto step = (n + threads - 1) / threads;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+      auto b = std::min(n, t * step);
+      auto e = std::min(n, b + step);
+      pool.emplace_back([=]() { fn(b, e, t); });
+    }
+    for (auto& th : pool)
+    {
+      th.join();
+    }
+  }
+
+  // Sorts chunks in parallel and merges them pairwise.
+  template<class It>
+  void parallel_sort(It b, It e, unsigned threads)
+  {
+    size_t n = e - b;
+    if (threads <= 1 || n < 65536)
+    {
+      std::sort(b, e);
+      return;
+    }
+    auto step = (n + threads - 1) / threads;
+    parallel_for(threads, threads, [&](size_t tb, size_t te, unsigned)
+    {
+      for (auto t = tb; t < te; ++t)
+      {
+        std::sort(b + std::min(n, t * step), b + std::min(n, (t + 1) * step));
+      }
+    });
+    for (; step < n; step *= 2)
+    {
+      size_t pairs = (n + 2 * step - 1) / (2 * step);
+      parallel_for(threads, pairs, [&](size_t pb, size_t pe, unsigned)
+      {
+        for (auto p = pb; p < pe; ++p)
+        {
+          auto first = p * 2 * step;
+          auto middle = std::min(n, first + step);
+          auto last = std::min(n, first + 2 * step);
+          std::inplace_merge(b + first, b + middle, b + last);
+        }
+      });
+    }
+  }
+} // mphf
+
+template<class Key = uint64_t, class Alloc = std::allocator<Key>>
+class mphf_set
+{
+  static_assert(std::is_integral<Key>::value, "mphf_set supports integral keys only");
+
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<uint64_t> word_allocator;
+  typedef std::vector<uint64_t, word_allocator> words;
+  typedef std::vector<Key, Alloc> keys;
+
+  // Keys which still collide after max_levels go to a sorted tail of _keys.
+  static constexpr unsigned max_levels = 32;
+  // One rank sample per 8 words (512 bits).
+  static constexpr unsigned rank_shift = 3;
+
+  struct level
+  {
+    uint64_t offset; // in bits from the start of _bits
+    uint64_t size;   // in bits, multiple of 64
+  };
+
+public:
+  typedef Key key_type;
+  typedef Key value_type;
+  typedef size_t size_type;
+  typedef typename keys::const_iterator const_iterator;
+  typedef const_iterator iterator;
+
+  explicit mphf_set(double gamma = 2.0, unsigned threads = 0) :
+    _gamma(gamma < 1.0 ? 1.0 : gamma), _threads(threads == 0 ? mphf::default_threads() : threads)
+  {
+  }
+
+  // Queues a key for the next build(). Keys already in the built set are
+  // rejected, duplicates among queued keys are removed by build().
+  bool insert(const Key& k)
+  {
+    if (!_keys.empty() && find(k) != end())
+    {
+      return false;
+    }
+    _pending.push_back(k);
+    return true;
+  }
+
+  template<class InputIterator>
+  void insert(InputIterator b, InputIterator e)
+  {
+    _pending.insert(_pending.end(), b, e);
+  }
+
+  // Builds the hash function over the built keys plus all queued keys.
+  void build()
+  {
+    if (_pending.empty())
+    {
+      return;
+    }
+    keys all(std::move(_pending));
+    _pending = keys();
+    all.insert(all.end(), _keys.begin(), _keys.end());
+    mphf::parallel_sort(all.begin(), all.end(), _threads);
+    all.erase(std::unique(all.begin(), all.end()), all.end());
+    build_levels(all);
+  }
+
+  const_iterator find(const Key& k) const
+  {
+    auto h = static_cast<uint64_t>(k);
+    for (size_t l = 0; l < _levels.size(); ++l)
+    {
+      auto pos = _levels[l].offset + mphf::reduce(mphf::hash(h, l), _levels[l].size);
+      if (_bits[pos >> 6] & (1ULL << (pos & 63)))
+      {
+        auto i = rank(pos);
+        return _keys[i] == k ? _keys.begin() + i : end();
+      }
+    }
+    auto tail = _keys.begin() + _placed;
+    auto it = std::lower_bound(tail, _keys.end(), k);
+    return it != _keys.end() && *it == k ? it : end();
+  }
+
+  size_type count(const Key& k) const { return find(k) != end() ? 1 : 0; }
+
+  const_iterator begin() const { return _keys.begin(); }
+  const_iterator end() const { return _keys.end(); }
+  size_type size() const { return _keys.size(); }
+  bool empty() const { return _keys.empty(); }
+
+  void clear()
+  {
+    _keys = keys();
+    _pending = keys();
+    _bits = words();
+    _ranks = words();
+    _levels.clear();
+    _placed = 0;
+  }
+
+  size_t levels() const { return _levels.size(); }
+
+  // Bytes taken by the hash function (bit arrays and rank samples).
+  size_t function_bytes() const
+  {
+    return (_bits.size() + _ranks.size()) * sizeof(uint64_t) + _levels.size() * sizeof(level);
+  }
+
+  size_t bytes_used() const
+  {
+    return sizeof(*this) + function_bytes() + _keys.size() * sizeof(Key);
+  }
+
+private:
+  uint64_t rank(uint64_t pos) const
+  {
+    auto word = pos >> 6;
+    auto r = _ranks[word >> rank_shift];
+    for (auto w = word & ~((1ULL << rank_shift) - 1); w < word; ++w)
+    {
+      r += mphf::popcount(_bits[w]);
+    }
+    return r + mphf::popcount(_bits[word] & ((1ULL << (pos & 63)) - 1));
+  }
+
+  void build_levels(keys& all)
+  {
+    _levels.clear();
+    std::vector<words> level_bits;
+    std::vector<Key> rest(all.begin(), all.end());
+    uint64_t offset = 0;
+    while (!rest.empty() && _levels.size() < max_levels)
+    {
+      auto seed = _levels.size();
+      uint64_t size = (static_cast<uint64_t>(_gamma * rest.size()) + 64) & ~63ULL;
+      std::vector<std::atomic<uint64_t>> seen(size / 64);
+      std::vector<std::atomic<uint64_t>> collide(size / 64);
+      for (size_t i = 0; i < seen.size(); ++i)
+      {
+        seen[i].store(0, std::memory_order_relaxed);
+        collide[i].store(0, std::memory_order_relaxed);
+      }
+      mphf::parallel_for(_threads, rest.size(), [&](size_t b, size_t e, unsigned)
+      {
+        for (auto i = b; i < e; ++i)
+        {
+          auto pos = mphf::reduce(mphf::hash(static_cast<uint64_t>(rest[i]), seed), size);
+          auto mask = 1ULL << (pos & 63);
+          if (seen[pos >> 6].fetch_or(mask, std::memory_order_relaxed) & mask)
+          {
+            collide[pos >> 6].fetch_or(mask, std::memory_order_relaxed);
+          }
+        }
+      });
+      words bits(size / 64);
+      for (size_t i = 0; i < bits.size(); ++i)
+      {
+        bits[i] = seen[i].load(std::memory_order_relaxed) & ~collide[i].load(std::memory_order_relaxed);
+      }
+      std::vector<std::vector<Key>> next(_threads);
+      mphf::parallel_for(_threads, rest.size(), [&](size_t b, size_t e, unsigned t)
+      {
+        for (auto i = b; i < e; ++i)
+        {
+          auto pos = mphf::reduce(mphf::hash(static_cast<uint64_t>(rest[i]), seed), size);
+          if (!(bits[pos >> 6] & (1ULL << (pos & 63))))
+          {
+            next[t].push_back(rest[i]);
+          }
+        }
+      });
+      rest.clear();
+      for (auto& n : next)
+      {
+        rest.insert(rest.end(), n.begin(), n.end());
+      }
+      _levels.push_back({ offset, size });
+      level_bits.push_back(std::move(bits));
+      offset += size;
+    }
+
+    _bits = words();
+    _bits.reserve(offset / 64);
+    for (auto& b : level_bits)
+    {
+      _bits.insert(_bits.end(), b.begin(), b.end());
+    }
+    level_bits.clear();
+    _ranks = words();
+    _ranks.reserve((_bits.size() >> rank_shift) + 1);
+    uint64_t r = 0;
+    for (size_t w = 0; w < _bits.size(); ++w)
+    {
+      if ((w & ((1ULL << rank_shift) - 1)) == 0)
+      {
+        _ranks.push_back(r);
+      }
+      r += mphf::popcount(_bits[w]);
+    }
+    _placed = static_cast<size_t>(r);
+
+    // Leftovers are already sorted: every level keeps the order of all.
+    _keys = keys(all.size());
+    auto& placed = _keys;
+    auto levels = _levels.size();
+    mphf::parallel_for(_threads, all.size(), [&](size_t b, size_t e, unsigned)
+    {
+      for (auto i = b; i < e; ++i)
+      {
+        auto h = static_cast<uint64_t>(all[i]);
+        for (size_t l = 0; l < levels; ++l)
+        {
+          auto pos = _levels[l].offset + mphf::reduce(mphf::hash(h, l), _levels[l].size);
+          if (_bits[pos >> 6] & (1ULL << (pos & 63)))
+          {
+            placed[rank(pos)] = all[i];
+            break;
+          }
+        }
+      }
+    });
+    std::copy(rest.begin(), rest.end(), _keys.begin() + _placed);
+  }
+
+  double _gamma;
+  unsigned _threads;
+  keys _keys;
+  keys _pending;
+  words _bits;
+  words _ranks;
+  std::vector<level> _levels;
+  size_t _placed = 0;
+};
+
+#endif // MPHF_SET_H
@@ -0,0 +1,647 @@
+// Ordered set of integral keys shared between threads, a B+ tree with
+// optimistic lock coupling.
+//
+// Every node carries a version counter whose low bit pair marks it write
+// locked. Readers never write to shared memory: they remember the version of
+// a node, read what they need and check that the version did not change
+// before they rely on it, restarting from the root otherwise. Writers descend
+// the same way and lock only the leaf they modify, plus its parent when the
+// leaf is split. Full nodes are split eagerly on the way down, so a split
+// never propagates upwards and at most two nodes are locked at any time.
+//
+// Nodes are never freed while the set exists: erase removes keys from their
+// leaf without merging nodes, so an optimistic reader never follows a pointer
+// into released memory. Leaves are chained left to right for iteration,
+// which like size() and the statistics is only meaningful while no thread
+// modifies the set.
+//
+// Optimistic readers load keys, counts and child pointers while a writer may
+// be storing them, so those fields are atomics accessed with relaxed order:
+// the version check, not the load, decides whether a value may be used.
+//
+// As in btree::btree_set leaves are NodeSize bytes and hold
+// (NodeSize - 24) / sizeof(Key) keys, inner nodes hold as many keys plus the
+// child pointers.
+
+#ifndef OLC_BTREE_SET_H
+#define OLC_BTREE_SET_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#define OLC_PAUSE() _mm_pause()
+#else
+#define OLC_PAUSE()
+#endif
+
+template<class Key = uint64_t, class Alloc = std::allocator<Key>, int NodeSize = 256>
+class olc_btree_set
+{
+  static_assert(std::is_integral<Key>::value, "olc_btree_set supports integral keys only");
+
+  static constexpr uint64_t locked = 2;
+
+  struct node
+  {
+    explicit node(bool is_leaf) : version(0), count(0), leaf(is_leaf) {}
+
+    // Version of an unlocked node, restart is set if it is locked.
+    uint64_t read_lock(bool& restart) const
+    {
+      auto v = version.load();
+      if (v & locked)
+      {
+        OLC_PAUSE();
+        restart = true;
+      }
+      return v;
+    }
+
+    // Sets restart if the node changed since v was read.
+    void check(uint64_t v, bool& restart) const
+    {
+      if (version.load() != v)
+      {
+        restart = true;
+      }
+    }
+
+    // Locks the node if it is still at version v.
+    void upgrade(uint64_t& v, bool& restart)
+    {
+      if (version.compare_exchange_strong(v, v + locked))
+      {
+        v += locked;
+      }
+      else
+      {
+        restart = true;
+      }
+    }
+
+    void unlock() { version.fetch_add(locked); }
+
+    int size() const { return count.load(std::memory_order_relaxed); }
+    void set_size(int n) { count.store(static_cast<uint16_t>(n), std::memory_order_relaxed); }
+
+    std::atomic<uint64_t> version;
+    std::atomic<uint16_t> count;
+    bool leaf;
+  };
+
+  template<class T>
+  static T load(const std::atomic<T>& x) { return x.load(std::memory_order_relaxed); }
+  template<class T>
+  static void store(std::atomic<T>& x, T v) { x.store(v, std::memory_order_relaxed); }
+
+  // std::copy and std::copy_backward for fields a reader may load meanwhile.
+  template<class T>
+  static void copy(const std::atomic<T>* b, const std::atomic<T>* e, std::atomic<T>* d)
+  {
+    for (; b != e; ++b, ++d)
+    {
+      store(*d, load(*b));
+    }
+  }
+  template<class T>
+  static void copy_backward(const std::atomic<T>* b, const std::atomic<T>* e, std::atomic<T>* d)
+  {
+    while (e != b)
+    {
+      store(*--d, load(*--e));
+    }
+  }
+
+  static constexpr int leaf_keys = static_cast<int>((NodeSize - sizeof(node) - sizeof(void*)) / sizeof(Key));
+  static constexpr int inner_keys = leaf_keys;
+  static_assert(leaf_keys >= 4, "NodeSize is too small");
+
+  // Position of the first of n sorted keys not less than k. The count is
+  // read once, so a racing writer can only make the result wrong, never out
+  // of range; readers validate the node version before using it.
+  //
+  // Counting the smaller keys touches every cache line of the node, but the
+  // loads do not depend on each other and their misses overlap, unlike the
+  // probes of a binary search.
+  static int search(const std::atomic<Key>* keys, int n, const Key& k)
+  {
+    int lo = 0;
+    for (int i = 0; i < n; ++i)
+    {
+      lo += load(keys[i]) < k;
+    }
+    return lo;
+  }
+
+  struct leaf_node : node
+  {
+    leaf_node() : node(true), next(nullptr) {}
+
+    // Position of the first key not less than k.
+    int lower_bound(const Key& k) const { return search(keys, this->size(), k); }
+
+    // Moves the upper half to right, sep is the largest key left here.
+    void split(leaf_node* right, Key& sep)
+    {
+      int n = this->size();
+      int half = n / 2;
+      right->set_size(n - half);
+      copy(keys + half, keys + n, right->keys);
+      this->set_size(half);
+      sep = load(keys[half - 1]);
+      right->next = next;
+      next = right;
+    }
+
+    leaf_node* next;
+    std::atomic<Key> keys[leaf_keys];
+  };
+
+  // Child i holds the keys not greater than keys[i], the last child the rest.
+  struct inner_node : node
+  {
+    inner_node() : node(false) {}
+
+    int lower_bound(const Key& k) const { return search(keys, this->size(), k); }
+
+    node* child(int i) const { return load(children[i]); }
+
+    // Adds right as the neighbour of the child that was split at sep.
+    void insert(const Key& sep, node* right)
+    {
+      int n = this->size();
+      int pos = lower_bound(sep);
+      copy_backward(keys + pos, keys + n, keys + n + 1);
+      copy_backward(children + pos + 1, children + n + 1, children + n + 2);
+      store(keys[pos], sep);
+      store(children[pos + 1], right);
+      this->set_size(n + 1);
+    }
+
+    // Moves the upper half to right, the middle key goes up as sep.
+    void split(inner_node* right, Key& sep)
+    {
+      int n = this->size();
+      int half = n / 2;
+      right->set_size(n - half - 1);
+      copy(keys + half + 1, keys + n, right->keys);
+      copy(children + half + 1, children + n + 1, right->children);
+      sep = load(keys[half]);
+      this->set_size(half);
+    }
+
+    bool full() const { return this->size() == inner_keys; }
+
+    std::atomic<Key> keys[inner_keys];
+    std::atomic<node*> children[inner_keys + 1];
+  };
+
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<leaf_node> leaf_allocator;
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<inner_node> inner_allocator;
+
+public:
+  typedef Key key_type;
+  typedef Key value_type;
+  typedef size_t size_type;
+
+  // Walks the leaf chain, not safe against concurrent modification. The keys
+  // are atomics, so it yields them by value.
+  class const_iterator
+  {
+  public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef Key value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const Key* pointer;
+    typedef Key reference;
+
+    const_iterator() {}
+    const_iterator(const leaf_node* l, int i) : _l(l), _i(i) { settle(); }
+
+    reference operator*() const { return load(_l->keys[_i]); }
+    const_iterator& operator++()
+    {
+      ++_i;
+      settle();
+      return *this;
+    }
+    const_iterator operator++(int)
+    {
+      auto tmp = *this;
+      ++*this;
+      return tmp;
+    }
+    bool operator==(const const_iterator& x) const { return _l == x._l && _i == x._i; }
+    bool operator!=(const const_iterator& x) const { return !(*this == x); }
+
+  private:
+    // Skips leaves left empty by erase.
+    void settle()
+    {
+      while (_l != nullptr && _i == _l->size())
+      {
+        _l = _l->next;
+        _i = 0;
+      }
+    }
+
+    const leaf_node* _l = nullptr;
+    int _i = 0;
+  };
+  typedef const_iterator iterator;
+
+  olc_btree_set()
+  {
+    _head = new_leaf();
+    _root.store(_head);
+  }
+  olc_btree_set(const olc_btree_set&) = delete;
+  olc_btree_set& operator=(const olc_btree_set&) = delete;
+  ~olc_btree_set() { free_node(_root.load()); }
+
+  // Safe to call from any number of threads at once.
+  bool insert(const Key& k)
+  {
+    for (int restarts = 0; ; ++restarts)
+    {
+      backoff(restarts);
+      bool restart = false;
+      node* n = _root.load();
+      auto v = n->read_lock(restart);
+      if (restart || n != _root.load())
+      {
+        continue;
+      }
+      inner_node* parent = nullptr;
+      uint64_t parent_v = 0;
+      while (!n->leaf && !restart)
+      {
+        auto inner = static_cast<inner_node*>(n);
+        if (inner->full())
+        {
+          split(parent, parent_v, n, v, restart);
+          restart = true;
+          break;
+        }
+        if (parent != nullptr)
+        {
+          parent->check(parent_v, restart);
+        }
+        parent = inner;
+        parent_v = v;
+        n = inner->child(inner->lower_bound(k));
+        inner->check(v, restart);
+        if (!restart)
+        {
+          v = n->read_lock(restart);
+        }
+      }
+      if (restart)
+      {
+        continue;
+      }
+      auto l = static_cast<leaf_node*>(n);
+      if (l->size() == leaf_keys)
+      {
+        split(parent, parent_v, n, v, restart);
+        continue;
+      }
+      l->upgrade(v, restart);
+      if (restart)
+      {
+        continue;
+      }
+      if (parent != nullptr)
+      {
+        parent->check(parent_v, restart);
+        if (restart)
+        {
+          l->unlock();
+          continue;
+        }
+      }
+      int n_keys = l->size();
+      int pos = l->lower_bound(k);
+      bool inserted = pos == n_keys || load(l->keys[pos]) != k;
+      if (inserted)
+      {
+        copy_backward(l->keys + pos, l->keys + n_keys, l->keys + n_keys + 1);
+        store(l->keys[pos], k);
+        l->set_size(n_keys + 1);
+      }
+      l->unlock();
+      return inserted;
+    }
+  }
+
+  template<class InputIterator>
+  void insert(InputIterator b, InputIterator e)
+  {
+    for (; b != e; ++b)
+    {
+      insert(*b);
+    }
+  }
+
+  // Safe to call from any number of threads at once.
+  size_type erase(const Key& k)
+  {
+    for (int restarts = 0; ; ++restarts)
+    {
+      backoff(restarts);
+      bool restart = false;
+      uint64_t v;
+      auto l = locate(k, v, restart);
+      if (restart)
+      {
+        continue;
+      }
+      l->upgrade(v, restart);
+      if (restart)
+      {
+        continue;
+      }
+      int n_keys = l->size();
+      int pos = l->lower_bound(k);
+      bool found = pos < n_keys && load(l->keys[pos]) == k;
+      if (found)
+      {
+        copy(l->keys + pos + 1, l->keys + n_keys, l->keys + pos);
+        l->set_size(n_keys - 1);
+      }
+      l->unlock();
+      return found ? 1 : 0;
+    }
+  }
+
+  // Safe to call from any number of threads at once.
+  bool contains(const Key& k) const
+  {
+    for (int restarts = 0; ; ++restarts)
+    {
+      backoff(restarts);
+      bool restart = false;
+      uint64_t v;
+      auto l = locate(k, v, restart);
+      if (restart)
+      {
+        continue;
+      }
+      int pos = l->lower_bound(k);
+      bool found = pos < l->size() && load(l->keys[pos]) == k;
+      l->check(v, restart);
+      if (!restart)
+      {
+        return found;
+      }
+    }
+  }
+
+  // Safe to call concurrently, the iterator itself is not.
+  const_iterator find(const Key& k) const
+  {
+    for (int restarts = 0; ; ++restarts)
+    {
+      backoff(restarts);
+      bool restart = false;
+      uint64_t v;
+      auto l = locate(k, v, restart);
+      if (restart)
+      {
+        continue;
+      }
+      int pos = l->lower_bound(k);
+      bool found = pos < l->size() && load(l->keys[pos]) == k;
+      l->check(v, restart);
+      if (!restart)
+      {
+        return found ? const_iterator(l, pos) : end();
+      }
+    }
+  }
+
+  size_type count(const Key& k) const { return contains(k) ? 1 : 0; }
+
+  // First key not less than k, for a set no thread modifies.
+  const_iterator lower_bound(const Key& k) const
+  {
+    const node* n = _root.load();
+    while (!n->leaf)
+    {
+      auto inner = static_cast<const inner_node*>(n);
+      n = inner->child(inner->lower_bound(k));
+    }
+    auto l = static_cast<const leaf_node*>(n);
+    return const_iterator(l, l->lower_bound(k));
+  }
+
+  const_iterator begin() const { return const_iterator(_head, 0); }
+  const_iterator end() const { return const_iterator(); }
+
+  // Counts the keys leaf by leaf.
+  size_type size() const
+  {
+    size_type n = 0;
+    for (auto l = _head; l != nullptr; l = l->next)
+    {
+      n += l->size();
+    }
+    return n;
+  }
+  bool empty() const { return begin() == end(); }
+
+  size_t height() const
+  {
+    size_t h = 1;
+    for (const node* n = _root.load(); !n->leaf; n = static_cast<const inner_node*>(n)->child(0))
+    {
+      ++h;
+    }
+    return h;
+  }
+  size_t leaf_nodes() const { return _leaves.load(); }
+  size_t inner_nodes() const { return _inners.load(); }
+  size_t nodes() const { return leaf_nodes() + inner_nodes(); }
+  static size_t node_keys() { return leaf_keys; }
+
+  // Share of the leaf slots in use.
+  double fullness() const
+  {
+    return static_cast<double>(size()) / (leaf_nodes() * leaf_keys);
+  }
+
+  size_t bytes_used() const
+  {
+    return sizeof(*this) + leaf_nodes() * sizeof(leaf_node) + inner_nodes() * sizeof(inner_node);
+  }
+
+  // Bytes per key beyond the raw key size.
+  double overhead() const
+  {
+    auto n = size();
+    return n == 0 ? 0.0 : (static_cast<double>(bytes_used()) - n * sizeof(Key)) / n;
+  }
+
+private:
+  static void backoff(int restarts)
+  {
+    if (restarts > 8)
+    {
+      std::this_thread::yield();
+    }
+  }
+
+  // Optimistic descent to the leaf for k, v receives its version.
+  const leaf_node* locate(const Key& k, uint64_t& v, bool& restart) const
+  {
+    const node* n = _root.load();
+    v = n->read_lock(restart);
+    if (restart || n != _root.load())
+    {
+      restart = true;
+      return nullptr;
+    }
+    while (!n->leaf)
+    {
+      auto inner = static_cast<const inner_node*>(n);
+      auto inner_v = v;
+      n = inner->child(inner->lower_bound(k));
+      inner->check(inner_v, restart);
+      if (restart)
+      {
+        return nullptr;
+      }
+      v = n->read_lock(restart);
+      // A split of the child after the first check moves keys to a new
+      // sibling, it changes the parent as well.
+      inner->check(inner_v, restart);
+      if (restart)
+      {
+        return nullptr;
+      }
+    }
+    return static_cast<const leaf_node*>(n);
+  }
+
+  leaf_node* locate(const Key& k, uint64_t& v, bool& restart)
+  {
+    return const_cast<leaf_node*>(static_cast<const olc_btree_set*>(this)->locate(k, v, restart));
+  }
+
+  // Splits the full node n (at version v) under its parent, or under a new
+  // root. Both nodes are locked for the split, restart is set if either
+  // changed since it was read; the caller restarts from the root either way.
+  void split(inner_node* parent, uint64_t parent_v, node* n, uint64_t v, bool& restart)
+  {
+    if (parent != nullptr)
+    {
+      parent->upgrade(parent_v, restart);
+      if (restart)
+      {
+        return;
+      }
+    }
+    n->upgrade(v, restart);
+    if (restart)
+    {
+      if (parent != nullptr)
+      {
+        parent->unlock();
+      }
+      return;
+    }
+    if (parent == nullptr && n != _root.load())
+    {
+      // Another thread grew the tree above n.
+      n->unlock();
+      restart = true;
+      return;
+    }
+    Key sep;
+    node* right;
+    if (n->leaf)
+    {
+      auto r = new_leaf();
+      static_cast<leaf_node*>(n)->split(r, sep);
+      right = r;
+    }
+    else
+    {
+      auto r = new_inner();
+      static_cast<inner_node*>(n)->split(r, sep);
+      right = r;
+    }
+    if (parent != nullptr)
+    {
+      parent->insert(sep, right);
+    }
+    else
+    {
+      auto root = new_inner();
+      root->set_size(1);
+      store(root->keys[0], sep);
+      store(root->children[0], n);
+      store(root->children[1], right);
+      _root.store(root);
+    }
+    n->unlock();
+    if (parent != nullptr)
+    {
+      parent->unlock();
+    }
+  }
+
+  leaf_node* new_leaf()
+  {
+    leaf_allocator a;
+    auto l = a.allocate(1);
+    new(l) leaf_node();
+    _leaves.fetch_add(1, std::memory_order_relaxed);
+    return l;
+  }
+
+  inner_node* new_inner()
+  {
+    inner_allocator a;
+    auto n = a.allocate(1);
+    new(n) inner_node();
+    _inners.fetch_add(1, std::memory_order_relaxed);
+    return n;
+  }
+
+  void free_node(node* n)
+  {
+    if (n->leaf)
+    {
+      auto l = static_cast<leaf_node*>(n);
+      l->~leaf_node();
+      leaf_allocator a;
+      a.deallocate(l, 1);
+    }
+    else
+    {
+      auto inner = static_cast<inner_node*>(n);
+      for (int i = 0; i <= inner->size(); ++i)
+      {
+        free_node(inner->child(i));
+      }
+      inner->~inner_node();
+      inner_allocator a;
+      a.deallocate(inner, 1);
+    }
+  }
+
+  std::atomic<node*> _root;
+  leaf_node* _head;
+  std::atomic<size_t> _leaves{ 0 };
+  std::atomic<size_t> _inners{ 0 };
+};
+
+#endif // OLC_BTREE_SET_H
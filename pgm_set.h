@@ -0,0 +1,287 @@
+// Static sorted set of integral keys indexed by a learned model (PGM index).
+//
+// The keys are kept in one sorted array. A piecewise linear function maps a
+// key to its position in the array with a guaranteed error of at most
+// epsilon: segments are cut with the shrinking cone algorithm, every segment
+// stores its first key, its first position and a slope. The segments are in
+// turn indexed the same way with a small error bound until a single segment
+// is left, so a lookup evaluates one segment per level and finishes with a
+// branchless binary search over a window of 2 * epsilon + 2 keys.
+//
+// For uniform or near-uniform keys a handful of segments describes millions
+// of keys, so the index costs a tiny fraction of the data it covers.
+// model_bytes() reports the size of the index for a given epsilon.
+
+#ifndef PGM_SET_H
+#define PGM_SET_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#define PGM_PREFETCH(p) _mm_prefetch(reinterpret_cast<const char*>(p), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define PGM_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PGM_PREFETCH(p)
+#endif
+
+template<class Key = uint64_t, class Alloc = std::allocator<Key>>
+class pgm_set
+{
+  static_assert(std::is_integral<Key>::value, "pgm_set supports integral keys only");
+
+  struct segment
+  {
+    Key key;
+    double slope;
+    size_t pos;
+  };
+
+  typedef std::vector<Key, Alloc> keys;
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<segment> segment_allocator;
+  typedef std::vector<segment, segment_allocator> segments;
+
+public:
+  typedef Key key_type;
+  typedef Key value_type;
+  typedef size_t size_type;
+  typedef typename keys::const_iterator const_iterator;
+  typedef const_iterator iterator;
+
+  explicit pgm_set(size_t epsilon = 64, size_t epsilon_recursive = 4) :
+    _epsilon(std::max<size_t>(1, epsilon)), _epsilon_recursive(std::max<size_t>(1, epsilon_recursive))
+  {
+  }
+
+  // Error bound of the bottom level, takes effect on the next build().
+  void set_epsilon(size_t epsilon) { _epsilon = std::max<size_t>(1, epsilon); }
+  size_t epsilon() const { return _epsilon; }
+
+  // Queues a key for the next build(). Keys already in the built set are
+  // rejected, duplicates among queued keys are removed by build().
+  bool insert(const Key& k)
+  {
+    if (!_keys.empty() && find(k) != end())
+    {
+      return false;
+    }
+    _pending.push_back(k);
+    return true;
+  }
+
+  template<class InputIterator>
+  void insert(InputIterator b, InputIterator e)
+  {
+    _pending.insert(_pending.end(), b, e);
+  }
+
+  // Sorts the built keys together with all queued keys and fits the model.
+  void build()
+  {
+    if (_pending.empty())
+    {
+      return;
+    }
+    keys all(std::move(_pending));
+    _pending = keys();
+    all.insert(all.end(), _keys.begin(), _keys.end());
+    std::sort(all.begin(), all.end());
+    all.erase(std::unique(all.begin(), all.end()), all.end());
+    _keys.swap(all);
+    fit();
+  }
+
+  // Replaces the contents with a sorted range of unique keys.
+  template<class ForwardIterator>
+  void build_sorted(ForwardIterator first, ForwardIterator last)
+  {
+    _keys.assign(first, last);
+    fit();
+  }
+
+  const_iterator find(const Key& x) const
+  {
+    auto it = lower_bound(x);
+    return it != end() && *it == x ? it : end();
+  }
+
+  size_type count(const Key& x) const { return find(x) != end() ? 1 : 0; }
+
+  // First key not less than x.
+  const_iterator lower_bound(const Key& x) const { return _keys.begin() + rank(x); }
+
+  // Number of keys less than x.
+  size_type rank(const Key& x) const
+  {
+    if (_keys.empty())
+    {
+      return 0;
+    }
+    // Walk down the levels, every level narrows the segment of the next one.
+    size_t s = 0;
+    for (auto l = _levels.size() - 1; l > 0; --l)
+    {
+      auto& lower = _levels[l - 1];
+      auto p = predict(_levels[l], s, x, lower.size());
+      auto lo = p > _epsilon_recursive + 1 ? p - _epsilon_recursive - 1 : 0;
+      auto hi = std::min(lower.size(), p + _epsilon_recursive + 2);
+      // Last segment in the window starting at or before x.
+      s = lo;
+      while (s + 1 < hi && !(x < lower[s + 1].key))
+      {
+        ++s;
+      }
+    }
+    auto p = predict(_levels[0], s, x, _keys.size());
+    auto lo = p > _epsilon + 1 ? p - _epsilon - 1 : 0;
+    auto hi = std::min(_keys.size(), p + _epsilon + 2);
+    // Fetch the whole window at once, the misses then overlap instead of
+    // following one another down the binary search.
+    auto first = reinterpret_cast<const char*>(_keys.data() + lo);
+    auto last = reinterpret_cast<const char*>(_keys.data() + hi);
+    for (auto line = first; line < last; line += 64)
+    {
+      PGM_PREFETCH(line);
+    }
+    return lo + search(_keys.data() + lo, hi - lo, x);
+  }
+
+  // Number of keys in [lo, hi).
+  size_type count_range(const Key& lo, const Key& hi) const
+  {
+    auto l = rank(lo);
+    auto h = rank(hi);
+    return h > l ? h - l : 0;
+  }
+
+  const_iterator begin() const { return _keys.begin(); }
+  const_iterator end() const { return _keys.end(); }
+  size_type size() const { return _keys.size(); }
+  bool empty() const { return _keys.empty(); }
+
+  void clear()
+  {
+    _keys = keys();
+    _pending = keys();
+    _levels.clear();
+  }
+
+  // Number of segments in the bottom level.
+  size_t segment_count() const { return _levels.empty() ? 0 : _levels[0].size(); }
+  size_t height() const { return _levels.size(); }
+
+  // Bytes taken by the model, without the keys.
+  size_t model_bytes() const
+  {
+    size_t bytes = 0;
+    for (auto& l : _levels)
+    {
+      bytes += l.size() * sizeof(segment);
+    }
+    return bytes;
+  }
+
+  size_t bytes_used() const { return sizeof(*this) + model_bytes() + _keys.size() * sizeof(Key); }
+
+private:
+  // b - a for b >= a, also for signed keys far apart.
+  static double distance(const Key& b, const Key& a)
+  {
+    return static_cast<double>(static_cast<uint64_t>(b) - static_cast<uint64_t>(a));
+  }
+
+  // Position predicted for x by segment s of level, clamped to the range the
+  // segment covers so that keys between two segments stay in the window.
+  static size_t predict(const segments& level, size_t s, const Key& x, size_t n)
+  {
+    auto& seg = level[s];
+    auto next = s + 1 < level.size() ? level[s + 1].pos : n;
+    if (x < seg.key)
+    {
+      return seg.pos;
+    }
+    auto p = static_cast<double>(seg.pos) + seg.slope * distance(x, seg.key);
+    return p >= static_cast<double>(next) ? next : static_cast<size_t>(p);
+  }
+
+  // Branchless lower bound over n keys.
+  static size_t search(const Key* base, size_t n, const Key& x)
+  {
+    if (n == 0)
+    {
+      return 0;
+    }
+    auto first = base;
+    while (n > 1)
+    {
+      auto half = n / 2;
+      base = base[half] < x ? base + half : base;
+      n -= half;
+    }
+    return (base - first) + (*base < x);
+  }
+
+  // Cuts the sorted keys k[0..n) with positions 0..n-1 into segments with
+  // error at most epsilon (shrinking cone).
+  template<class KeyAt>
+  static segments make_segments(size_t n, size_t epsilon, KeyAt key_at)
+  {
+    segments result;
+    size_t start = 0;
+    while (start < n)
+    {
+      auto origin = key_at(start);
+      double lo = 0;
+      double hi = std::numeric_limits<double>::infinity();
+      auto i = start + 1;
+      for (; i < n; ++i)
+      {
+        auto dx = distance(key_at(i), origin);
+        auto dy = static_cast<double>(i - start);
+        auto l = (dy - static_cast<double>(epsilon)) / dx;
+        auto h = (dy + static_cast<double>(epsilon)) / dx;
+        if (l > hi || h < lo)
+        {
+          break;
+        }
+        lo = std::max(lo, l);
+        hi = std::min(hi, h);
+      }
+      auto slope = i == start + 1 ? 0.0 : (lo + hi) / 2;
+      result.push_back({ origin, slope, start });
+      start = i;
+    }
+    return result;
+  }
+
+  void fit()
+  {
+    _levels.clear();
+    if (_keys.empty())
+    {
+      return;
+    }
+    auto& data = _keys;
+    _levels.push_back(make_segments(data.size(), _epsilon, [&](size_t i) { return data[i]; }));
+    while (_levels.back().size() > 1)
+    {
+      auto& lower = _levels.back();
+      auto upper = make_segments(lower.size(), _epsilon_recursive, [&](size_t i) { return lower[i].key; });
+      _levels.push_back(std::move(upper));
+    }
+  }
+
+  size_t _epsilon;
+  size_t _epsilon_recursive;
+  keys _keys;
+  keys _pending;
+  std::vector<segments> _levels;
+};
+
+#endif // PGM_SET_H
@@ -0,0 +1,385 @@
+// Compact open addressing set of integral keys with quotienting.
+//
+// Keys of key_bits() bits are first run through an invertible mix of the same
+// width. With a table of 2^q slots the high q bits of the mixed key (the
+// quotient) pick the home slot and only the low key_bits() - q bits (the
+// remainder) are stored, together with the distance of the slot from home.
+// The slots live in an sdsl::int_vector<0> whose width is chosen at runtime,
+// so a 32 bit universe in a table of 2^24 slots needs 8 + 7 bits per slot
+// instead of 64. Every doubling of the table moves one more bit from the
+// remainder into the quotient, the slot width shrinks accordingly.
+//
+// Collisions are resolved by Robin Hood linear probing: a key never sits
+// further from home than the key it displaced, so a lookup stops at the first
+// slot whose distance is smaller than the current probe length. Erase shifts
+// the following run back by one slot, no tombstones are left. The distance
+// field is limited to 7 bits, if an insert would exceed it the table grows.
+
+#ifndef QUOTIENT_SET_H
+#define QUOTIENT_SET_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include <sdsl/int_vector.hpp>
+
+template<class Key = uint64_t>
+class quotient_set
+{
+  static_assert(std::is_integral<Key>::value, "quotient_set supports integral keys only");
+
+  typedef sdsl::int_vector<0> slots;
+
+  // A slot holds (distance + 1) << remainder bits | remainder, 0 is empty.
+  static constexpr unsigned distance_bits = 7;
+  static constexpr uint64_t max_distance = (1ULL << distance_bits) - 2;
+  static constexpr unsigned min_quotient_bits = 6;
+  static constexpr uint64_t mul1 = 0xff51afd7ed558ccdULL;
+  static constexpr uint64_t mul2 = 0xc4ceb9fe1a85ec53ULL;
+  static constexpr size_t npos = ~size_t(0);
+
+public:
+  typedef Key key_type;
+  typedef Key value_type;
+  typedef size_t size_type;
+
+  // Walks the slots in table order, keys are decoded on the fly.
+  class const_iterator
+  {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Key value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const Key* pointer;
+    typedef const Key& reference;
+
+    const_iterator() {}
+    const_iterator(const quotient_set* s, size_t i) : _s(s), _i(i) { settle(); }
+
+    reference operator*() const { return _key; }
+    pointer operator->() const { return &_key; }
+    const_iterator& operator++()
+    {
+      ++_i;
+      settle();
+      return *this;
+    }
+    const_iterator operator++(int)
+    {
+      auto tmp = *this;
+      ++*this;
+      return tmp;
+    }
+    bool operator==(const const_iterator& x) const { return _i == x._i; }
+    bool operator!=(const const_iterator& x) const { return _i != x._i; }
+
+  private:
+    void settle()
+    {
+      auto n = _s->_slots.size();
+      while (_i < n && _s->_slots[_i] == 0)
+      {
+        ++_i;
+      }
+      if (_i < n)
+      {
+        _key = _s->key_at(_i);
+      }
+    }
+
+    const quotient_set* _s = nullptr;
+    size_t _i = 0;
+    Key _key = Key();
+  };
+  typedef const_iterator iterator;
+
+  explicit quotient_set(unsigned key_bits = sizeof(Key) * 8, double max_load = 0.9) :
+    _inv1(inverse(mul1)), _inv2(inverse(mul2))
+  {
+    set_max_load(max_load);
+    set_width(key_bits);
+    reset(initial_quotient_bits());
+  }
+
+  // Width of the key universe: keys must be below 2^bits. Keys already in
+  // the set are rehashed, insert() throws std::out_of_range for a key which
+  // does not fit.
+  void set_key_bits(unsigned bits)
+  {
+    std::vector<Key> all(begin(), end());
+    set_width(bits);
+    reset(initial_quotient_bits());
+    _size = 0;
+    reserve(all.size());
+    for (auto k : all)
+    {
+      insert(k);
+    }
+  }
+  unsigned key_bits() const { return _bits; }
+
+  void set_max_load(double max_load) { _max_load = max_load < 0.1 ? 0.1 : max_load > 0.99 ? 0.99 : max_load; }
+  double max_load() const { return _max_load; }
+
+  void reserve(size_t n)
+  {
+    auto q = _q;
+    while (q < _bits && n > _max_load * static_cast<double>(1ULL << q))
+    {
+      ++q;
+    }
+    if (q != _q)
+    {
+      rehash(q);
+    }
+  }
+
+  bool insert(const Key& k)
+  {
+    auto x = static_cast<uint64_t>(k);
+    if (x > _mask)
+    {
+      throw std::out_of_range("quotient_set: key does not fit into key_bits");
+    }
+    auto h = mix(x);
+    if (locate(h) != npos)
+    {
+      return false;
+    }
+    if (_q < _bits && _size + 1 > _max_load * static_cast<double>(_slots.size()))
+    {
+      rehash(_q + 1);
+    }
+    place(h);
+    ++_size;
+    return true;
+  }
+
+  template<class InputIterator>
+  void insert(InputIterator b, InputIterator e)
+  {
+    for (; b != e; ++b)
+    {
+      insert(*b);
+    }
+  }
+
+  size_type erase(const Key& k)
+  {
+    auto x = static_cast<uint64_t>(k);
+    auto i = x > _mask ? npos : locate(mix(x));
+    if (i == npos)
+    {
+      return 0;
+    }
+    // Pull the rest of the run one slot closer to home.
+    auto m = _slots.size() - 1;
+    for (auto j = (i + 1) & m; ; j = (j + 1) & m)
+    {
+      uint64_t v = _slots[j];
+      if ((v >> _r) <= 1)
+      {
+        break;
+      }
+      _slots[i] = v - (1ULL << _r);
+      i = j;
+    }
+    _slots[i] = 0;
+    --_size;
+    return 1;
+  }
+
+  const_iterator find(const Key& k) const
+  {
+    auto x = static_cast<uint64_t>(k);
+    auto i = x > _mask ? npos : locate(mix(x));
+    return i == npos ? end() : const_iterator(this, i);
+  }
+
+  size_type count(const Key& k) const { return find(k) != end() ? 1 : 0; }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, _slots.size()); }
+  size_type size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  void clear()
+  {
+    reset(initial_quotient_bits());
+    _size = 0;
+  }
+
+  size_t bucket_count() const { return _slots.size(); }
+  double load_factor() const { return static_cast<double>(_size) / _slots.size(); }
+  unsigned slot_bits() const { return _slots.width(); }
+
+  // Longest distance of a key from its home slot.
+  size_t max_probe() const
+  {
+    uint64_t d = 0;
+    for (size_t i = 0; i < _slots.size(); ++i)
+    {
+      d = std::max<uint64_t>(d, _slots[i] >> _r);
+    }
+    return d == 0 ? 0 : static_cast<size_t>(d - 1);
+  }
+
+  size_t bytes_used() const { return sizeof(*this) + _slots.capacity() / 8; }
+
+private:
+  // Multiplicative inverse of an odd number modulo 2^64 (Newton iteration),
+  // it is also the inverse modulo any smaller power of two.
+  static uint64_t inverse(uint64_t a)
+  {
+    uint64_t x = a;
+    for (int i = 0; i < 5; ++i)
+    {
+      x *= 2 - a * x;
+    }
+    return x;
+  }
+
+  // Bijection on [0, 2^_bits): odd multiplications and xor shifts of at
+  // least half the width, both invertible within the width.
+  uint64_t mix(uint64_t x) const
+  {
+    x = (x * mul1) & _mask;
+    x ^= x >> _shift;
+    x = (x * mul2) & _mask;
+    x ^= x >> _shift;
+    return x;
+  }
+
+  uint64_t unmix(uint64_t h) const
+  {
+    h ^= h >> _shift;
+    h = (h * _inv2) & _mask;
+    h ^= h >> _shift;
+    h = (h * _inv1) & _mask;
+    return h;
+  }
+
+  // The remainder and the distance must fit into one 64 bit slot.
+  unsigned initial_quotient_bits() const
+  {
+    unsigned q = min_quotient_bits;
+    if (_bits > 64 - distance_bits)
+    {
+      q = std::max(q, _bits - (64 - distance_bits));
+    }
+    return std::min(q, _bits);
+  }
+
+  void set_width(unsigned bits)
+  {
+    _bits = bits < 1 ? 1 : bits > 64 ? 64 : bits;
+    _mask = _bits == 64 ? ~0ULL : (1ULL << _bits) - 1;
+    _shift = (_bits + 1) / 2;
+  }
+
+  void reset(unsigned q)
+  {
+    _q = q;
+    _r = _bits - q;
+    _rem_mask = (1ULL << _r) - 1;
+    slots(size_t(1) << _q, 0, static_cast<uint8_t>(_r + distance_bits)).swap(_slots);
+  }
+
+  Key key_at(size_t i) const
+  {
+    uint64_t v = _slots[i];
+    auto home = (i - ((v >> _r) - 1)) & (_slots.size() - 1);
+    return static_cast<Key>(unmix((static_cast<uint64_t>(home) << _r) | (v & _rem_mask)));
+  }
+
+  // Slot of the mixed key h, npos if absent.
+  size_t locate(uint64_t h) const
+  {
+    auto m = _slots.size() - 1;
+    auto home = static_cast<size_t>(h >> _r);
+    auto rem = h & _rem_mask;
+    for (uint64_t d = 0; ; ++d)
+    {
+      auto i = (home + d) & m;
+      uint64_t v = _slots[i];
+      auto vd = v >> _r;
+      if (vd <= d)
+      {
+        return npos;
+      }
+      if (vd == d + 1 && (v & _rem_mask) == rem)
+      {
+        return i;
+      }
+    }
+  }
+
+  // Robin Hood insert of a mixed key known to be absent.
+  void place(uint64_t h)
+  {
+    for (;;)
+    {
+      auto m = _slots.size() - 1;
+      auto i = static_cast<size_t>(h >> _r);
+      auto rem = h & _rem_mask;
+      uint64_t d = 0;
+      for (; d <= max_distance; i = (i + 1) & m, ++d)
+      {
+        uint64_t v = _slots[i];
+        if (v == 0)
+        {
+          _slots[i] = ((d + 1) << _r) | rem;
+          return;
+        }
+        auto vd = (v >> _r) - 1;
+        if (vd < d)
+        {
+          _slots[i] = ((d + 1) << _r) | rem;
+          rem = v & _rem_mask;
+          d = vd;
+        }
+      }
+      // The key carried out of the probe window is put back after growing.
+      // At _q == _bits every key has a home slot of its own, so this does not
+      // happen there.
+      h = (static_cast<uint64_t>((i - d) & m) << _r) | rem;
+      rehash(_q + 1);
+    }
+  }
+
+  void rehash(unsigned q)
+  {
+    slots old;
+    old.swap(_slots);
+    auto old_r = _r;
+    auto old_rem_mask = _rem_mask;
+    auto m = old.size() - 1;
+    reset(q);
+    for (size_t i = 0; i < old.size(); ++i)
+    {
+      uint64_t v = old[i];
+      if (v != 0)
+      {
+        auto home = (i - ((v >> old_r) - 1)) & m;
+        place((static_cast<uint64_t>(home) << old_r) | (v & old_rem_mask));
+      }
+    }
+  }
+
+  uint64_t _inv1;
+  uint64_t _inv2;
+  double _max_load = 0.9;
+  unsigned _bits = 64;
+  unsigned _shift = 32;
+  uint64_t _mask = ~0ULL;
+  unsigned _q = 0;
+  unsigned _r = 0;
+  uint64_t _rem_mask = 0;
+  slots _slots;
+  size_t _size = 0;
+};
+
+#endif // QUOTIENT_SET_H
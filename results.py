@@ -40,8 +40,39 @@ class Test:
         self.population = None
         self.population_hit = None
         self.hit = None
+        self.hit_lookups = None
         self.miss = None
         self.working_set = None
+        self.build = None
+        self.model = None
+        self.scan = None
+        self.fullness = None
+        self.overhead = None
+        self.bytes_used = None
+        self.rank = None
+        self.select = None
+        self.mt_read = None
+        self.mt_mixed = None
+        self.image_save = None
+        self.image_open = None
+        self.image_first = None
+        self.image_cold = None
+        self.image_warm = None
+        self.rss = None
+        self.peak_rss = None
+        self.used = None
+        self.erase = None
+        self.debris_before = None
+        self.debris_hit = None
+        self.compact = None
+        self.compact_slowest = None
+        self.debris_after = None
+        self.compacted_hit = None
+        self.probe_hit = None
+        self.probe_miss = None
+        self.probe_cluster = None
+        self.home_variance = None
+        self.max_insert_latency = None
 
     def __str__(self):
         l = list()
@@ -56,6 +87,35 @@ class Test:
         l.append(str(self.free))
         l.append(str(self.grow))
         l.append(str(self.shrink))
+        l.append(str_or_empty(self.build))
+        l.append(str_or_empty(self.model))
+        l.append(str_or_empty(self.scan))
+        l.append(str_or_empty(self.fullness))
+        l.append(str_or_empty(self.overhead))
+        l.append(str_or_empty(self.bytes_used))
+        l.append(str_or_empty(self.rank))
+        l.append(str_or_empty(self.select))
+        l.append(str_or_empty(self.mt_read))
+        l.append(str_or_empty(self.mt_mixed))
+        l.append(str_or_empty(self.image_save))
+        l.append(str_or_empty(self.image_open))
+        l.append(str_or_empty(self.image_first))
+        l.append(str_or_empty(self.image_cold))
+        l.append(str_or_empty(self.image_warm))
+        l.append(str_or_empty(self.rss))
+        l.append(str_or_empty(self.peak_rss))
+        l.append(str_or_empty(self.probe_hit))
+        l.append(str_or_empty(self.probe_miss))
+        l.append(str_or_empty(self.max_insert_latency))
+        l.append(str_or_empty(self.probe_cluster))
+        l.append(str_or_empty(self.home_variance))
+        l.append(str_or_empty(self.erase))
+        l.append(str_or_empty(self.debris_before))
+        l.append(str_or_empty(self.debris_hit))
+        l.append(str_or_empty(self.compact))
+        l.append(str_or_empty(self.compact_slowest))
+        l.append(str_or_empty(self.debris_after))
+        l.append(str_or_empty(self.compacted_hit))
         return ",".join(l)
 
 
@@ -94,12 +154,95 @@ with open(sys.argv[1]) as f:
         if s[0] == "population":
             test.population_hit = smaller_non_zero(test.population_hit, float(s[3]))
             continue
+        if s[0] == "build,":
+            test.build = smaller_non_zero(test.build, float(s[2]))
+            continue
+        if s[0] == "Model:":
+            test.model = same_or_none(test.model, int(s[8]))
+            continue
+        if s[0] == "Tree:":
+            test.fullness = same_or_none(test.fullness, float(s[8]))
+            test.overhead = same_or_none(test.overhead, float(s[10]))
+            test.bytes_used = same_or_none(test.bytes_used, int(s[12]))
+            continue
+        if s[0] == "scan,":
+            test.scan = smaller_non_zero(test.scan, float(s[2]))
+            continue
+        if s[0] == "rank,":
+            test.rank = smaller_non_zero(test.rank, float(s[2]))
+            continue
+        if s[0] == "select,":
+            test.select = smaller_non_zero(test.select, float(s[2]))
+            continue
+        if s[0] == "mt" and s[1] == "read,":
+            test.mt_read = smaller_non_zero(test.mt_read, float(s[3]))
+            continue
+        if s[0] == "mt" and s[1] == "mixed,":
+            test.mt_mixed = smaller_non_zero(test.mt_mixed, float(s[3]))
+            continue
+        if s[0] == "image" and s[1] == "save,":
+            test.image_save = smaller_non_zero(test.image_save, float(s[3]))
+            continue
+        if s[0] == "image" and s[1] == "open,":
+            test.image_open = smaller_non_zero(test.image_open, float(s[3]))
+            continue
+        if s[0] == "image" and s[1] == "first":
+            test.image_first = smaller_non_zero(test.image_first, float(s[4]))
+            continue
+        if s[0] == "image" and s[1] == "cold":
+            test.image_cold = smaller_non_zero(test.image_cold, float(s[4]))
+            continue
+        if s[0] == "image" and s[1] == "warm":
+            test.image_warm = smaller_non_zero(test.image_warm, float(s[4]))
+            continue
         if s[0] == "hit,":
             test.hit = smaller_non_zero(test.hit, float(s[2]))
             continue
+        if s[0] == "hit" and s[1] == "lookups:":
+            test.hit_lookups = same_or_none(test.hit_lookups, int(s[2]))
+            continue
         if s[0] == "miss,":
             test.miss = smaller_non_zero(test.miss, float(s[2]))
             continue
+        if s[0] == "max" and s[1] == "insert":
+            test.max_insert_latency = smaller_non_zero(test.max_insert_latency, float(s[4]))
+            continue
+        if s[0] == "Probe:":
+            test.probe_hit = same_or_none(test.probe_hit, float(s[5]))
+            test.probe_miss = same_or_none(test.probe_miss, float(s[12]))
+            test.probe_cluster = same_or_none(test.probe_cluster, float(s[19]))
+            test.home_variance = same_or_none(test.home_variance, float(s[24]))
+            continue
+        if s[0] == "erase,":
+            test.erase = smaller_non_zero(test.erase, float(s[2]))
+            continue
+        if s[0] == "Debris" and s[1] == "before:":
+            test.debris_before = same_or_none(test.debris_before, float(s[3]))
+            continue
+        if s[0] == "Debris" and s[1] == "after:":
+            test.debris_after = same_or_none(test.debris_after, float(s[3]))
+            continue
+        if s[0] == "debris" and s[1] == "hit,":
+            test.debris_hit = smaller_non_zero(test.debris_hit, float(s[3]))
+            continue
+        if s[0] == "compact,":
+            test.compact = smaller_non_zero(test.compact, float(s[2]))
+            continue
+        if s[0] == "compact" and s[1] == "calls:":
+            test.compact_slowest = smaller_non_zero(test.compact_slowest, float(s[5]))
+            continue
+        if s[0] == "compacted" and s[1] == "hit,":
+            test.compacted_hit = smaller_non_zero(test.compacted_hit, float(s[3]))
+            continue
+        if s[0] == "RSS:":
+            test.rss = smaller_non_zero(test.rss, int(s[1]))
+            continue
+        if s[0] == "Peak" and s[1] == "RSS:":
+            test.peak_rss = smaller_non_zero(test.peak_rss, int(s[2]))
+            continue
+        if s[0] == "Used:":
+            test.used = same_or_none(test.used, int(s[1]))
+            continue
         if s[0] == "Working":
             test.working_set = smaller_non_zero(test.working_set, int(s[3]))
             continue
@@ -115,6 +258,32 @@ with open(sys.argv[1]) as f:
                 test.grow.same_or_none(int(s[1]), int(s[3]))
             elif s[0] == "Shrink:":
                 test.shrink.same_or_none(int(s[1]), int(s[3]))
-print(str(cnt) + "," + str(data_size))
-for test in tests.values():
-    print(test)
\ No newline at end of file
+
+
+def pareto(tests):
+    # Bytes per value against lookups per second, with the points that no
+    # smaller set beats on speed marked, for the load factor sweeps.  The
+    # bytes are those the allocator handed out with wrap_alloc, else the
+    # growth of the resident set.  Sets run without hit steps have no
+    # lookup rate and are left out.
+    points = list()
+    for test in tests:
+        size = test.used if test.used else test.rss
+        if not size or not test.hit or not test.hit_lookups:
+            continue
+        points.append((size / float(cnt), test.hit_lookups / test.hit / 1e6, test.name))
+    points.sort(key=lambda p: (p[0], -p[1]))
+    print("name,bytes per value,M lookups/s,pareto")
+    best = 0.0
+    for bytes_per_value, lookups, name in points:
+        on_frontier = lookups > best
+        best = max(best, lookups)
+        print(name + "," + str(bytes_per_value) + "," + str(lookups) + "," + ("1" if on_frontier else ""))
+
+
+if len(sys.argv) > 2 and sys.argv[2] == "pareto":
+    pareto(tests.values())
+else:
+    print(str(cnt) + "," + str(data_size))
+    for test in tests.values():
+        print(test)
\ No newline at end of file
@@ -0,0 +1,415 @@
+// An allocator which makes a sparsetable keep the arrays of its groups in
+// an arena of its own:
+//
+//   google::sparse_hash_set<int64_t, SPARSEHASH_HASH<int64_t>,
+//                           std::equal_to<int64_t>,
+//                           google::arena_allocator_with_realloc<int64_t> > s;
+//
+// With libc_allocator_with_realloc the array of every group is a malloc
+// block of its own, which costs 8 to 24 bytes of malloc header and
+// rounding a group, and nearly every insert reallocs one.  With this
+// allocator the table carves the arrays out of the slabs of a
+// sparsegroup_arena instead, see below.  Everything else it allocates
+// comes from malloc, as with libc_allocator_with_realloc.
+
+#ifndef UTIL_GTL_ARENA_ALLOCATOR_WITH_REALLOC_H_
+#define UTIL_GTL_ARENA_ALLOCATOR_WITH_REALLOC_H_
+
+#include <sparsehash/internal/sparseconfig.h>
+#include <assert.h>
+#include <stdint.h>           // for uintptr_t
+#include <stddef.h>           // for size_t
+#include <string.h>           // for memcpy
+#include <vector>
+#include <sparsehash/internal/libc_allocator_with_realloc.h>
+
+_START_GOOGLE_NAMESPACE_
+
+template<class T>
+class arena_allocator_with_realloc : public libc_allocator_with_realloc<T> {
+ public:
+  // See has_group_arena in libc_allocator_with_realloc.h.
+  static const bool uses_group_arena = true;
+
+  arena_allocator_with_realloc() {}
+  arena_allocator_with_realloc(const arena_allocator_with_realloc&) {}
+  template <class U>
+  arena_allocator_with_realloc(const arena_allocator_with_realloc<U>&) {}
+
+  template<class U>
+  struct rebind {
+    typedef arena_allocator_with_realloc<U> other;
+  };
+};
+
+template<class T>
+const bool arena_allocator_with_realloc<T>::uses_group_arena;
+
+template<class T>
+inline bool operator==(const arena_allocator_with_realloc<T>&,
+                       const arena_allocator_with_realloc<T>&) {
+  return true;
+}
+
+template<class T>
+inline bool operator!=(const arena_allocator_with_realloc<T>&,
+                       const arena_allocator_with_realloc<T>&) {
+  return false;
+}
+
+namespace sparsehash_internal {
+
+// The smallest power of two, starting from Bytes, which is at least Min.
+template <size_t Min, size_t Bytes, bool Enough = (Bytes >= Min)>
+struct arena_slab_bytes {
+  static const size_t value = arena_slab_bytes<Min, Bytes * 2>::value;
+};
+
+template <size_t Min, size_t Bytes>
+struct arena_slab_bytes<Min, Bytes, true> {
+  static const size_t value = Bytes;
+};
+
+}  // namespace sparsehash_internal
+
+// The arrays of up to MAX_VALUES values of VALUE_SIZE bytes of the groups
+// of one sparsetable.
+//
+// Arrays are rounded up to a multiple of GRANULE values, two for all but
+// the smallest values, so every other insert into a group finds room in
+// its array.  An array at the end of the used part of its slab grows into
+// the rest of the slab, and one which shrinks gives its tail back; other
+// arrays move.  Freed arrays go on a free list per size class.  As the
+// groups fill up the small classes fall out of use, so once the free
+// arrays of a region add up to more than 1/COMPACT_SHARE of the arrays in
+// use, the table moves the arrays of the groups of the region to new
+// slabs, next to each other, see begin_compaction().
+//
+// The groups of the table are split into regions of REGION_GROUPS
+// consecutive groups, which take their arrays from slabs of their own and
+// give them back as soon as all of them are freed.  A table rehashed into
+// a bigger one frees its arrays region by region, and the bigger table
+// takes those slabs, see sparsetable::borrow_slabs().  Slabs come from
+// Alloc in chunks of CHUNK_SLABS and go back to it all at once when the
+// arena goes away, without visiting a group.
+//
+// A slab starts with a header which tells the arena and the region of
+// the arrays in it, slabs are aligned to SLAB_BYTES so deallocate() and
+// reallocate() find it from the array.  Not thread safe.
+template <size_t VALUE_SIZE, size_t MAX_VALUES, class Alloc>
+class sparsegroup_arena {
+ public:
+  static const size_t GRANULE =
+      VALUE_SIZE * 2 >= sizeof(void*)
+          ? 2 : (sizeof(void*) + VALUE_SIZE - 1) / VALUE_SIZE;
+  static const size_t NUM_CLASSES = (MAX_VALUES + GRANULE - 1) / GRANULE;
+  static const size_t REGION_GROUPS = 4096;
+  static const size_t HEADER_BYTES = 64;
+  static const size_t SLAB_BYTES = sparsehash_internal::arena_slab_bytes<
+      HEADER_BYTES + 4 * NUM_CLASSES * GRANULE * VALUE_SIZE, 16 << 10>::value;
+  static const size_t CHUNK_SLABS = 64;
+  static const size_t COMPACT_SHARE = 8;
+  static const size_t NONE = static_cast<size_t>(-1);
+
+  explicit sparsegroup_arena(const Alloc& a)
+      : alloc(a), fresh(NULL), fresh_end(NULL), spare(NULL), donor(NULL),
+        old_slabs(NULL), old_live(0), current(0), due(NONE) { }
+  ~sparsegroup_arena() {
+    for ( size_t i = 0; i < chunks.size(); ++i )
+      alloc.deallocate(chunks[i], CHUNK_BYTES);
+  }
+
+  // allocate() gives arrays to group number g from now on.
+  sparsegroup_arena* at(size_t g) {
+    current = g / REGION_GROUPS;
+    return this;
+  }
+
+  // Room for n > 0 values, or NULL.
+  void* allocate(size_t n) {
+    if ( current >= regions.size() )
+      regions.resize(current + 1);
+    return allocate_in(current, bytes(n));
+  }
+
+  // Room for n > 0 values in the region of the array p.
+  static void* allocate_near(const void* p, size_t n) {
+    slab* s = slab_of(p);
+    return s->arena->allocate_in(s->region, bytes(n));
+  }
+
+  static void deallocate(void* p, size_t n) {
+    slab* s = slab_of(p);
+    s->arena->free_in(s->region, p, bytes(n));
+  }
+
+  // Like realloc(), returns NULL and leaves p as it was on failure.
+  static void* reallocate(void* p, size_t n, size_t old_n) {
+    const size_t new_bytes = bytes(n);
+    const size_t old_bytes = bytes(old_n);
+    if ( new_bytes == old_bytes )
+      return p;
+    slab* s = slab_of(p);
+    sparsegroup_arena* a = s->arena;
+    region& r = a->regions[s->region];
+    char* c = static_cast<char*>(p);
+    if ( c + old_bytes == r.top &&
+         (new_bytes < old_bytes ||
+          new_bytes - old_bytes <= static_cast<size_t>(r.end - r.top)) ) {
+      r.top = c + new_bytes;                 // in place, at the end
+      r.live_bytes += new_bytes;
+      r.live_bytes -= old_bytes;
+      return p;
+    }
+    if ( new_bytes < old_bytes ) {           // in place, the tail is free
+      r.live_bytes -= old_bytes - new_bytes;
+      a->push(r, c + new_bytes, old_bytes - new_bytes);
+      a->check_waste(s->region);
+      return p;
+    }
+    void* retval = a->allocate_in(s->region, new_bytes);
+    if ( retval != NULL ) {
+      memcpy(retval, p, old_bytes);
+      a->free_in(s->region, p, old_bytes);
+    }
+    return retval;
+  }
+
+  // Slabs which regions give back from now on may also go to x, which
+  // gets all of them with take_slabs() when done.
+  void lend_slabs(sparsegroup_arena* x) {
+    assert(x->donor == NULL);
+    x->donor = this;
+  }
+
+  // Takes the chunks of our donor, which has no arrays left.
+  void take_slabs() {
+    assert(donor != NULL);
+    sparsegroup_arena* x = donor;
+    donor = NULL;
+    for ( size_t i = 0; i < x->regions.size(); ++i )
+      assert(x->regions[i].live == 0);
+    chunks.insert(chunks.end(), x->chunks.begin(), x->chunks.end());
+    x->chunks.clear();
+    while ( x->spare != NULL ) {
+      slab* s = x->spare;
+      x->spare = s->next;
+      s->next = spare;
+      spare = s;
+    }
+    if ( fresh == fresh_end ) {              // the rest of its last chunk
+      fresh = x->fresh;
+      fresh_end = x->fresh_end;
+    }
+    x->fresh = x->fresh_end = NULL;
+    x->regions.clear();
+    x->due = NONE;
+  }
+
+  // The region whose arrays should be compacted, or NONE.
+  size_t compaction_due() const { return due; }
+
+  // Until end_compaction() the arrays of region i stay where they are,
+  // but compacting() tells them apart and the region takes new arrays
+  // from new slabs.  The table moves the arrays of the groups of region
+  // i to new ones, of course without freeing the old ones.
+  void begin_compaction(size_t i) {
+    assert(old_slabs == NULL);
+    region& r = regions[i];
+    old_slabs = r.slabs;
+    old_live = r.live;
+    for ( slab* s = old_slabs; s != NULL; s = s->next )
+      s->region = NONE;
+    r = region();
+    if ( due == i )
+      due = NONE;
+  }
+  bool compacting(const void* p) const {
+    const slab* s = slab_of(p);
+    return s->arena == this && s->region == NONE;
+  }
+  void end_compaction(size_t i) {
+    assert(regions[i].live == old_live);
+    (void)i;
+    while ( old_slabs != NULL ) {
+      slab* s = old_slabs;
+      old_slabs = s->next;
+      s->next = spare;
+      spare = s;
+    }
+  }
+
+ private:
+  static const size_t UNIT = GRANULE * VALUE_SIZE;
+  static const size_t CHUNK_BYTES = (CHUNK_SLABS + 1) * SLAB_BYTES;
+
+  struct slab {
+    sparsegroup_arena* arena;
+    size_t region;
+    slab* next;                              // in its region or spare
+  };
+
+  struct region {
+    region()
+        : slabs(NULL), top(NULL), end(NULL), live(0), live_bytes(0),
+          free_bytes(0) {
+      for ( size_t c = 0; c < NUM_CLASSES; ++c )
+        free[c] = NULL;
+    }
+
+    void* free[NUM_CLASSES];                 // free arrays by size class
+    slab* slabs;                             // the first one is in use
+    char* top;                               // the unused rest of it
+    char* end;
+    size_t live;                             // arrays handed out
+    size_t live_bytes;                       // and their bytes
+    size_t free_bytes;                       // on the free lists
+  };
+
+  typedef typename Alloc::template rebind<char>::other chunk_alloc_type;
+
+  static size_t bytes(size_t n) {
+    return (n + GRANULE - 1) / GRANULE * UNIT;
+  }
+
+  static slab* slab_of(const void* p) {
+    return reinterpret_cast<slab*>(
+        reinterpret_cast<uintptr_t>(p) & ~static_cast<uintptr_t>(SLAB_BYTES - 1));
+  }
+
+  void* allocate_in(size_t i, size_t n_bytes) {
+    region& r = regions[i];
+    void*& head = r.free[n_bytes / UNIT - 1];
+    void* retval = head;
+    if ( retval != NULL ) {
+      memcpy(&head, retval, sizeof(head));   // the next free array
+      r.free_bytes -= n_bytes;
+    } else {
+      if ( static_cast<size_t>(r.end - r.top) < n_bytes && !new_slab(i) )
+        return NULL;
+      retval = r.top;
+      r.top += n_bytes;
+    }
+    ++r.live;
+    r.live_bytes += n_bytes;
+    return retval;
+  }
+
+  void free_in(size_t i, void* p, size_t n_bytes) {
+    region& r = regions[i];
+    r.live_bytes -= n_bytes;
+    push(r, p, n_bytes);
+    if ( --r.live == 0 )
+      release(i);
+    else
+      check_waste(i);
+  }
+
+  void push(region& r, void* p, size_t n_bytes) {
+    void*& head = r.free[n_bytes / UNIT - 1];
+    memcpy(p, &head, sizeof(head));
+    head = p;
+    r.free_bytes += n_bytes;
+  }
+
+  void check_waste(size_t i) {
+    const region& r = regions[i];
+    if ( due == NONE && r.free_bytes > 2 * SLAB_BYTES &&
+         r.free_bytes > r.live_bytes / COMPACT_SHARE )
+      due = i;
+  }
+
+  // Starts a new slab for region i, what is left of the one before goes
+  // to the free lists.
+  bool new_slab(size_t i) {
+    slab* s = spare;
+    if ( s == NULL && donor != NULL )
+      s = donor->spare;
+    if ( s != NULL ) {
+      (s == spare ? spare : donor->spare) = s->next;
+    } else {
+      if ( fresh == fresh_end && !new_chunk() )
+        return false;
+      s = reinterpret_cast<slab*>(fresh);
+      fresh += SLAB_BYTES;
+    }
+    region& r = regions[i];
+    while ( static_cast<size_t>(r.end - r.top) >= UNIT ) {
+      size_t n_bytes = static_cast<size_t>(r.end - r.top) / UNIT * UNIT;
+      if ( n_bytes > NUM_CLASSES * UNIT )
+        n_bytes = NUM_CLASSES * UNIT;
+      push(r, r.top, n_bytes);
+      r.top += n_bytes;
+    }
+    s->arena = this;
+    s->region = i;
+    s->next = r.slabs;
+    r.slabs = s;
+    r.top = reinterpret_cast<char*>(s) + HEADER_BYTES;
+    r.end = reinterpret_cast<char*>(s) + SLAB_BYTES;
+    return true;
+  }
+
+  // All arrays of region i are free, its slabs are spare.
+  void release(size_t i) {
+    region& r = regions[i];
+    if ( due == i )
+      due = NONE;
+    while ( r.slabs != NULL ) {
+      slab* s = r.slabs;
+      r.slabs = s->next;
+      s->next = spare;
+      spare = s;
+    }
+    r = region();
+  }
+
+  bool new_chunk() {
+    char* p = alloc.allocate(CHUNK_BYTES);
+    if ( p == NULL )
+      return false;
+    chunks.push_back(p);
+    const uintptr_t first = (reinterpret_cast<uintptr_t>(p) + SLAB_BYTES - 1) &
+                            ~static_cast<uintptr_t>(SLAB_BYTES - 1);
+    fresh = p + (first - reinterpret_cast<uintptr_t>(p));
+    fresh_end = fresh + CHUNK_SLABS * SLAB_BYTES;
+    return true;
+  }
+
+  chunk_alloc_type alloc;
+  std::vector<char*> chunks;                 // as alloc gave them
+  std::vector<region> regions;
+  char* fresh;                               // slabs never used yet
+  char* fresh_end;
+  slab* spare;                               // slabs regions gave back
+  sparsegroup_arena* donor;                  // see lend_slabs()
+  slab* old_slabs;                           // see begin_compaction()
+  size_t old_live;
+  size_t current;                            // region of allocate()
+  size_t due;                                // see compaction_due()
+};
+
+template <size_t V, size_t M, class A>
+const size_t sparsegroup_arena<V, M, A>::GRANULE;
+template <size_t V, size_t M, class A>
+const size_t sparsegroup_arena<V, M, A>::NUM_CLASSES;
+template <size_t V, size_t M, class A>
+const size_t sparsegroup_arena<V, M, A>::REGION_GROUPS;
+template <size_t V, size_t M, class A>
+const size_t sparsegroup_arena<V, M, A>::HEADER_BYTES;
+template <size_t V, size_t M, class A>
+const size_t sparsegroup_arena<V, M, A>::SLAB_BYTES;
+template <size_t V, size_t M, class A>
+const size_t sparsegroup_arena<V, M, A>::CHUNK_SLABS;
+template <size_t V, size_t M, class A>
+const size_t sparsegroup_arena<V, M, A>::COMPACT_SHARE;
+template <size_t V, size_t M, class A>
+const size_t sparsegroup_arena<V, M, A>::NONE;
+template <size_t V, size_t M, class A>
+const size_t sparsegroup_arena<V, M, A>::UNIT;
+template <size_t V, size_t M, class A>
+const size_t sparsegroup_arena<V, M, A>::CHUNK_BYTES;
+
+_END_GOOGLE_NAMESPACE_
+
+#endif  // UTIL_GTL_ARENA_ALLOCATOR_WITH_REALLOC_H_
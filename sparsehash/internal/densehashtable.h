@@ -46,7 +46,10 @@
 // are resolved by trying to insert again in another bucket.  The
 // most cache-efficient internal probing schemes are linear probing
 // (which suffers, alas, from clumping) and quadratic probing, which
-// is what we implement by default.
+// is what we implement by default.  The Probe template argument picks
+// the scheme: dense_probe_quadratic, dense_probe_linear, or
+// dense_probe_robin_hood, which is linear probing that keeps runs
+// ordered by home bucket and erases without "deleted" markers.
 //
 // Type requirements: value_type is required to be Copy Constructible
 // and Default Constructible. It is not required to be (and commonly
@@ -55,6 +58,46 @@
 // You probably shouldn't use this code directly.  Use dense_hash_map<>
 // or dense_hash_set<> instead.
 
+// Growing the table normally rehashes every element in one call.  With
+// set_incremental_resize(n), the old table is kept next to the new one
+// instead, and each insert, erase and non-const find moves n of its
+// buckets over.  Lookups and iterators look at both tables until the
+// old one is empty.  The new table is allocated a little before it is
+// needed and filled with empty buckets a slice per insert as well.
+// This bounds the time a single insert can take, at the price of a
+// little work on every operation meanwhile.  As moving buckets
+// invalidates iterators, non-const find(), find_batch() and erase(key)
+// then invalidate them like insert does.
+//
+// With set_resize_threads(n), big tables are rehashed on n threads when
+// they grow or are copied, and so is a range passed to insert() along
+// with the table when the range is at least as big as the table.  The
+// hasher, key_equal and copy constructor of the values are then called
+// from several threads at once.  Robin Hood tables always rehash on
+// one thread, as their runs must stay ordered.
+//
+// find_batch(), count_batch() and insert_batch() look up or insert an
+// array of keys or values.  They hash set_batch_depth(n) keys ahead of
+// the one they resolve and prefetch the home bucket of each, so that
+// the cache misses of up to n lookups overlap instead of coming one
+// after the other.
+//
+// compact(budget) does while the table is idle what an insert would do
+// after a wave of erases: it rehashes the table to drop the deleted
+// buckets, into a smaller table if it is below the shrink threshold.
+// It uses the machinery of incremental resizing, a slice at a time, and
+// returns once budget is spent, so it can be called again and again in
+// the gaps between bursts of requests.  If the allocator can reallocate
+// blocks, the old table is then given back a slice at a time as well,
+// by shrinking it; otherwise it is freed at once.  debris_ratio() tells
+// how much there is to do.
+//
+// With an allocator whose reallocate() grows big blocks without copying
+// them, such as mmap_allocator_with_realloc, a table of trivially
+// copyable values grows in place: the bucket array is reallocated and
+// the elements are rehashed within it, so growing takes the new table
+// and a bit per bucket rather than the old and the new table.
+//
 // You can change the following below:
 // HT_OCCUPANCY_PCT      -- how full before we double size
 // HT_EMPTY_PCT          -- how empty before we halve size
@@ -71,7 +114,7 @@
 // For enlarge_factor, you can use this chart to try to trade-off
 // expected lookup time to the space taken up.  By default, this
 // code uses quadratic probing, though you can change it to linear
-// via JUMP_ below if you really want to.
+// via the Probe template argument if you really want to.
 //
 // From http://www.augustana.ca/~mohrj/courses/1999.fall/csc210/lecture_notes/hashing.html
 // NUMBER OF PROBES / LOOKUP       Successful            Unsuccessful
@@ -93,10 +136,12 @@
 #include <assert.h>
 #include <stdio.h>              // for FILE, fwrite, fread
 #include <algorithm>            // For swap(), eg
+#include <chrono>               // for compact()'s budget
 #include <iterator>             // For iterator tags
 #include <limits>               // for numeric_limits
 #include <memory>               // For uninitialized_fill
 #include <utility>              // for pair
+#include <vector>               // for erase() of a range, Robin Hood
 #include <sparsehash/internal/hashtable-common.h>
 #include <sparsehash/internal/libc_allocator_with_realloc.h>
 #include <sparsehash/type_traits.h>
@@ -108,15 +153,44 @@ namespace base {   // just to make google->opensource transition easier
 using GOOGLE_NAMESPACE::true_type;
 using GOOGLE_NAMESPACE::false_type;
 using GOOGLE_NAMESPACE::integral_constant;
+using GOOGLE_NAMESPACE::has_trivial_copy;
 using GOOGLE_NAMESPACE::is_same;
 using GOOGLE_NAMESPACE::remove_const;
 }
 
-// The probing method
-// Linear probing
-// #define JUMP_(key, num_probes)    ( 1 )
+// The probing method, given as the Probe template argument.  next()
+// returns the bucket to look at after bucknum on the num_probes-th
+// probe; mask is bucket_count() - 1.
 // Quadratic probing
-#define JUMP_(key, num_probes)    ( num_probes )
+struct dense_probe_quadratic {
+  static const bool robin_hood = false;
+  template <class SizeType>
+  static SizeType next(SizeType bucknum, SizeType num_probes, SizeType mask) {
+    return (bucknum + num_probes) & mask;
+  }
+};
+
+// Linear probing
+struct dense_probe_linear {
+  static const bool robin_hood = false;
+  template <class SizeType>
+  static SizeType next(SizeType bucknum, SizeType, SizeType mask) {
+    return (bucknum + 1) & mask;
+  }
+};
+
+// Robin Hood probing: linear probing where an insert takes the bucket of
+// the first element that is closer to its home bucket than the new one
+// would be, and shifts the rest of the run up by one.  Runs stay ordered
+// by home bucket, so a lookup can stop at that same bucket, which bounds
+// misses by the longest displacement rather than the length of the run.
+// erase() shifts the following elements of the run back instead of
+// leaving a "deleted" marker: no set_deleted_key() is needed, and probe
+// lengths don't grow under churn.  The cost is that erase() moves
+// elements, so it invalidates iterators and pointers.
+struct dense_probe_robin_hood : dense_probe_linear {
+  static const bool robin_hood = true;
+};
 
 // Hashtable class, used to implement the hashed associative containers
 // hash_set and hash_map.
@@ -134,26 +208,32 @@ using GOOGLE_NAMESPACE::remove_const;
 // EqualKey: Given two Keys, says whether they are the same (that is,
 //           if they are both associated with the same Value).
 // Alloc: STL allocator to use to allocate memory.
+// Probe: the probing method, see dense_probe_quadratic above.
 
 template <class Value, class Key, class HashFcn,
-          class ExtractKey, class SetKey, class EqualKey, class Alloc>
+          class ExtractKey, class SetKey, class EqualKey, class Alloc,
+          class Probe = dense_probe_quadratic>
 class dense_hashtable;
 
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
+template <class V, class K, class HF, class ExK, class SetK, class EqK, class A,
+          class P>
 struct dense_hashtable_iterator;
 
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
+template <class V, class K, class HF, class ExK, class SetK, class EqK, class A,
+          class P>
 struct dense_hashtable_const_iterator;
 
 // We're just an array, but we need to skip over empty and deleted elements
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
+template <class V, class K, class HF, class ExK, class SetK, class EqK, class A,
+          class P>
 struct dense_hashtable_iterator {
  private:
   typedef typename A::template rebind<V>::other value_alloc_type;
 
  public:
-  typedef dense_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A>       iterator;
-  typedef dense_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A> const_iterator;
+  typedef dense_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A,P>     iterator;
+  typedef dense_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A,P>
+      const_iterator;
 
   typedef std::forward_iterator_tag iterator_category;  // very little defined!
   typedef V value_type;
@@ -163,7 +243,7 @@ struct dense_hashtable_iterator {
   typedef typename value_alloc_type::pointer pointer;
 
   // "Real" constructor and default constructor
-  dense_hashtable_iterator(const dense_hashtable<V,K,HF,ExK,SetK,EqK,A> *h,
+  dense_hashtable_iterator(const dense_hashtable<V,K,HF,ExK,SetK,EqK,A,P> *h,
                            pointer it, pointer it_end, bool advance)
     : ht(h), pos(it), end(it_end)   {
     if (advance)  advance_past_empty_and_deleted();
@@ -181,6 +261,8 @@ struct dense_hashtable_iterator {
   void advance_past_empty_and_deleted() {
     while ( pos != end && (ht->test_empty(*this) || ht->test_deleted(*this)) )
       ++pos;
+    if ( pos == end && ht->continue_iteration(&pos, &end) )
+      advance_past_empty_and_deleted();
   }
   iterator& operator++()   {
     assert(pos != end); ++pos; advance_past_empty_and_deleted(); return *this;
@@ -193,20 +275,22 @@ struct dense_hashtable_iterator {
 
 
   // The actual data
-  const dense_hashtable<V,K,HF,ExK,SetK,EqK,A> *ht;
+  const dense_hashtable<V,K,HF,ExK,SetK,EqK,A,P> *ht;
   pointer pos, end;
 };
 
 
 // Now do it all again, but with const-ness!
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
+template <class V, class K, class HF, class ExK, class SetK, class EqK, class A,
+          class P>
 struct dense_hashtable_const_iterator {
  private:
   typedef typename A::template rebind<V>::other value_alloc_type;
 
  public:
-  typedef dense_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A>       iterator;
-  typedef dense_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A> const_iterator;
+  typedef dense_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A,P>     iterator;
+  typedef dense_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A,P>
+      const_iterator;
 
   typedef std::forward_iterator_tag iterator_category;  // very little defined!
   typedef V value_type;
@@ -217,7 +301,7 @@ struct dense_hashtable_const_iterator {
 
   // "Real" constructor and default constructor
   dense_hashtable_const_iterator(
-      const dense_hashtable<V,K,HF,ExK,SetK,EqK,A> *h,
+      const dense_hashtable<V,K,HF,ExK,SetK,EqK,A,P> *h,
       pointer it, pointer it_end, bool advance)
     : ht(h), pos(it), end(it_end)   {
     if (advance)  advance_past_empty_and_deleted();
@@ -239,6 +323,8 @@ struct dense_hashtable_const_iterator {
   void advance_past_empty_and_deleted() {
     while ( pos != end && (ht->test_empty(*this) || ht->test_deleted(*this)) )
       ++pos;
+    if ( pos == end && ht->continue_iteration(&pos, &end) )
+      advance_past_empty_and_deleted();
   }
   const_iterator& operator++()   {
     assert(pos != end); ++pos; advance_past_empty_and_deleted(); return *this;
@@ -251,12 +337,13 @@ struct dense_hashtable_const_iterator {
 
 
   // The actual data
-  const dense_hashtable<V,K,HF,ExK,SetK,EqK,A> *ht;
+  const dense_hashtable<V,K,HF,ExK,SetK,EqK,A,P> *ht;
   pointer pos, end;
 };
 
 template <class Value, class Key, class HashFcn,
-          class ExtractKey, class SetKey, class EqualKey, class Alloc>
+          class ExtractKey, class SetKey, class EqualKey, class Alloc,
+          class Probe>
 class dense_hashtable {
  private:
   typedef typename Alloc::template rebind<Value>::other value_alloc_type;
@@ -275,11 +362,12 @@ class dense_hashtable {
   typedef typename value_alloc_type::pointer pointer;
   typedef typename value_alloc_type::const_pointer const_pointer;
   typedef dense_hashtable_iterator<Value, Key, HashFcn,
-                                   ExtractKey, SetKey, EqualKey, Alloc>
+                                   ExtractKey, SetKey, EqualKey, Alloc, Probe>
   iterator;
 
   typedef dense_hashtable_const_iterator<Value, Key, HashFcn,
-                                         ExtractKey, SetKey, EqualKey, Alloc>
+                                         ExtractKey, SetKey, EqualKey, Alloc,
+                                         Probe>
   const_iterator;
 
   // These come from tr1.  For us they're the same as regular iterators.
@@ -307,13 +395,24 @@ class dense_hashtable {
   // at least HT_MIN_BUCKETS.
   static const size_type HT_DEFAULT_STARTING_BUCKETS = 32;
 
+  // With incremental resizing, how many buckets of the table to grow
+  // into are filled with empty buckets per bucket moved.
+  static const size_type HT_SPARE_FILL_PER_STEP = 64;
+
+  // How many buckets compact() moves between looks at the clock.  It
+  // fills or gives back HT_SPARE_FILL_PER_STEP times as many.
+  static const size_type HT_COMPACT_STEP = 256;
+
   // ITERATOR FUNCTIONS
-  iterator begin()             { return iterator(this, table,
-                                                 table + num_buckets, true); }
+  iterator begin()             { return old_table ? old_begin<iterator>()
+                                        : iterator(this, table,
+                                                   table + num_buckets, true); }
   iterator end()               { return iterator(this, table + num_buckets,
                                                  table + num_buckets, true); }
-  const_iterator begin() const { return const_iterator(this, table,
-                                                       table+num_buckets,true);}
+  const_iterator begin() const {
+    return old_table ? old_begin<const_iterator>()
+                     : const_iterator(this, table, table+num_buckets, true);
+  }
   const_iterator end() const   { return const_iterator(this, table + num_buckets,
                                                        table+num_buckets,true);}
 
@@ -348,6 +447,32 @@ class dense_hashtable {
   // Accessor function for statistics gathering.
   int num_table_copies() const { return settings.num_ht_copies(); }
 
+  // Probe lengths, cluster sizes and elements per home bucket, see
+  // probe_statistics in hashtable-common.h.
+  typedef sparsehash_internal::probe_statistics<size_type> probe_statistics;
+
+  // Walks the whole table, so this is meant for diagnostics only.
+  probe_statistics probe_stats() const {
+    if (!table) return probe_statistics();  // the empty key isn't set yet
+    sparsehash_internal::probe_counter<size_type> counter(num_buckets);
+    for ( size_type bucknum = 0; bucknum < num_buckets; ++bucknum ) {
+      if ( !test_empty(bucknum) && !test_deleted(bucknum) )  // not counting
+        counter.hit(hit_probes(bucknum),                    // an old table
+                    hash(get_key(table[bucknum])) & (num_buckets - 1));
+      counter.miss(miss_probes(bucknum));
+      counter.bucket(test_empty(bucknum));
+    }
+    return counter.result();
+  }
+
+  // The buckets as they are, empty and deleted ones included, for
+  // writers of images that are looked up in place (see dense_hash_image).
+  // NULL until the empty key is set, and while resizing(), as part of
+  // the elements are still in the old table then.
+  const_pointer raw_table() const { return old_table ? NULL : table; }
+  // How many of them hold the deleted key.
+  size_type num_deleted_buckets() const { return num_deleted; }
+
  private:
   // Annoyingly, we can't copy values around, because they might have
   // const components (they're probably pair<const X, Y>).  We use
@@ -371,7 +496,7 @@ class dense_hashtable {
   // at.  This is just because I don't know how to assign just a key.)
  private:
   void squash_deleted() {           // gets rid of any deleted entries we have
-    if ( num_deleted ) {            // get rid of deleted before writing
+    if ( num_deleted || old_table ) {  // get rid of deleted before writing
       dense_hashtable tmp(*this);   // copying will get rid of deleted
       swap(tmp);                    // now we are tmp
     }
@@ -379,10 +504,11 @@ class dense_hashtable {
   }
 
   // Test if the given key is the deleted indicator.  Requires
-  // num_deleted > 0, for correctness of read(), and because that
-  // guarantees that key_info.delkey is valid.
+  // num_deleted > 0 (or deleted entries in the old table), for
+  // correctness of read(), and because that guarantees that
+  // key_info.delkey is valid.
   bool test_deleted_key(const key_type& key) const {
-    assert(num_deleted > 0);
+    assert(num_deleted > 0 || old_num_deleted > 0);
     return equals(key_info.delkey, key);
   }
 
@@ -414,15 +540,29 @@ class dense_hashtable {
     assert(settings.use_deleted() || num_deleted == 0);
     return num_deleted > 0 && test_deleted_key(get_key(table[bucknum]));
   }
+  // Iterators may point into the old table during an incremental resize.
   bool test_deleted(const iterator &it) const {
     // Invariant: !use_deleted() implies num_deleted is 0.
     assert(settings.use_deleted() || num_deleted == 0);
-    return num_deleted > 0 && test_deleted_key(get_key(*it));
+    return (num_deleted > 0 || old_num_deleted > 0) &&
+        test_deleted_key(get_key(*it));
   }
   bool test_deleted(const const_iterator &it) const {
     // Invariant: !use_deleted() implies num_deleted is 0.
     assert(settings.use_deleted() || num_deleted == 0);
-    return num_deleted > 0 && test_deleted_key(get_key(*it));
+    return (num_deleted > 0 || old_num_deleted > 0) &&
+        test_deleted_key(get_key(*it));
+  }
+
+  // Moves an iterator that reached the end of the old table on to the
+  // start of the table.  False if it was at the end of the table.
+  template <class Pointer>
+  bool continue_iteration(Pointer* pos, Pointer* end) const {
+    if ( !old_table || *end != old_table + old_num_buckets )
+      return false;
+    *pos = table;
+    *end = table + num_buckets;
+    return true;
   }
 
  private:
@@ -486,6 +626,10 @@ class dense_hashtable {
   }
 
  private:
+  bool test_empty_value(const_reference v) const {
+    return equals(get_key(val_info.emptyval), get_key(v));
+  }
+
   void fill_range_with_empty(pointer table_start, pointer table_end) {
     std::uninitialized_fill(table_start, table_end, val_info.emptyval);
   }
@@ -517,7 +661,9 @@ class dense_hashtable {
 
   // FUNCTIONS CONCERNING SIZE
  public:
-  size_type size() const      { return num_elements - num_deleted; }
+  size_type size() const      {
+    return num_elements - num_deleted + old_size;
+  }
   size_type max_size() const  { return val_info.max_size(); }
   bool empty() const          { return size() == 0; }
   size_type bucket_count() const      { return num_buckets; }
@@ -542,12 +688,25 @@ class dense_hashtable {
     assert(bucket_count() >= HT_MIN_BUCKETS);
     bool retval = false;
 
+    const size_type sz = shrunk_bucket_count();
+    if (sz < bucket_count()) {
+      dense_hashtable tmp(*this, sz);       // Do the actual resizing
+      swap(tmp);                            // now we are tmp
+      retval = true;
+    }
+    settings.set_consider_shrink(false);    // because we just considered it
+    return retval;
+  }
+
+  // The bucket count we shrink to, or ours if we are not below the
+  // shrink threshold.
+  size_type shrunk_bucket_count() const {
     // If you construct a hashtable with < HT_DEFAULT_STARTING_BUCKETS,
     // we'll never shrink until you get relatively big, and we'll never
     // shrink below HT_DEFAULT_STARTING_BUCKETS.  Otherwise, something
     // like "dense_hash_set<int> x; x.insert(4); x.erase(4);" will
     // shrink us down to HT_MIN_BUCKETS buckets, which is too small.
-    const size_type num_remain = num_elements - num_deleted;
+    const size_type num_remain = size();
     const size_type shrink_threshold = settings.shrink_threshold();
     if (shrink_threshold > 0 && num_remain < shrink_threshold &&
         bucket_count() > HT_DEFAULT_STARTING_BUCKETS) {
@@ -557,12 +716,9 @@ class dense_hashtable {
              num_remain < sz * shrink_factor) {
         sz /= 2;                            // stay a power of 2
       }
-      dense_hashtable tmp(*this, sz);       // Do the actual resizing
-      swap(tmp);                            // now we are tmp
-      retval = true;
+      return sz;
     }
-    settings.set_consider_shrink(false);    // because we just considered it
-    return retval;
+    return bucket_count();
   }
 
   // We'll let you resize a hashtable -- though this makes us copy all!
@@ -570,6 +726,17 @@ class dense_hashtable {
   // Returns true if we actually resized, false if size was already ok.
   bool resize_delta(size_type delta) {
     bool did_resize = false;
+    if ( resize_step > 0 && !old_table )
+      fill_spare(delta);
+    if ( old_table ) {                   // an incremental resize is going on
+      migrate(migrate_count(delta));
+      // Moving buckets changes where things go, so we say we resized.
+      if ( old_table &&
+           num_elements + old_size + delta <= settings.enlarge_threshold() )
+        return true;
+      finish_resize();                   // out of room before we got done
+      did_resize = true;
+    }
     if ( settings.consider_shrink() ) {  // see if lots of deletes happened
       if ( maybe_shrink() )
         did_resize = true;
@@ -617,6 +784,14 @@ class dense_hashtable {
         resize_to *= 2;
       }
     }
+    if ( resize_step > 0 ) {               // move the elements over later
+      start_resize(resize_to);
+      return true;
+    }
+    if ( grow_in_place_pays(resize_to) ) {
+      grow_in_place(resize_to);
+      return true;
+    }
     dense_hashtable tmp(*this, resize_to);
     swap(tmp);                             // now we are tmp
     return true;
@@ -633,6 +808,71 @@ class dense_hashtable {
     table = val_info.allocate(new_size);
   }
 
+  // IN-PLACE GROWTH
+  // When the allocator grows blocks without copying them, e.g.
+  // mmap_allocator_with_realloc, we grow the table itself and rehash the
+  // elements where they are, instead of copying them to a new table: the
+  // old and the new table are never both around, and only a bit per
+  // bucket is needed on top.  Values must survive being moved by
+  // reallocate(), and Robin Hood runs would need reordering, so such
+  // tables are copied as usual, as are those rehashed on several threads.
+  bool grow_in_place_pays(size_type new_num_buckets) const {
+    return has_in_place_reallocate<value_alloc_type>::value &&
+        base::has_trivial_copy<value_type>::value && !Probe::robin_hood &&
+        !parallel_rehash_pays() && table && !old_table &&
+        new_num_buckets > num_buckets;
+  }
+
+  // Each bucket i of the old table holding a value is marked pending.
+  // The value goes to the first bucket of its probe sequence which is
+  // empty or pending: if that is i it stays, if it is empty it moves
+  // there, if it is another pending bucket the two values swap and i is
+  // looked at again.  A bucket is only passed over once its value is in
+  // place for good, so the probe sequences of those values stay intact.
+  void grow_in_place(size_type new_num_buckets) {
+    const size_type old_num_buckets = num_buckets;
+    std::vector<bool> pending(old_num_buckets);
+    for ( size_type i = 0; i < old_num_buckets; ++i ) {
+      if ( test_empty(i) ) continue;
+      if ( num_deleted > 0 && test_deleted(i) )
+        set_value(&table[i], val_info.emptyval);   // deleted ones go
+      else
+        pending[i] = true;
+    }
+    table = val_info.realloc_or_die(table, new_num_buckets, old_num_buckets);
+    fill_range_with_empty(table + old_num_buckets, table + new_num_buckets);
+    num_buckets = new_num_buckets;
+    num_elements -= num_deleted;
+    num_deleted = 0;
+    settings.reset_thresholds(bucket_count());
+
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    for ( size_type i = 0; i < old_num_buckets; ++i ) {
+      while ( pending[i] ) {
+        size_type num_probes = 0;
+        size_type bucknum = hash(get_key(table[i])) & bucket_count_minus_one;
+        while ( !test_empty(bucknum) &&
+                !(bucknum < old_num_buckets && pending[bucknum]) ) {
+          ++num_probes;
+          bucknum = Probe::next(bucknum, num_probes, bucket_count_minus_one);
+        }
+        if ( bucknum == i ) {
+          pending[i] = false;
+        } else if ( test_empty(bucknum) ) {
+          set_value(&table[bucknum], table[i]);
+          set_value(&table[i], val_info.emptyval);
+          pending[i] = false;
+        } else {                           // an element not rehashed yet
+          value_type tmp(table[bucknum]);
+          set_value(&table[bucknum], table[i]);
+          set_value(&table[i], tmp);
+          pending[bucknum] = false;
+        }
+      }
+    }
+    settings.inc_num_ht_copies();
+  }
+
   // Used to actually do the rehashing when we grow/shrink a hashtable
   void copy_from(const dense_hashtable &ht, size_type min_buckets_wanted) {
     clear_to_size(settings.min_buckets(ht.size(), min_buckets_wanted));
@@ -641,29 +881,323 @@ class dense_hashtable {
     // We could use insert() here, but since we know there are
     // no duplicates and no deleted items, we can be more efficient
     assert((bucket_count() & (bucket_count()-1)) == 0);      // a power of two
-    for ( const_iterator it = ht.begin(); it != ht.end(); ++it ) {
-      size_type num_probes = 0;              // how many times we've probed
-      size_type bucknum;
-      const size_type bucket_count_minus_one = bucket_count() - 1;
-      for (bucknum = hash(get_key(*it)) & bucket_count_minus_one;
-           !test_empty(bucknum);                               // not empty
-           bucknum = (bucknum + JUMP_(key, num_probes)) & bucket_count_minus_one) {
+    if ( parallel_rehash_pays() && !ht.old_table ) {
+      parallel_insert(ht.num_buckets, [&ht](size_type i) -> const_pointer {
+        if ( ht.test_empty(i) || ht.test_deleted(i) ) return NULL;
+        return &ht.table[i];
+      }, false);
+    } else {
+      for ( const_iterator it = ht.begin(); it != ht.end(); ++it ) {
+        insert_new(*it);
+      }
+    }
+    settings.inc_num_ht_copies();
+  }
+
+  // PARALLEL REHASH, see sparsehash_internal::parallel_rehash.
+  bool parallel_rehash_pays() const {
+    return num_resize_threads > 1 && !Probe::robin_hood &&
+        bucket_count() >= parallel_rehash_type::MIN_BUCKETS;
+  }
+
+  // Inserts source(i), unless it is NULL, for i in [0, n) on
+  // num_resize_threads threads.  Unless check_dups is set, the values
+  // are known not to be in the table and to be different from each
+  // other.  The table has room for all of them, no deleted buckets and
+  // no resize going on.
+  template <class Source>
+  void parallel_insert(size_type n, const Source& source, bool check_dups) {
+    typedef typename parallel_rehash_type::entry entry;
+    assert(num_deleted == 0 && !old_table);
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    parallel_rehash_type rehash(num_resize_threads, bucket_count(), 1);
+    rehash.scatter(n, [&](size_type i, entry* e) {
+      e->second = source(i);
+      if ( e->second == NULL ) return false;
+      e->first = hash(get_key(*e->second)) & bucket_count_minus_one;
+      return true;
+    });
+    std::vector<size_type> added(rehash.threads());
+    rehash.place([&](size_t t, entry* e, size_type begin, size_type end) {
+      size_type num_probes = 0;
+      size_type bucknum = e->first;
+      while ( !test_empty(bucknum) ) {
+        if ( check_dups &&
+             equals(get_key(*e->second), get_key(table[bucknum])) )
+          return true;                       // we have it already
         ++num_probes;
-        assert(num_probes < bucket_count()
-               && "Hashtable is full: an error in key_equal<> or hash<>");
+        bucknum = Probe::next(bucknum, num_probes, bucket_count_minus_one);
+        if ( bucknum < begin || bucknum >= end )
+          return false;                      // another thread's buckets
       }
-      set_value(&table[bucknum], *it);       // copies the value to here
-      num_elements++;
+      set_value(&table[bucknum], *e->second);
+      ++added[t];
+      return true;
+    });
+    for ( size_type t = 0; t < added.size(); ++t )
+      num_elements += added[t];
+    rehash.insert_deferred([&](const entry& e) {
+      if ( !check_dups ||
+           find_position(get_key(*e.second)).first == ILLEGAL_BUCKET )
+        insert_new(*e.second);
+    });
+  }
+
+  // Rehashes our values and the range [f, l) into a new table on
+  // num_resize_threads threads.  If that throws, we are left as we were.
+  template <class RandomAccessIterator>
+  void parallel_insert_range(RandomAccessIterator f, size_type dist) {
+    const size_type new_num_buckets =
+        settings.min_buckets(size() + dist, bucket_count());
+    pointer new_table = val_info.allocate(new_num_buckets);
+    fill_range_with_empty(new_table, new_table + new_num_buckets);
+    const pointer src = table;
+    const size_type src_num_buckets = num_buckets;
+    const size_type src_num_elements = num_elements;
+    const size_type src_num_deleted = num_deleted;
+    table = new_table;
+    num_buckets = new_num_buckets;
+    num_elements = 0;
+    num_deleted = 0;
+    settings.reset_thresholds(bucket_count());
+    try {
+      parallel_insert(src_num_buckets + dist,
+                      [&](size_type i) -> const_pointer {
+        if ( i >= src_num_buckets ) return &*(f + (i - src_num_buckets));
+        if ( test_empty_value(src[i]) ||
+             (src_num_deleted > 0 &&
+              equals(key_info.delkey, get_key(src[i]))) )
+          return NULL;
+        return &src[i];
+      }, true);
+    } catch (...) {
+      destroy_buckets(0, num_buckets);
+      val_info.deallocate(table, num_buckets);
+      table = src;
+      num_buckets = src_num_buckets;
+      num_elements = src_num_elements;
+      num_deleted = src_num_deleted;
+      settings.reset_thresholds(bucket_count());
+      throw;
     }
+    for ( size_type i = 0; i < src_num_buckets; ++i )
+      src[i].~value_type();
+    val_info.deallocate(src, src_num_buckets);
     settings.inc_num_ht_copies();
   }
 
+  // Puts obj, which we know isn't in the table, where find() will look.
+  void insert_new(const_reference obj) {
+    if ( Probe::robin_hood ) {             // runs must stay ordered
+      insert_at(obj, find_position(get_key(obj)).second);
+      return;
+    }
+    size_type num_probes = 0;              // how many times we've probed
+    size_type bucknum;
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    for (bucknum = hash(get_key(obj)) & bucket_count_minus_one;
+         !test_empty(bucknum);                               // not empty
+         bucknum = Probe::next(bucknum, num_probes, bucket_count_minus_one)) {
+      ++num_probes;
+      assert(num_probes < bucket_count()
+             && "Hashtable is full: an error in key_equal<> or hash<>");
+    }
+    set_value(&table[bucknum], obj);       // copies the value to here
+    num_elements++;
+  }
+
+  // INCREMENTAL RESIZE HELPERS
+  // While old_table is set, the elements it holds from old_pos on are
+  // part of the hashtable as well.  The buckets before old_pos have been
+  // moved: with Robin Hood probing they are emptied, which keeps the runs
+  // intact; otherwise they keep a stale copy, so that the probe sequences
+  // going through them stay intact, and find_old() ignores it.
+  void start_resize(size_type new_num_buckets) {
+    old_table = table;
+    old_num_buckets = num_buckets;
+    old_pos = 0;
+    old_size = num_elements - num_deleted;
+    old_num_deleted = num_deleted;
+    if ( spare_table && spare_num_buckets == new_num_buckets ) {
+      fill_range_with_empty(spare_table + spare_filled,
+                            spare_table + new_num_buckets);
+      table = spare_table;
+      spare_table = NULL;
+      spare_num_buckets = 0;
+      spare_filled = 0;
+    } else {                               // not the size we guessed
+      drop_spare_table();
+      table = val_info.allocate(new_num_buckets);
+      fill_range_with_empty(table, table + new_num_buckets);
+    }
+    num_buckets = new_num_buckets;
+    num_elements = 0;
+    num_deleted = 0;
+    settings.reset_thresholds(bucket_count());
+    settings.inc_num_ht_copies();
+  }
+
+  // How many buckets to move before inserting delta more elements: at
+  // least resize_step, and enough to be done before fill_spare() starts
+  // preparing the next resize.  Without incremental resizing the resize
+  // is one compact() started, and it is finished at once.
+  size_type migrate_count(size_type delta) const {
+    const size_type left = old_num_buckets - old_pos;
+    if ( resize_step == 0 ) return left;
+    const size_type lead =
+        bucket_count() * 2 / (resize_step * HT_SPARE_FILL_PER_STEP);
+    const size_type used = num_elements + old_size + delta + lead;
+    if ( used >= settings.enlarge_threshold() )
+      return left;
+    const size_type room = settings.enlarge_threshold() - used;
+    return (std::max)(resize_step, (left + room - 1) / room);
+  }
+
+  // Moves up to n buckets of the old table over, and frees it once it
+  // is done with.
+  void migrate(size_type n) {
+    if ( move_old_buckets(n) )
+      drop_old_table();
+  }
+
+  // Moves up to n buckets of the old table over.  Returns true once
+  // there is nothing left in it.
+  bool move_old_buckets(size_type n) {
+    if ( !old_table ) return false;
+    for ( ; n > 0 && old_pos < old_num_buckets; --n, ++old_pos ) {
+      const_reference obj = old_table[old_pos];
+      if ( Probe::robin_hood ) {
+        while ( !test_empty_value(obj) ) {  // the run moves down into it
+          insert_new(obj);
+          shift_down(old_table, old_num_buckets - 1, old_pos);
+          --old_size;
+        }
+      } else if ( !test_empty_value(obj) &&
+                  !(old_num_deleted > 0 && test_deleted_key(get_key(obj))) ) {
+        insert_new(obj);
+        --old_size;
+      }
+    }
+    return old_pos == old_num_buckets || old_size == 0;
+  }
+
+  // Filling a big table with empty buckets takes a good part of the time
+  // of a resize, so we allocate the table to grow into once we are close
+  // enough to the enlarge threshold to fill it a slice per insert.  It
+  // is usually twice our size; if not, start_resize() makes a new one.
+  void fill_spare(size_type delta) {
+    const size_type fill = resize_step * HT_SPARE_FILL_PER_STEP;
+    if ( !spare_table ) {
+      const size_type spare_buckets = bucket_count() * 2;
+      if ( spare_buckets < bucket_count() ||        // overflow
+           num_elements + delta + spare_buckets / fill <
+           settings.enlarge_threshold() )
+        return;                                     // not close enough yet
+      spare_table = val_info.allocate(spare_buckets);
+      spare_num_buckets = spare_buckets;
+      spare_filled = 0;
+    }
+    const size_type n = (std::min)(fill, spare_num_buckets - spare_filled);
+    fill_range_with_empty(spare_table + spare_filled,
+                          spare_table + spare_filled + n);
+    spare_filled += n;
+  }
+
+  void drop_spare_table() {
+    if ( !spare_table ) return;
+    for ( size_type i = 0; i < spare_filled; ++i )
+      spare_table[i].~value_type();
+    val_info.deallocate(spare_table, spare_num_buckets);
+    spare_table = NULL;
+    spare_num_buckets = 0;
+    spare_filled = 0;
+  }
+
+  void drop_old_table() {
+    if ( !old_table ) return;
+    retire_old_table();
+    drop_retired_table();
+  }
+
+  // Destroys the buckets of the old table and keeps its memory as the
+  // retired table, for compact() to give back a slice at a time.
+  void retire_old_table() {
+    drop_retired_table();
+    for ( size_type i = 0; i < old_num_buckets; ++i )
+      old_table[i].~value_type();
+    retired_table = old_table;
+    retired_num_buckets = old_num_buckets;
+    old_table = NULL;
+    old_num_buckets = 0;
+    old_pos = 0;
+    old_size = 0;
+    old_num_deleted = 0;
+  }
+
+  void drop_retired_table() {
+    if ( !retired_table ) return;
+    val_info.deallocate(retired_table, retired_num_buckets);
+    retired_table = NULL;
+    retired_num_buckets = 0;
+  }
+
+  // Gives the last n buckets of the retired table back by shrinking it,
+  // or all of it once that is no more than n, or if the allocator can't.
+  void release_retired_table(size_type n, base::true_type) {
+    if ( retired_num_buckets <= n ) {
+      drop_retired_table();
+      return;
+    }
+    retired_table = val_info.realloc_or_die(retired_table,
+                                            retired_num_buckets - n,
+                                            retired_num_buckets);
+    retired_num_buckets -= n;
+  }
+
+  void release_retired_table(size_type, base::false_type) {
+    drop_retired_table();
+  }
+
+  // Where key is in the old table, or ILLEGAL_BUCKET if it isn't there
+  // or has been moved already.
+  size_type find_old(const key_type& key) const {
+    if ( !old_table || old_size == 0 ) return ILLEGAL_BUCKET;
+    size_type num_probes = 0;
+    const size_type bucket_count_minus_one = old_num_buckets - 1;
+    size_type bucknum = hash(key) & bucket_count_minus_one;
+    while ( !test_empty_value(old_table[bucknum]) ) {
+      if ( equals(key, get_key(old_table[bucknum])) )
+        return bucknum >= old_pos ? bucknum : ILLEGAL_BUCKET;
+      if ( Probe::robin_hood &&
+           displacement(old_table, bucket_count_minus_one, bucknum) <
+           num_probes )
+        break;
+      ++num_probes;
+      bucknum = Probe::next(bucknum, num_probes, bucket_count_minus_one);
+    }
+    return ILLEGAL_BUCKET;
+  }
+
+  template <class It>
+  It find_in_old(const key_type& key) const {
+    const size_type bucknum = find_old(key);
+    if ( bucknum == ILLEGAL_BUCKET )
+      return It(this, table + num_buckets, table + num_buckets, true);
+    return It(this, old_table + bucknum, old_table + old_num_buckets, false);
+  }
+
+  template <class It>
+  It old_begin() const {
+    return It(this, old_table + old_pos, old_table + old_num_buckets, true);
+  }
+
   // Required by the spec for hashed associative container
  public:
   // Though the docs say this should be num_buckets, I think it's much
   // more useful as num_elements.  As a special feature, calling with
   // req_elements==0 will cause us to shrink if we can, saving space.
   void resize(size_type req_elements) {       // resize to this or larger
+    finish_resize();
     if ( settings.consider_shrink() || req_elements == 0 )
       maybe_shrink();
     if ( req_elements > num_elements )
@@ -683,6 +1217,106 @@ class dense_hashtable {
     settings.reset_thresholds(bucket_count());
   }
 
+  // Incremental resizing, see the top of this file: buckets_per_op old
+  // buckets are moved on each insert, erase and non-const find.  With
+  // the default load factors, 2 or more keep up with inserts.  0, the
+  // default, resizes all at once and finishes any resize in progress.
+  void set_incremental_resize(size_type buckets_per_op) {
+    resize_step = buckets_per_op;
+    if ( resize_step == 0 ) {
+      finish_resize();
+      drop_spare_table();
+    }
+  }
+  size_type incremental_resize() const { return resize_step; }
+
+  // Rehashing, when the table grows or is copied, and inserting a range
+  // at least as big as the table use n threads; 1, the default, keeps
+  // to the calling thread.
+  void set_resize_threads(size_type n) {
+    num_resize_threads = n > 0 ? n : 1;
+  }
+  size_type resize_threads() const { return num_resize_threads; }
+
+  // How many keys ahead find_batch(), count_batch() and insert_batch()
+  // prefetch, 16 by default, at most 64.
+  void set_batch_depth(size_type n) {
+    batch_prefetch_depth = n < 1 ? 1
+        : n > sparsehash_internal::MAX_BATCH_DEPTH
+        ? sparsehash_internal::MAX_BATCH_DEPTH : n;
+  }
+  size_type batch_depth() const { return batch_prefetch_depth; }
+
+  // True while an incremental resize is going on.
+  bool resizing() const { return old_table != NULL; }
+  // Moves all that is left of the old table over at once.
+  void finish_resize() {
+    if ( old_table )
+      migrate(old_num_buckets);
+  }
+
+  // Compaction, see the top of this file.  Each round fills a slice of
+  // the table to rehash into with empty buckets, starts the resize once
+  // it is filled, moves a slice of the old table over, or gives a slice
+  // of the old table back once it is retired, until budget is spent; at
+  // least one round is done.  Returns true once there are no deleted
+  // buckets, nothing to shrink and nothing left to free.  Lookups,
+  // inserts and erases may come between calls; without incremental
+  // resizing the next insert which needs to resize finishes the work.
+  bool compact(std::chrono::nanoseconds budget) {
+    if ( !table ) return true;             // no empty key, no buckets yet
+    const std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + budget;
+    const size_type slice = HT_COMPACT_STEP * HT_SPARE_FILL_PER_STEP;
+    typedef base::integral_constant<bool,
+        has_reallocate_method<value_alloc_type>::value>
+        realloc_ok;
+    do {
+      if ( retired_table ) {
+        release_retired_table(slice, realloc_ok());
+        continue;
+      }
+      if ( old_table ) {
+        if ( move_old_buckets(HT_COMPACT_STEP) )
+          retire_old_table();
+        continue;
+      }
+      const size_type target = shrunk_bucket_count();
+      if ( num_deleted == 0 && target == bucket_count() )
+        return true;
+      if ( spare_table && spare_num_buckets != target )
+        drop_spare_table();
+      if ( !spare_table ) {
+        spare_table = val_info.allocate(target);
+        spare_num_buckets = target;
+        spare_filled = 0;
+      }
+      if ( spare_filled < target ) {
+        const size_type left = target - spare_filled;
+        const size_type n = left < slice ? left : slice;
+        fill_range_with_empty(spare_table + spare_filled,
+                              spare_table + spare_filled + n);
+        spare_filled += n;
+      } else {
+        start_resize(target);              // takes the spare table
+      }
+    } while ( std::chrono::steady_clock::now() < deadline );
+    return !old_table && !retired_table && num_deleted == 0 &&
+        shrunk_bucket_count() == bucket_count();
+  }
+
+  // The share of the buckets we hold that compact() would get rid of:
+  // those a shrink would drop, the old table of a resize going on, what
+  // is left of a retired one, and the deleted buckets, in proportion to
+  // the buckets kept since those in the part dropped go anyway.
+  float debris_ratio() const {
+    if ( !table ) return 0.0f;
+    const float held = static_cast<float>(num_buckets + old_num_buckets +
+                                          retired_num_buckets);
+    const float kept = static_cast<float>(shrunk_bucket_count());
+    return (held - kept + num_deleted * kept / held) / held;
+  }
+
   // CONSTRUCTORS -- as required by the specs, we take a size,
   // but also let you specify a hashfunction, key comparator,
   // and key extractor.  We also define a copy constructor and =.
@@ -701,7 +1335,20 @@ class dense_hashtable {
                     ? HT_DEFAULT_STARTING_BUCKETS
                     : settings.min_buckets(expected_max_items_in_table, 0)),
         val_info(alloc_impl<value_alloc_type>(alloc)),
-        table(NULL) {
+        table(NULL),
+        resize_step(0),
+        num_resize_threads(1),
+        batch_prefetch_depth(sparsehash_internal::DEFAULT_BATCH_DEPTH),
+        old_table(NULL),
+        old_num_buckets(0),
+        old_pos(0),
+        old_size(0),
+        old_num_deleted(0),
+        spare_table(NULL),
+        spare_num_buckets(0),
+        spare_filled(0),
+        retired_table(NULL),
+        retired_num_buckets(0) {
     // table is NULL until emptyval is set.  However, we set num_buckets
     // here so we know how much space to allocate once emptyval is set
     settings.reset_thresholds(bucket_count());
@@ -717,7 +1364,20 @@ class dense_hashtable {
         num_elements(0),
         num_buckets(0),
         val_info(ht.val_info),
-        table(NULL) {
+        table(NULL),
+        resize_step(ht.resize_step),
+        num_resize_threads(ht.num_resize_threads),
+        batch_prefetch_depth(ht.batch_prefetch_depth),
+        old_table(NULL),
+        old_num_buckets(0),
+        old_pos(0),
+        old_size(0),
+        old_num_deleted(0),
+        spare_table(NULL),
+        spare_num_buckets(0),
+        spare_filled(0),
+        retired_table(NULL),
+        retired_num_buckets(0) {
     if (!ht.settings.use_empty()) {
       // If use_empty isn't set, copy_from will crash, so we do our own copying.
       assert(ht.empty());
@@ -739,6 +1399,9 @@ class dense_hashtable {
     }
     settings = ht.settings;
     key_info = ht.key_info;
+    resize_step = ht.resize_step;
+    num_resize_threads = ht.num_resize_threads;
+    batch_prefetch_depth = ht.batch_prefetch_depth;
     set_value(&val_info.emptyval, ht.val_info.emptyval);
     // copy_from() calls clear and sets num_deleted to 0 too
     copy_from(ht, HT_MIN_BUCKETS);
@@ -747,6 +1410,9 @@ class dense_hashtable {
   }
 
   ~dense_hashtable() {
+    drop_old_table();
+    drop_spare_table();
+    drop_retired_table();
     if (table) {
       destroy_buckets(0, num_buckets);
       val_info.deallocate(table, num_buckets);
@@ -766,6 +1432,19 @@ class dense_hashtable {
       set_value(&ht.val_info.emptyval, tmp);
     }
     std::swap(table, ht.table);
+    std::swap(resize_step, ht.resize_step);
+    std::swap(num_resize_threads, ht.num_resize_threads);
+    std::swap(batch_prefetch_depth, ht.batch_prefetch_depth);
+    std::swap(old_table, ht.old_table);
+    std::swap(old_num_buckets, ht.old_num_buckets);
+    std::swap(old_pos, ht.old_pos);
+    std::swap(old_size, ht.old_size);
+    std::swap(old_num_deleted, ht.old_num_deleted);
+    std::swap(spare_table, ht.spare_table);
+    std::swap(spare_num_buckets, ht.spare_num_buckets);
+    std::swap(spare_filled, ht.spare_filled);
+    std::swap(retired_table, ht.retired_table);
+    std::swap(retired_num_buckets, ht.retired_num_buckets);
     settings.reset_thresholds(bucket_count());  // also resets consider_shrink
     ht.settings.reset_thresholds(ht.bucket_count());
     // we purposefully don't swap the allocator, which may not be swap-able
@@ -773,6 +1452,9 @@ class dense_hashtable {
 
  private:
   void clear_to_size(size_type new_num_buckets) {
+    drop_old_table();
+    drop_spare_table();
+    drop_retired_table();
     if (!table) {
       table = val_info.allocate(new_num_buckets);
     } else {
@@ -798,7 +1480,7 @@ class dense_hashtable {
     // If the table is already empty, and the number of buckets is
     // already as we desire, there's nothing to do.
     const size_type new_num_buckets = settings.min_buckets(0, 0);
-    if (num_elements == 0 && new_num_buckets == num_buckets) {
+    if (num_elements == 0 && new_num_buckets == num_buckets && !old_table) {
       return;
     }
     clear_to_size(new_num_buckets);
@@ -808,6 +1490,9 @@ class dense_hashtable {
   // Mimicks the stl_hashtable's behaviour when clear()-ing in that it
   // does not modify the bucket count
   void clear_no_resize() {
+    drop_old_table();
+    drop_spare_table();
+    drop_retired_table();
     if (num_elements > 0) {
       assert(table);
       destroy_buckets(0, num_buckets);
@@ -827,9 +1512,15 @@ class dense_hashtable {
   // Note: because of deletions where-to-insert is not trivial: it's the
   // first deleted bucket we see, as long as we don't find the key later
   std::pair<size_type, size_type> find_position(const key_type &key) const {
+    return find_position(key, hash(key));
+  }
+
+  // Likewise, for a key whose hash is known already.
+  std::pair<size_type, size_type> find_position(const key_type &key,
+                                                size_type key_hash) const {
     size_type num_probes = 0;              // how many times we've probed
     const size_type bucket_count_minus_one = bucket_count() - 1;
-    size_type bucknum = hash(key) & bucket_count_minus_one;
+    size_type bucknum = key_hash & bucket_count_minus_one;
     size_type insert_pos = ILLEGAL_BUCKET; // where we would insert
     while ( 1 ) {                          // probe until something happens
       if ( test_empty(bucknum) ) {         // bucket is empty
@@ -844,21 +1535,60 @@ class dense_hashtable {
 
       } else if ( equals(key, get_key(table[bucknum])) ) {
         return std::pair<size_type,size_type>(bucknum, ILLEGAL_BUCKET);
+
+      } else if ( Probe::robin_hood && displacement(bucknum) < num_probes ) {
+        // key would have taken this bucket over, so it isn't further on
+        return std::pair<size_type,size_type>(ILLEGAL_BUCKET, bucknum);
       }
       ++num_probes;                        // we're doing another probe
-      bucknum = (bucknum + JUMP_(key, num_probes)) & bucket_count_minus_one;
+      bucknum = Probe::next(bucknum, num_probes, bucket_count_minus_one);
       assert(num_probes < bucket_count()
              && "Hashtable is full: an error in key_equal<> or hash<>");
     }
   }
 
+  // How far the element in bucknum is from its home bucket.  Only
+  // meaningful for linear probing.
+  size_type displacement(size_type bucknum) const {
+    return displacement(table, bucket_count() - 1, bucknum);
+  }
+  size_type displacement(const_pointer tbl, size_type bucket_count_minus_one,
+                         size_type bucknum) const {
+    return (bucknum - hash(get_key(tbl[bucknum]))) & bucket_count_minus_one;
+  }
+
+  // Number of buckets find() looks at to find the element in bucknum.
+  size_type hit_probes(size_type bucknum) const {
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    size_type num_probes = 0;
+    size_type probe = hash(get_key(table[bucknum])) & bucket_count_minus_one;
+    while ( probe != bucknum ) {
+      ++num_probes;
+      probe = Probe::next(probe, num_probes, bucket_count_minus_one);
+    }
+    return num_probes + 1;
+  }
+
+  // Number of buckets find() looks at for a missing key hashing to bucknum.
+  size_type miss_probes(size_type bucknum) const {
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    size_type num_probes = 0;
+    while ( !test_empty(bucknum) &&
+            !(Probe::robin_hood && displacement(bucknum) < num_probes) ) {
+      ++num_probes;
+      bucknum = Probe::next(bucknum, num_probes, bucket_count_minus_one);
+    }
+    return num_probes + 1;
+  }
+
  public:
 
   iterator find(const key_type& key) {
+    migrate(resize_step);
     if ( size() == 0 ) return end();
     std::pair<size_type, size_type> pos = find_position(key);
     if ( pos.first == ILLEGAL_BUCKET )     // alas, not there
-      return end();
+      return find_in_old<iterator>(key);
     else
       return iterator(this, table + pos.first, table + num_buckets, false);
   }
@@ -867,7 +1597,7 @@ class dense_hashtable {
     if ( size() == 0 ) return end();
     std::pair<size_type, size_type> pos = find_position(key);
     if ( pos.first == ILLEGAL_BUCKET )     // alas, not there
-      return end();
+      return find_in_old<const_iterator>(key);
     else
       return const_iterator(this, table + pos.first, table+num_buckets, false);
   }
@@ -882,7 +1612,7 @@ class dense_hashtable {
   // Counts how many elements have key key.  For maps, it's either 0 or 1.
   size_type count(const key_type &key) const {
     std::pair<size_type, size_type> pos = find_position(key);
-    return pos.first == ILLEGAL_BUCKET ? 0 : 1;
+    return pos.first != ILLEGAL_BUCKET || find_old(key) != ILLEGAL_BUCKET;
   }
 
   // Likewise, equal_range doesn't really make sense for us.  Oh well.
@@ -906,6 +1636,70 @@ class dense_hashtable {
     }
   }
 
+  // Batched lookups of n keys: out[i] receives find(keys[i]) or
+  // count(keys[i]).  See set_batch_depth().
+  void find_batch(const key_type* keys, size_type n, iterator* out) {
+    // Do the migration the n lookups would have done before resolving
+    // any of them: moving buckets over, or dropping the old table, in
+    // between would leave the iterators already in out dangling.
+    migrate(resize_step > 0 && n > old_num_buckets / resize_step
+            ? old_num_buckets : n * resize_step);
+    if ( size() == 0 ) {
+      std::fill(out, out + n, end());
+      return;
+    }
+    sparsehash_internal::prefetch_pipeline(
+        n, batch_prefetch_depth,
+        [&](size_type i) { return hash(keys[i]); },
+        [&](size_type h) { prefetch_bucket(h); },
+        [](size_type) {},
+        [&](size_type i, size_type h) {
+          const std::pair<size_type, size_type> pos = find_position(keys[i], h);
+          out[i] = pos.first == ILLEGAL_BUCKET
+              ? find_in_old<iterator>(keys[i])
+              : iterator(this, table + pos.first, table + num_buckets, false);
+        });
+  }
+
+  void find_batch(const key_type* keys, size_type n,
+                  const_iterator* out) const {
+    if ( size() == 0 ) {
+      std::fill(out, out + n, end());
+      return;
+    }
+    sparsehash_internal::prefetch_pipeline(
+        n, batch_prefetch_depth,
+        [&](size_type i) { return hash(keys[i]); },
+        [&](size_type h) { prefetch_bucket(h); },
+        [](size_type) {},
+        [&](size_type i, size_type h) {
+          const std::pair<size_type, size_type> pos = find_position(keys[i], h);
+          out[i] = pos.first == ILLEGAL_BUCKET
+              ? find_in_old<const_iterator>(keys[i])
+              : const_iterator(this, table + pos.first, table + num_buckets,
+                               false);
+        });
+  }
+
+  void count_batch(const key_type* keys, size_type n, size_type* out) const {
+    sparsehash_internal::prefetch_pipeline(
+        n, batch_prefetch_depth,
+        [&](size_type i) { return hash(keys[i]); },
+        [&](size_type h) { prefetch_bucket(h); },
+        [](size_type) {},
+        [&](size_type i, size_type h) {
+          out[i] = find_position(keys[i], h).first != ILLEGAL_BUCKET ||
+                   find_old(keys[i]) != ILLEGAL_BUCKET;
+        });
+  }
+
+ private:
+  void prefetch_bucket(size_type key_hash) const {
+    sparsehash_internal::prefetch(table + (key_hash & (bucket_count() - 1)));
+  }
+
+ public:
+
 
   // INSERTION ROUTINES
  private:
@@ -921,31 +1715,104 @@ class dense_hashtable {
       assert( num_deleted > 0);
       --num_deleted;                // used to be, now it isn't
     } else {
+      if ( Probe::robin_hood && !test_empty(pos) )
+        shift_up(pos);              // take the bucket over from its element
       ++num_elements;               // replacing an empty bucket
     }
     set_value(&table[pos], obj);
     return iterator(this, table + pos, table + num_buckets, false);
   }
 
+  // Robin Hood insert: moves the run from bucknum on up by one bucket.
+  // There is always an empty bucket, since we resize before getting full.
+  void shift_up(size_type bucknum) {
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    size_type last = bucknum;
+    while ( !test_empty(last) )
+      last = (last + 1) & bucket_count_minus_one;
+    while ( last != bucknum ) {
+      const size_type prev = (last - 1) & bucket_count_minus_one;
+      set_value(&table[last], table[prev]);
+      last = prev;
+    }
+  }
+
+  // Robin Hood erase: moves the elements following bucknum that are not
+  // in their home bucket back by one, and empties the last bucket moved.
+  // tbl is the table or the old table.
+  void shift_down(pointer tbl, size_type bucket_count_minus_one,
+                  size_type bucknum) {
+    size_type next = (bucknum + 1) & bucket_count_minus_one;
+    while ( !test_empty_value(tbl[next]) &&
+            displacement(tbl, bucket_count_minus_one, next) > 0 ) {
+      set_value(&tbl[bucknum], tbl[next]);
+      bucknum = next;
+      next = (next + 1) & bucket_count_minus_one;
+    }
+    set_value(&tbl[bucknum], val_info.emptyval);
+  }
+
   // If you know *this is big enough to hold obj, use this routine
   std::pair<iterator, bool> insert_noresize(const_reference obj) {
+    return insert_noresize(obj, hash(get_key(obj)));
+  }
+
+  std::pair<iterator, bool> insert_noresize(const_reference obj,
+                                            size_type obj_hash) {
     // First, double-check we're not inserting delkey or emptyval
     assert((!settings.use_empty() || !equals(get_key(obj),
                                              get_key(val_info.emptyval)))
            && "Inserting the empty key");
     assert((!settings.use_deleted() || !equals(get_key(obj), key_info.delkey))
            && "Inserting the deleted key");
-    const std::pair<size_type,size_type> pos = find_position(get_key(obj));
+    const std::pair<size_type,size_type> pos = find_position(get_key(obj),
+                                                             obj_hash);
     if ( pos.first != ILLEGAL_BUCKET) {      // object was already there
       return std::pair<iterator,bool>(iterator(this, table + pos.first,
                                           table + num_buckets, false),
                                  false);          // false: we didn't insert
-    } else {                                 // pos.second says where to put it
-      return std::pair<iterator,bool>(insert_at(obj, pos.second), true);
     }
+    if ( old_table ) {                       // or not moved over yet
+      const iterator old = find_in_old<iterator>(get_key(obj));
+      if ( old != end() )
+        return std::pair<iterator,bool>(old, false);
+    }
+    // pos.second says where to put it
+    return std::pair<iterator,bool>(insert_at(obj, pos.second), true);
   }
 
   // Specializations of insert(it, it) depending on the power of the iterator:
+  // (0) Random access to values of our type, the range may be rehashed
+  //     along with the table on several threads
+  template <class RandomAccessIterator>
+  void insert(RandomAccessIterator f, RandomAccessIterator l,
+              std::random_access_iterator_tag) {
+    insert(f, l, typename base::is_same<value_type,
+               typename std::iterator_traits<RandomAccessIterator>::value_type
+           >::type());
+  }
+
+  template <class RandomAccessIterator>
+  void insert(RandomAccessIterator f, RandomAccessIterator l,
+              base::true_type) {
+    const size_t dist = l - f;
+    if ( num_resize_threads > 1 && !Probe::robin_hood && !old_table &&
+         settings.use_empty() && dist >= size() &&
+         dist < (std::numeric_limits<size_type>::max)() - size() &&
+         settings.min_buckets(size() + dist, bucket_count()) >=
+         parallel_rehash_type::MIN_BUCKETS ) {
+      parallel_insert_range(f, static_cast<size_type>(dist));
+    } else {
+      insert(f, l, std::forward_iterator_tag());
+    }
+  }
+
+  template <class RandomAccessIterator>
+  void insert(RandomAccessIterator f, RandomAccessIterator l,
+              base::false_type) {
+    insert(f, l, std::forward_iterator_tag());
+  }
+
   // (1) Iterator supports operator-, resize before inserting
   template <class ForwardIterator>
   void insert(ForwardIterator f, ForwardIterator l, std::forward_iterator_tag) {
@@ -981,6 +1848,22 @@ class dense_hashtable {
            typename std::iterator_traits<InputIterator>::iterator_category());
   }
 
+  // Inserts n values like insert(f, f + n), resizing once for all of
+  // them first.  Unless inserted is NULL, inserted[i] tells whether
+  // objs[i] went in or was there already.  See set_batch_depth().
+  void insert_batch(const value_type* objs, size_type n, bool* inserted) {
+    resize_delta(n);
+    sparsehash_internal::prefetch_pipeline(
+        n, batch_prefetch_depth,
+        [&](size_type i) { return hash(get_key(objs[i])); },
+        [&](size_type h) { prefetch_bucket(h); },
+        [](size_type) {},
+        [&](size_type i, size_type h) {
+          const bool b = insert_noresize(objs[i], h).second;
+          if ( inserted ) inserted[i] = b;
+        });
+  }
+
   // DefaultValue is a functor that takes a key and returns a value_type
   // representing the default value to be inserted if none is found.
   template <class DefaultValue>
@@ -991,9 +1874,13 @@ class dense_hashtable {
     assert((!settings.use_deleted() || !equals(key, key_info.delkey))
            && "Inserting the deleted key");
     const std::pair<size_type,size_type> pos = find_position(key);
+    const size_type old_bucknum =
+        pos.first == ILLEGAL_BUCKET ? find_old(key) : ILLEGAL_BUCKET;
     DefaultValue default_value;
     if ( pos.first != ILLEGAL_BUCKET) {  // object was already there
       return table[pos.first];
+    } else if ( old_bucknum != ILLEGAL_BUCKET ) {  // not moved over yet
+      return old_table[old_bucknum];
     } else if (resize_delta(1)) {        // needed to rehash to make room
       // Since we resized, we can't use pos, so recalculate where to insert.
       return *insert_noresize(default_value(key)).first;
@@ -1013,9 +1900,7 @@ class dense_hashtable {
     const_iterator pos = find(key);   // shrug: shouldn't need to be const
     if ( pos != end() ) {
       assert(!test_deleted(pos));  // or find() shouldn't have returned it
-      set_deleted(pos);
-      ++num_deleted;
-      settings.set_consider_shrink(true); // will think about shrink after next insert
+      erase_at(pos);
       return 1;                    // because we deleted one thing
     } else {
       return 0;                    // because we deleted nothing
@@ -1025,18 +1910,17 @@ class dense_hashtable {
   // We return the iterator past the deleted item.
   void erase(iterator pos) {
     if ( pos == end() ) return;    // sanity check
-    if ( set_deleted(pos) ) {      // true if object has been newly deleted
-      ++num_deleted;
-      settings.set_consider_shrink(true); // will think about shrink after next insert
-    }
+    erase_at(pos);
   }
 
   void erase(iterator f, iterator l) {
+    if ( Probe::robin_hood ) {
+      erase_keys(f, l);
+      return;
+    }
     for ( ; f != l; ++f) {
-      if ( set_deleted(f)  )       // should always be true
-        ++num_deleted;
+      erase_at(f);
     }
-    settings.set_consider_shrink(true); // will think about shrink after next insert
   }
 
   // We allow you to erase a const_iterator just like we allow you to
@@ -1046,19 +1930,55 @@ class dense_hashtable {
   // if it's const or not.
   void erase(const_iterator pos) {
     if ( pos == end() ) return;    // sanity check
-    if ( set_deleted(pos) ) {      // true if object has been newly deleted
-      ++num_deleted;
-      settings.set_consider_shrink(true); // will think about shrink after next insert
-    }
+    erase_at(pos);
   }
   void erase(const_iterator f, const_iterator l) {
+    if ( Probe::robin_hood ) {
+      erase_keys(f, l);
+      return;
+    }
     for ( ; f != l; ++f) {
-      if ( set_deleted(f)  )       // should always be true
+      erase_at(f);
+    }
+  }
+
+ private:
+  // Erases what pos points to, which may be in the old table.
+  template <class Iterator>
+  void erase_at(Iterator pos) {
+    const bool in_old = old_table && pos.end == old_table + old_num_buckets;
+    if ( Probe::robin_hood ) {
+      if ( in_old ) {
+        shift_down(old_table, old_num_buckets - 1, pos.pos - old_table);
+        --old_size;
+      } else {
+        shift_down(table, num_buckets - 1, pos.pos - table);
+        --num_elements;
+      }
+    } else if ( set_deleted(pos) ) {  // true if object has been newly deleted
+      if ( in_old ) {
+        --old_size;
+        ++old_num_deleted;
+      } else {
         ++num_deleted;
+      }
     }
-    settings.set_consider_shrink(true);   // will think about shrink after next insert
+    settings.set_consider_shrink(true); // will think about shrink after next insert
   }
 
+  // Robin Hood erase moves elements around, so for a range we collect
+  // the keys first.
+  template <class Iterator>
+  void erase_keys(Iterator f, Iterator l) {
+    std::vector<typename base::remove_const<key_type>::type> keys;
+    for ( ; f != l; ++f)
+      keys.push_back(get_key(*f));
+    for ( size_type i = 0; i < keys.size(); ++i)
+      erase(keys[i]);
+  }
+
+ public:
+
 
   // COMPARISON
   bool operator==(const dense_hashtable& ht) const {
@@ -1236,6 +2156,9 @@ class dense_hashtable {
   }
 
  private:
+  typedef sparsehash_internal::parallel_rehash<size_type, const_pointer>
+      parallel_rehash_type;
+
   // Actual data
   Settings settings;
   KeyInfo key_info;
@@ -1245,21 +2168,40 @@ class dense_hashtable {
   size_type num_buckets;
   ValInfo val_info;       // holds emptyval, and also the allocator
   pointer table;
+
+  // Incremental resize: buckets moved per operation, 0 if off, and the
+  // table being moved out of.  Its buckets before old_pos are moved,
+  // old_size elements are left, old_num_deleted buckets are deleted.
+  size_type resize_step;
+  size_type num_resize_threads;   // threads to rehash on, 1 by default
+  size_type batch_prefetch_depth; // keys the batched calls prefetch ahead
+  pointer old_table;
+  size_type old_num_buckets;
+  size_type old_pos;
+  size_type old_size;
+  size_type old_num_deleted;
+  // The table to grow into next, spare_filled buckets of it are empty.
+  pointer spare_table;
+  size_type spare_num_buckets;
+  size_type spare_filled;
+  // The memory of the old table of a compaction, not given back yet.
+  pointer retired_table;
+  size_type retired_num_buckets;
 };
 
 
 // We need a global swap as well
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
-inline void swap(dense_hashtable<V,K,HF,ExK,SetK,EqK,A> &x,
-                 dense_hashtable<V,K,HF,ExK,SetK,EqK,A> &y) {
+template <class V, class K, class HF, class ExK, class SetK, class EqK, class A,
+          class P>
+inline void swap(dense_hashtable<V,K,HF,ExK,SetK,EqK,A,P> &x,
+                 dense_hashtable<V,K,HF,ExK,SetK,EqK,A,P> &y) {
   x.swap(y);
 }
 
-#undef JUMP_
-
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
-const typename dense_hashtable<V,K,HF,ExK,SetK,EqK,A>::size_type
-  dense_hashtable<V,K,HF,ExK,SetK,EqK,A>::ILLEGAL_BUCKET;
+template <class V, class K, class HF, class ExK, class SetK, class EqK, class A,
+          class P>
+const typename dense_hashtable<V,K,HF,ExK,SetK,EqK,A,P>::size_type
+  dense_hashtable<V,K,HF,ExK,SetK,EqK,A,P>::ILLEGAL_BUCKET;
 
 // How full we let the table get before we resize.  Knuth says .8 is
 // good -- higher causes us to probe too much, though saves memory.
@@ -1267,15 +2209,17 @@ const typename dense_hashtable<V,K,HF,ExK,SetK,EqK,A>::size_type
 // more space (a trade-off densehashtable explicitly chooses to make).
 // Feel free to play around with different values, though, via
 // max_load_factor() and/or set_resizing_parameters().
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
-const int dense_hashtable<V,K,HF,ExK,SetK,EqK,A>::HT_OCCUPANCY_PCT = 50;
+template <class V, class K, class HF, class ExK, class SetK, class EqK, class A,
+          class P>
+const int dense_hashtable<V,K,HF,ExK,SetK,EqK,A,P>::HT_OCCUPANCY_PCT = 50;
 
 // How empty we let the table get before we resize lower.
 // It should be less than OCCUPANCY_PCT / 2 or we thrash resizing.
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
-const int dense_hashtable<V,K,HF,ExK,SetK,EqK,A>::HT_EMPTY_PCT
+template <class V, class K, class HF, class ExK, class SetK, class EqK, class A,
+          class P>
+const int dense_hashtable<V,K,HF,ExK,SetK,EqK,A,P>::HT_EMPTY_PCT
   = static_cast<int>(0.4 *
-                     dense_hashtable<V,K,HF,ExK,SetK,EqK,A>::HT_OCCUPANCY_PCT);
+                   dense_hashtable<V,K,HF,ExK,SetK,EqK,A,P>::HT_OCCUPANCY_PCT);
 
 _END_GOOGLE_NAMESPACE_
 
@@ -36,6 +36,12 @@
 //
 // Other functions and classes provide common code for serializing
 // and deserializing hashtables to a stream (such as a FILE*).
+//
+// parallel_rehash has the parts of rehashing on several threads that
+// do not depend on how a table stores its buckets.
+//
+// probe_statistics and probe_counter describe how well the hash spreads
+// the keys over the buckets of an open addressing table.
 
 #ifndef UTIL_GTL_HASHTABLE_COMMON_H_
 #define UTIL_GTL_HASHTABLE_COMMON_H_
@@ -44,8 +50,16 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stddef.h>                  // for size_t
+#include <algorithm>                 // for max
+#include <exception>                 // for exception_ptr
 #include <iosfwd>
 #include <stdexcept>                 // For length_error
+#include <thread>
+#include <utility>                   // for pair
+#include <vector>
+#ifdef _MSC_VER
+#include <xmmintrin.h>               // for _mm_prefetch
+#endif
 
 _START_GOOGLE_NAMESPACE_
 
@@ -373,6 +387,302 @@ class sh_hashtable_settings : public HashFunc {
   unsigned int num_ht_copies_;
 };
 
+// Calls fn(t) for every t in [0, threads), each on a thread of its own;
+// the calling thread takes t == 0.  The first exception thrown by any
+// of the calls is rethrown once all of them are done.
+template <typename Fn>
+void run_on_threads(size_t threads, const Fn& fn) {
+  std::vector<std::exception_ptr> errors(threads);
+  std::vector<std::thread> workers;
+  for (size_t t = 1; t < threads; ++t) {
+    workers.push_back(std::thread([&fn, &errors, t]() {
+      try {
+        fn(t);
+      } catch (...) {
+        errors[t] = std::current_exception();
+      }
+    }));
+  }
+  try {
+    fn(0);
+  } catch (...) {
+    errors[0] = std::current_exception();
+  }
+  for (size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+  for (size_t t = 0; t < threads; ++t) {
+    if (errors[t])
+      std::rethrow_exception(errors[t]);
+  }
+}
+
+// Rehashing on several threads without locks.  The buckets of the new
+// table are split into regions, a few per thread, each a multiple of
+// granularity buckets, so that a region can be made of whole groups of
+// a sparsetable.  scatter() splits the source into a slice per thread,
+// which hashes its values into one list per region.  place() gives
+// every region to one thread, which hands the lists of all threads for
+// the region, in source order, to the table to put in its buckets.
+// Only that thread touches the buckets of the region.  A value whose
+// probe sequence leaves its region is put aside instead, for the
+// caller to insert once all threads are done.
+//
+// Values equal to one seen before have the same home bucket, so they
+// go through the same thread in source order, and the first one wins
+// as it would with a plain loop of inserts.
+template <typename SizeType, typename Pointer>
+class parallel_rehash {
+ public:
+  typedef SizeType size_type;
+  typedef std::pair<size_type, Pointer> entry;   // bucket, value
+
+  // Tables with fewer buckets are rehashed on one thread: starting
+  // the others would take longer than the work they save.
+  static const size_type MIN_BUCKETS = 1 << 16;
+  // The smallest region, which keeps the share of values put aside
+  // because their probe sequence crosses its end small.
+  static const size_type MIN_REGION = 1 << 12;
+
+  parallel_rehash(size_type threads, size_type num_buckets,
+                  size_type granularity)
+      : threads_(threads), region_size_(granularity) {
+    const size_type target = num_buckets / (threads * 8);
+    while ( region_size_ < num_buckets &&
+            (region_size_ < MIN_REGION || region_size_ * 2 <= target) )
+      region_size_ *= 2;
+    regions_ = (num_buckets + region_size_ - 1) / region_size_;
+    lists_.resize(threads_ * regions_);
+    deferred_.resize(threads_);
+  }
+
+  size_type threads() const { return threads_; }
+
+  // Calls source(i, &e) for i in [0, n): if it returns true, e is a
+  // value to insert with its home bucket.
+  template <typename Source>
+  void scatter(size_type n, const Source& source) {
+    run_on_threads(threads_, [&](size_t t) {
+      entry e;
+      const size_type last = n / threads_ * (t + 1) +
+          (t + 1 == threads_ ? n % threads_ : 0);
+      for ( size_type i = n / threads_ * t; i < last; ++i ) {
+        if ( source(i, &e) )
+          lists_[t * regions_ + e.first / region_size_].push_back(e);
+      }
+    });
+  }
+
+  // Calls place(t, &e, begin, end) for every value, on the thread t
+  // owning the region [begin, end) of its home bucket.  If it returns
+  // false, the probe sequence left the region: the value is put aside
+  // and its entry gets a NULL value.  place() may set the value to NULL
+  // itself to drop it.
+  template <typename Place>
+  void place(const Place& place) {
+    run_on_threads(threads_, [&](size_t t) {
+      for ( size_type r = t; r < regions_; r += threads_ ) {
+        const size_type begin = r * region_size_;
+        const size_type end = begin + region_size_;
+        for ( size_type u = 0; u < threads_; ++u ) {
+          std::vector<entry>& list = lists_[u * regions_ + r];
+          for ( size_type i = 0; i < list.size(); ++i ) {
+            if ( !place(t, &list[i], begin, end) ) {
+              deferred_[t].push_back(list[i]);
+              list[i].second = Pointer();
+            }
+          }
+        }
+      }
+    });
+  }
+
+  // Calls visit(e) again for every value place() took, each region on
+  // the thread that placed it.
+  template <typename Visit>
+  void visit(const Visit& visit) {
+    run_on_threads(threads_, [&](size_t t) {
+      for ( size_type r = t; r < regions_; r += threads_ ) {
+        for ( size_type u = 0; u < threads_; ++u ) {
+          const std::vector<entry>& list = lists_[u * regions_ + r];
+          for ( size_type i = 0; i < list.size(); ++i ) {
+            if ( list[i].second )
+              visit(list[i]);
+          }
+        }
+      }
+    });
+  }
+
+  // The values put aside by place(), values equal to each other in
+  // source order.
+  template <typename Insert>
+  void insert_deferred(const Insert& insert) const {
+    for ( size_type t = 0; t < threads_; ++t ) {
+      for ( size_type i = 0; i < deferred_[t].size(); ++i )
+        insert(deferred_[t][i]);
+    }
+  }
+
+ private:
+  size_type threads_;
+  size_type region_size_;
+  size_type regions_;
+  std::vector<std::vector<entry> > lists_;    // [thread * regions_ + region]
+  std::vector<std::vector<entry> > deferred_;  // by thread
+};
+
+// Asks for the cache line holding p ahead of a read.  Only a hint: p may
+// point anywhere, even to memory that is no longer allocated.
+inline void prefetch(const void* p) {
+#if defined(_MSC_VER)
+  _mm_prefetch(static_cast<const char*>(p), _MM_HINT_T0);
+#elif defined(__GNUC__)
+  __builtin_prefetch(p);
+#endif
+}
+
+// The pipeline of the batched lookups and inserts.  Each call takes one
+// cache miss on a random bucket, which a loop of plain calls takes one
+// after the other.  Here fn(i, h) gets the hash h = hash(i) of key i,
+// computed depth keys before, when far(h) started to fetch what the
+// lookup reads first; near(h) runs depth / 2 keys before fn, for tables
+// that find their bucket through what far() fetched.  So up to depth
+// misses overlap.
+static const size_t MAX_BATCH_DEPTH = 64;
+static const size_t DEFAULT_BATCH_DEPTH = 16;
+
+template <typename SizeType, typename Hash, typename Far, typename Near,
+          typename Fn>
+void prefetch_pipeline(SizeType n, SizeType depth, const Hash& hash,
+                       const Far& far, const Near& near, const Fn& fn) {
+  SizeType ring[MAX_BATCH_DEPTH];          // hashes of keys [i, i + depth)
+  if ( depth > MAX_BATCH_DEPTH ) depth = MAX_BATCH_DEPTH;
+  if ( depth > n ) depth = n;
+  if ( depth < 1 ) depth = 1;
+  const SizeType half = depth / 2;
+  for ( SizeType j = 0; j < depth && j < n; ++j ) {
+    ring[j] = hash(j);
+    far(ring[j]);
+  }
+  for ( SizeType j = 0; j < half; ++j )
+    near(ring[j]);
+  SizeType slot = 0;
+  SizeType near_slot = half;
+  for ( SizeType i = 0; i < n; ++i ) {
+    const SizeType h = ring[slot];
+    if ( half > 0 && i + half < n )
+      near(ring[near_slot]);
+    if ( i + depth < n ) {
+      ring[slot] = hash(i + depth);
+      far(ring[slot]);
+    }
+    fn(i, h);
+    if ( ++slot == depth ) slot = 0;
+    if ( ++near_slot == depth ) near_slot = 0;
+  }
+}
+
+// What probe_stats() of dense and sparse hashtables reports.  Probe
+// lengths are in buckets looked at by find(): for a hit, over all
+// elements, and for a miss, over all home buckets a key can hash to.  A
+// cluster is a run of non-empty buckets, deleted ones included, in bucket
+// order.  home_variance is the variance of the number of elements per
+// home bucket, whose mean is the load factor; for a good hash it is
+// close to the load factor too.
+template <typename SizeType>
+struct probe_statistics {
+  double hit_mean;
+  double hit_variance;
+  SizeType hit_max;
+  double miss_mean;
+  double miss_variance;
+  SizeType miss_max;
+  double cluster_mean;
+  SizeType cluster_max;
+  double home_variance;
+};
+
+// Sums up a walk over all buckets of a table, in bucket order.  Keeps a
+// count per bucket, so it is meant for diagnostics only.
+template <typename SizeType>
+class probe_counter {
+ public:
+  typedef SizeType size_type;
+
+  explicit probe_counter(size_type num_buckets)
+      : homes_(num_buckets), hits_(0), hit_sum_(0), hit_squares_(0),
+        misses_(0), miss_sum_(0), miss_squares_(0), clusters_(0),
+        cluster_sum_(0), run_(0), stats_() {
+  }
+
+  // An element found with probes buckets looked at, hashing to home.
+  void hit(size_type probes, size_type home) {
+    ++hits_;
+    hit_sum_ += probes;
+    hit_squares_ += static_cast<double>(probes) * probes;
+    stats_.hit_max = (std::max)(stats_.hit_max, probes);
+    ++homes_[home];
+  }
+  // A missing key hashing to the bucket, found absent after probes.
+  void miss(size_type probes) {
+    ++misses_;
+    miss_sum_ += probes;
+    miss_squares_ += static_cast<double>(probes) * probes;
+    stats_.miss_max = (std::max)(stats_.miss_max, probes);
+  }
+  // The next bucket, in order.
+  void bucket(bool empty) {
+    if ( !empty ) {
+      ++run_;
+    } else {
+      end_cluster();
+    }
+  }
+
+  probe_statistics<size_type> result() {
+    end_cluster();
+    probe_statistics<size_type> stats = stats_;
+    if ( hits_ > 0 ) {
+      stats.hit_mean = hit_sum_ / hits_;
+      stats.hit_variance = hit_squares_ / hits_ - stats.hit_mean * stats.hit_mean;
+    }
+    if ( misses_ > 0 ) {
+      stats.miss_mean = miss_sum_ / misses_;
+      stats.miss_variance =
+          miss_squares_ / misses_ - stats.miss_mean * stats.miss_mean;
+    }
+    if ( clusters_ > 0 )
+      stats.cluster_mean = cluster_sum_ / clusters_;
+    if ( !homes_.empty() ) {
+      double squares = 0;
+      for ( size_type i = 0; i < homes_.size(); ++i )
+        squares += static_cast<double>(homes_[i]) * homes_[i];
+      const double mean = static_cast<double>(hits_) / homes_.size();
+      stats.home_variance = squares / homes_.size() - mean * mean;
+    }
+    return stats;
+  }
+
+ private:
+  void end_cluster() {
+    if ( run_ == 0 ) return;
+    ++clusters_;
+    cluster_sum_ += run_;
+    stats_.cluster_max = (std::max)(stats_.cluster_max, run_);
+    run_ = 0;
+  }
+
+  std::vector<unsigned> homes_;        // elements per home bucket
+  size_type hits_;
+  double hit_sum_, hit_squares_;
+  size_type misses_;
+  double miss_sum_, miss_squares_;
+  size_type clusters_;
+  double cluster_sum_;
+  size_type run_;                      // length of the current cluster
+  probe_statistics<size_type> stats_;  // the maxima so far
+};
+
 }  // namespace sparsehash_internal
 
 #undef SPARSEHASH_COMPILE_ASSERT
@@ -130,6 +130,28 @@ public:
   static constexpr bool value = value_type::value;
 };
 
+// Whether A::reallocate() grows a large block without copying it, as
+// mmap_allocator_with_realloc does.  Such allocators say so with a
+// static const bool reallocates_in_place member.
+template<typename A, typename = void>
+struct has_in_place_reallocate : std::false_type {};
+
+template<typename A>
+struct has_in_place_reallocate<
+    A, typename std::enable_if<A::reallocates_in_place>::type>
+    : std::true_type {};
+
+// Whether a sparsetable with allocator A keeps the arrays of its groups in
+// a sparsegroup_arena, as with arena_allocator_with_realloc.  Such
+// allocators say so with a static const bool uses_group_arena member.
+template<typename A, typename = void>
+struct has_group_arena : std::false_type {};
+
+template<typename A>
+struct has_group_arena<
+    A, typename std::enable_if<A::uses_group_arena>::type>
+    : std::true_type {};
+
 template <class A>
 class alloc_impl : public A {
 public:
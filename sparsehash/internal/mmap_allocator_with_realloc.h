@@ -0,0 +1,254 @@
+// An allocator for the bucket arrays of very large hashtables:
+//
+//   google::dense_hash_set<int64_t, SPARSEHASH_HASH<int64_t>,
+//                          std::equal_to<int64_t>,
+//                          google::mmap_allocator_with_realloc<int64_t> > s;
+//
+// Blocks of MMAP_THRESHOLD bytes or more are anonymous memory mappings of
+// their own, smaller ones come from malloc as with
+// libc_allocator_with_realloc.  reallocate() grows a mapping with
+// mremap(MREMAP_MAYMOVE), which moves the pages rather than copying them
+// however large the block is, and shrinks it in place, which gives the
+// pages past the new end back to the OS.  A dense_hashtable with this
+// allocator also rehashes in place when it grows, so it never holds the
+// old and the new bucket array at the same time, see densehashtable.h.
+//
+// With Populate the pages of a mapping are faulted in when it is made or
+// grown, rather than on first touch.  With HugePages mappings are rounded
+// up to 2 MB and backed by transparent huge pages, which saves TLB misses
+// on tables much larger than the cache.
+//
+// Only values which are trivially copyable are moved by realloc() or
+// mremap().  reallocate() move constructs any others into a new block,
+// so for them reallocates_in_place is false.
+//
+// Only Linux has mremap(); elsewhere all blocks come from malloc.
+
+#ifndef UTIL_GTL_MMAP_ALLOCATOR_WITH_REALLOC_H_
+#define UTIL_GTL_MMAP_ALLOCATOR_WITH_REALLOC_H_
+
+#include <sparsehash/internal/sparseconfig.h>
+#include <stdlib.h>           // for malloc/realloc/free
+#include <stddef.h>           // for ptrdiff_t
+#include <string.h>           // for memcpy
+#include <new>                // for placement new
+#include <type_traits>        // for is_trivially_copyable
+#include <utility>            // for move
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+_START_GOOGLE_NAMESPACE_
+
+template<class T, bool Populate = false, bool HugePages = false>
+class mmap_allocator_with_realloc {
+ public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+
+  // Blocks of at least this many bytes are mapped.
+  static const size_t MMAP_THRESHOLD = 1 << 20;
+  // See has_in_place_reallocate in libc_allocator_with_realloc.h.
+  static const bool reallocates_in_place =
+      std::is_trivially_copyable<T>::value;
+
+  mmap_allocator_with_realloc() {}
+  mmap_allocator_with_realloc(const mmap_allocator_with_realloc&) {}
+  ~mmap_allocator_with_realloc() {}
+
+  pointer address(reference r) const  { return &r; }
+  const_pointer address(const_reference r) const  { return &r; }
+
+  pointer allocate(size_type n, const_pointer = 0) {
+    const size_t bytes = n * sizeof(value_type);
+    if ( !is_mapped(bytes) )
+      return static_cast<pointer>(malloc(bytes));
+    return static_cast<pointer>(map(bytes));
+  }
+  void deallocate(pointer p, size_type n) {
+    const size_t bytes = n * sizeof(value_type);
+    if ( !is_mapped(bytes) ) {
+      free(p);
+    } else if ( p != NULL ) {
+      unmap(p, bytes);
+    }
+  }
+  // Like realloc(), returns NULL and leaves p as it was on failure.  A
+  // block which crosses MMAP_THRESHOLD is copied.  Unless T is trivially
+  // copyable, the first min(n, old_n) values must be constructed.
+  pointer reallocate(pointer p, size_type n, size_type old_n) {
+    return reallocate(p, n, old_n, std::is_trivially_copyable<T>());
+  }
+
+  size_type max_size() const  {
+    return static_cast<size_type>(-1) / sizeof(value_type);
+  }
+
+  void construct(pointer p, const value_type& val) {
+    new(p) value_type(val);
+  }
+  void destroy(pointer p) { p->~value_type(); }
+
+  template <class U>
+  mmap_allocator_with_realloc(
+      const mmap_allocator_with_realloc<U, Populate, HugePages>&) {}
+
+  template<class U>
+  struct rebind {
+    typedef mmap_allocator_with_realloc<U, Populate, HugePages> other;
+  };
+
+ private:
+  pointer reallocate(pointer p, size_type n, size_type old_n,
+                     std::true_type) {
+    const size_t bytes = n * sizeof(value_type);
+    const size_t old_bytes = old_n * sizeof(value_type);
+    if ( p == NULL )
+      return allocate(n);
+    if ( !is_mapped(bytes) && !is_mapped(old_bytes) )
+      return static_cast<pointer>(realloc(p, bytes));
+    if ( is_mapped(bytes) && is_mapped(old_bytes) )
+      return static_cast<pointer>(remap(p, old_bytes, bytes));
+    pointer retval = allocate(n);
+    if ( retval != NULL ) {
+      memcpy(retval, p, bytes < old_bytes ? bytes : old_bytes);
+      deallocate(p, old_n);
+    }
+    return retval;
+  }
+
+  // Values which may not be moved bytewise are moved one by one.
+  pointer reallocate(pointer p, size_type n, size_type old_n,
+                     std::false_type) {
+    if ( p == NULL )
+      return allocate(n);
+    pointer retval = allocate(n);
+    if ( retval != NULL ) {
+      const size_type count = n < old_n ? n : old_n;
+      for ( size_type i = 0; i < count; ++i ) {
+        new(retval + i) value_type(std::move(p[i]));
+        p[i].~value_type();
+      }
+      deallocate(p, old_n);
+    }
+    return retval;
+  }
+
+  static bool is_mapped(size_t bytes) {
+#ifdef __linux__
+    return bytes >= MMAP_THRESHOLD;
+#else
+    (void)bytes;
+    return false;
+#endif
+  }
+
+#ifdef __linux__
+  // Mappings are whole pages, or whole 2 MB huge pages.
+  static size_t map_length(size_t bytes) {
+    const size_t page = HugePages ? size_t(2) << 20
+                                  : static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return (bytes + page - 1) / page * page;
+  }
+
+  static void* map(size_t bytes) {
+    const size_t length = map_length(bytes);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+    if ( Populate && !HugePages )  // huge pages are populated once advised
+      flags |= MAP_POPULATE;
+#endif
+    void* p = mmap(NULL, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if ( p == MAP_FAILED )
+      return NULL;
+    advise(p, 0, length);
+    return p;
+  }
+
+  static void unmap(void* p, size_t bytes) {
+    munmap(p, map_length(bytes));
+  }
+
+  static void* remap(void* p, size_t old_bytes, size_t bytes) {
+    const size_t old_length = map_length(old_bytes);
+    const size_t length = map_length(bytes);
+    if ( length == old_length )
+      return p;
+    // Shrinking stays in place and unmaps the tail, growing moves the
+    // page table entries if the mapping cannot be extended where it is.
+    void* retval = mremap(p, old_length, length,
+                          length > old_length ? MREMAP_MAYMOVE : 0);
+    if ( retval == MAP_FAILED )
+      return NULL;
+    if ( length > old_length )
+      advise(retval, old_length, length);
+    return retval;
+  }
+
+  // Huge pages for [first, last) of a new or grown mapping, then its pages.
+  static void advise(void* p, size_t first, size_t last) {
+    char* start = static_cast<char*>(p) + first;
+#ifdef MADV_HUGEPAGE
+    if ( HugePages )
+      madvise(start, last - first, MADV_HUGEPAGE);
+#endif
+    if ( Populate && (HugePages || first > 0) ) {
+#ifdef MADV_POPULATE_WRITE
+      madvise(start, last - first, MADV_POPULATE_WRITE);
+#else
+      const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+      for ( size_t i = 0; i < last - first; i += page )
+        start[i] = 0;                      // fresh anonymous memory is zero
+#endif
+    }
+  }
+#else
+  static void* map(size_t) { return NULL; }
+  static void unmap(void*, size_t) {}
+  static void* remap(void*, size_t, size_t) { return NULL; }
+#endif
+};
+
+template<class T, bool P, bool H>
+const size_t mmap_allocator_with_realloc<T, P, H>::MMAP_THRESHOLD;
+template<class T, bool P, bool H>
+const bool mmap_allocator_with_realloc<T, P, H>::reallocates_in_place;
+
+// mmap_allocator_with_realloc<void> specialization.
+template<bool Populate, bool HugePages>
+class mmap_allocator_with_realloc<void, Populate, HugePages> {
+ public:
+  typedef void value_type;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  typedef void* pointer;
+  typedef const void* const_pointer;
+
+  template<class U>
+  struct rebind {
+    typedef mmap_allocator_with_realloc<U, Populate, HugePages> other;
+  };
+};
+
+template<class T, bool P, bool H>
+inline bool operator==(const mmap_allocator_with_realloc<T, P, H>&,
+                       const mmap_allocator_with_realloc<T, P, H>&) {
+  return true;
+}
+
+template<class T, bool P, bool H>
+inline bool operator!=(const mmap_allocator_with_realloc<T, P, H>&,
+                       const mmap_allocator_with_realloc<T, P, H>&) {
+  return false;
+}
+
+_END_GOOGLE_NAMESPACE_
+
+#endif  // UTIL_GTL_MMAP_ALLOCATOR_WITH_REALLOC_H_
@@ -89,6 +89,37 @@
 //    probes/successful lookup    1.06  1.5   1.75  2.5   3.0   5.5   50.5
 //    probes/unsuccessful lookup  1.12  2.5   3.6   8.5   13.0  50.0  5000.0
 //
+// With set_resize_threads(n), big tables are rehashed on n threads when
+// they grow or are copied, and so is a range passed to insert() along
+// with the table when the range is at least as big as the table.  The
+// hasher, key_equal and copy constructor of the values are then called
+// from several threads at once, and the old table is only freed once
+// the new one is done instead of group by group.
+//
+// find_batch(), count_batch() and insert_batch() look up or insert an
+// array of keys or values.  They hash set_batch_depth(n) keys ahead of
+// the one they resolve and prefetch the group of its home bucket, then
+// n / 2 keys ahead the value slot the group points to, so that the
+// cache misses of up to n lookups overlap.
+//
+// compact(budget) does while the table is idle what an insert would do
+// after a wave of erases: it rehashes the table to drop the deleted
+// buckets, into a smaller table if it is below the shrink threshold.
+// The values are copied to a new table a slice at a time until budget
+// is spent, and the new table takes over once all are there, so it can
+// be called again and again in the gaps between bursts of requests.
+// Lookups keep going to the old table meanwhile.  Anything that may
+// change a value voids the copy, and the next call starts over: not
+// only inserts, erases and clear(), but also the non-const begin(),
+// find() and find_or_insert(), which a sparse_hash_map uses to hand out
+// values one can assign to.  The old table is then freed a slice of
+// groups at a time as well, except that with an arena its slabs go at
+// once.  debris_ratio() tells how much there is to do.
+//
+// With arena_allocator_with_realloc the arrays of the groups come from
+// slabs of the table's own, see arena_allocator_with_realloc.h.  A table
+// which grows takes over the slabs of the old one as it empties them.
+//
 // The value type is required to be copy constructible and default
 // constructible, but it need not be (and commonly isn't) assignable.
 
@@ -98,6 +129,7 @@
 #include <sparsehash/internal/sparseconfig.h>
 #include <assert.h>
 #include <algorithm>                 // For swap(), eg
+#include <chrono>                    // for compact()'s budget
 #include <iterator>                  // for iterator tags
 #include <limits>                    // for numeric_limits
 #include <utility>                   // for pair
@@ -372,9 +404,15 @@ class sparse_hashtable {
   // at least HT_MIN_BUCKETS.
   static const size_type HT_DEFAULT_STARTING_BUCKETS = 32;
 
+  // How many buckets compact() copies, or groups of the new table it
+  // builds or of the old table it frees, between looks at the clock.
+  static const size_type HT_COMPACT_STEP = 256;
+
   // ITERATOR FUNCTIONS
-  iterator begin()             { return iterator(this, table.nonempty_begin(),
-                                                 table.nonempty_end()); }
+  iterator begin() {
+    drop_compaction();                     // hands out assignable values
+    return iterator(this, table.nonempty_begin(), table.nonempty_end());
+  }
   iterator end()               { return iterator(this, table.nonempty_end(),
                                                  table.nonempty_end()); }
   const_iterator begin() const { return const_iterator(this,
@@ -390,6 +428,7 @@ class sparse_hashtable {
   // bucket n to be the n-th element of the sparsetable, if it's occupied,
   // or some empty element, otherwise.
   local_iterator begin(size_type i) {
+    drop_compaction();
     if (table.test(i))
       return local_iterator(this, table.get_iter(i), table.nonempty_end());
     else
@@ -418,6 +457,7 @@ class sparse_hashtable {
 
   // This is used when resizing
   destructive_iterator destructive_begin() {
+    drop_compaction();
     return destructive_iterator(this, table.destructive_begin(),
                                 table.destructive_end());
   }
@@ -435,6 +475,49 @@ class sparse_hashtable {
   // Accessor function for statistics gathering.
   int num_table_copies() const { return settings.num_ht_copies(); }
 
+  // Probe lengths, cluster sizes and elements per home bucket, see
+  // probe_statistics in hashtable-common.h.
+  typedef sparsehash_internal::probe_statistics<size_type> probe_statistics;
+
+  // Walks the whole table, so this is meant for diagnostics only.
+  probe_statistics probe_stats() const {
+    const size_type num_buckets = bucket_count();
+    sparsehash_internal::probe_counter<size_type> counter(num_buckets);
+    for ( size_type bucknum = 0; bucknum < num_buckets; ++bucknum ) {
+      if ( table.test(bucknum) && !test_deleted(bucknum) )
+        counter.hit(hit_probes(bucknum),
+                    hash(get_key(table.unsafe_get(bucknum))) & (num_buckets - 1));
+      counter.miss(miss_probes(bucknum));
+      counter.bucket(!table.test(bucknum));
+    }
+    return counter.result();
+  }
+
+ private:
+  // Number of buckets find() looks at to find the element in bucknum.
+  size_type hit_probes(size_type bucknum) const {
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    size_type num_probes = 0;
+    size_type probe = hash(get_key(table.unsafe_get(bucknum))) &
+                      bucket_count_minus_one;
+    while ( probe != bucknum ) {
+      ++num_probes;
+      probe = (probe + JUMP_(key, num_probes)) & bucket_count_minus_one;
+    }
+    return num_probes + 1;
+  }
+
+  // Number of buckets find() looks at for a missing key hashing to bucknum.
+  size_type miss_probes(size_type bucknum) const {
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    size_type num_probes = 0;
+    while ( table.test(bucknum) ) {
+      ++num_probes;
+      bucknum = (bucknum + JUMP_(key, num_probes)) & bucket_count_minus_one;
+    }
+    return num_probes + 1;
+  }
+
  private:
   // We need to copy values when we set the special marker for deleted
   // elements, but, annoyingly, we can't just use the copy assignment
@@ -526,6 +609,7 @@ class sparse_hashtable {
   // TODO(csilvers): make these private (also in densehashtable.h)
   bool set_deleted(iterator &it) {
     check_use_deleted("set_deleted()");
+    drop_compaction();
     bool retval = !test_deleted(it);
     // &* converts from iterator to value-type.
     set_key(&(*it), key_info.delkey);
@@ -545,6 +629,7 @@ class sparse_hashtable {
   // really matter.
   bool set_deleted(const_iterator &it) {
     check_use_deleted("set_deleted()");
+    drop_compaction();
     bool retval = !test_deleted(it);
     set_key(const_cast<pointer>(&(*it)), key_info.delkey);
     return retval;
@@ -581,6 +666,19 @@ class sparse_hashtable {
     assert(bucket_count() >= HT_MIN_BUCKETS);
     bool retval = false;
 
+    const size_type sz = shrunk_bucket_count();
+    if (sz < bucket_count()) {
+      sparse_hashtable tmp(MoveDontCopy, *this, sz);
+      swap(tmp);                            // now we are tmp
+      retval = true;
+    }
+    settings.set_consider_shrink(false);   // because we just considered it
+    return retval;
+  }
+
+  // The bucket count we shrink to, or ours if we are not below the
+  // shrink threshold.
+  size_type shrunk_bucket_count() const {
     // If you construct a hashtable with < HT_DEFAULT_STARTING_BUCKETS,
     // we'll never shrink until you get relatively big, and we'll never
     // shrink below HT_DEFAULT_STARTING_BUCKETS.  Otherwise, something
@@ -596,12 +694,9 @@ class sparse_hashtable {
              num_remain < static_cast<size_type>(sz * shrink_factor)) {
         sz /= 2;                            // stay a power of 2
       }
-      sparse_hashtable tmp(MoveDontCopy, *this, sz);
-      swap(tmp);                            // now we are tmp
-      retval = true;
+      return sz;
     }
-    settings.set_consider_shrink(false);   // because we just considered it
-    return retval;
+    return bucket_count();
   }
 
   // We'll let you resize a hashtable -- though this makes us copy all!
@@ -673,6 +768,13 @@ class sparse_hashtable {
     // We could use insert() here, but since we know there are
     // no duplicates and no deleted items, we can be more efficient
     assert((bucket_count() & (bucket_count()-1)) == 0);      // a power of two
+    if ( parallel_rehash_pays() ) {
+      parallel_insert(ht.bucket_count(), [&ht](size_type i) {
+        return ht.live_value(ht.table, ht.num_deleted, i);
+      }, false);
+      settings.inc_num_ht_copies();
+      return;
+    }
     for ( const_iterator it = ht.begin(); it != ht.end(); ++it ) {
       size_type num_probes = 0;              // how many times we've probed
       size_type bucknum;
@@ -711,7 +813,15 @@ class sparse_hashtable {
     // We could use insert() here, but since we know there are
     // no duplicates and no deleted items, we can be more efficient
     assert( (bucket_count() & (bucket_count()-1)) == 0);      // a power of two
+    if ( parallel_rehash_pays() ) {          // ht goes away once we are done
+      parallel_insert(ht.bucket_count(), [&ht](size_type i) {
+        return ht.live_value(ht.table, ht.num_deleted, i);
+      }, false);
+      settings.inc_num_ht_copies();
+      return;
+    }
     // THIS IS THE MAJOR LINE THAT DIFFERS FROM COPY_FROM():
+    table.borrow_slabs(ht.table);            // a no-op without an arena
     for ( destructive_iterator it = ht.destructive_begin();
           it != ht.destructive_end(); ++it ) {
       size_type num_probes = 0;              // how many times we've probed
@@ -725,6 +835,104 @@ class sparse_hashtable {
       }
       table.set(bucknum, *it);               // copies the value to here
     }
+    table.take_slabs();
+    settings.inc_num_ht_copies();
+  }
+
+  // PARALLEL REHASH, see sparsehash_internal::parallel_rehash.
+  bool parallel_rehash_pays() const {
+    return num_resize_threads > 1 &&
+        bucket_count() >= parallel_rehash_type::MIN_BUCKETS;
+  }
+
+  // The value in bucket i of t, or NULL if the bucket is empty or, when
+  // t has deleted > 0 deleted buckets, deleted.
+  template <class T>                       // T is Table, declared below
+  const_pointer live_value(const T& t, size_type deleted, size_type i) const {
+    if ( !t.test(i) ) return NULL;
+    const_reference v = t.unsafe_get(i);
+    if ( deleted > 0 && equals(key_info.delkey, get_key(v)) )
+      return NULL;
+    return &v;
+  }
+
+  // Inserts source(i), unless it is NULL, for i in [0, n) on
+  // num_resize_threads threads.  Unless check_dups is set, the values
+  // are known not to be in the table and to be different from each
+  // other.  The table has no values but room for all of them.  Each
+  // thread marks the buckets it takes in the groups of its regions, the
+  // groups are allocated on this thread, then each thread copies its
+  // values in.
+  template <class Source>
+  void parallel_insert(size_type n, const Source& source, bool check_dups) {
+    typedef typename parallel_rehash_type::entry entry;
+    assert(table.num_nonempty() == 0 && num_deleted == 0);
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    parallel_rehash_type rehash(num_resize_threads, bucket_count(),
+                                DEFAULT_GROUP_SIZE);
+    rehash.scatter(n, [&](size_type i, entry* e) {
+      e->second = source(i);
+      if ( e->second == NULL ) return false;
+      e->first = hash(get_key(*e->second)) & bucket_count_minus_one;
+      return true;
+    });
+    // What each thread put in the buckets of its current region.
+    std::vector<std::vector<const_pointer> > taken(rehash.threads());
+    std::vector<size_type> region(rehash.threads(), ILLEGAL_BUCKET);
+    rehash.place([&](size_t t, entry* e, size_type begin, size_type end) {
+      std::vector<const_pointer>& slots = taken[t];
+      if ( region[t] != begin ) {
+        slots.assign(end - begin, NULL);
+        region[t] = begin;
+      }
+      size_type num_probes = 0;
+      size_type bucknum = e->first;
+      while ( slots[bucknum - begin] != NULL ) {
+        if ( check_dups &&
+             equals(get_key(*e->second), get_key(*slots[bucknum - begin])) ) {
+          e->second = NULL;                  // we have it already
+          return true;
+        }
+        ++num_probes;
+        bucknum = (bucknum + JUMP_(key, num_probes)) & bucket_count_minus_one;
+        if ( bucknum < begin || bucknum >= end )
+          return false;                      // another thread's buckets
+      }
+      slots[bucknum - begin] = e->second;
+      table.mark(bucknum);
+      e->first = bucknum;
+      return true;
+    });
+    taken.clear();
+    table.allocate_marked();
+    rehash.visit([&](const entry& e) {
+      table.construct_marked(e.first, *e.second);
+    });
+    rehash.insert_deferred([&](const entry& e) {
+      const std::pair<size_type,size_type> pos =
+          find_position(get_key(*e.second));
+      if ( pos.first == ILLEGAL_BUCKET )
+        table.set(pos.second, *e.second);
+    });
+  }
+
+  // Rehashes our values and the range [f, f + dist) into a new table on
+  // num_resize_threads threads.
+  template <class RandomAccessIterator>
+  void parallel_insert_range(RandomAccessIterator f, size_type dist) {
+    drop_compaction();
+    const size_type resize_to =
+        settings.min_buckets(size() + dist, bucket_count());
+    Table src(0, get_allocator());
+    src.swap(table);
+    const size_type src_num_deleted = num_deleted;
+    num_deleted = 0;
+    table.resize(resize_to);
+    settings.reset_thresholds(bucket_count());
+    parallel_insert(src.size() + dist, [&](size_type i) -> const_pointer {
+      if ( i >= src.size() ) return &*(f + (i - src.size()));
+      return live_value(src, src_num_deleted, i);
+    }, true);
     settings.inc_num_ht_copies();
   }
 
@@ -754,10 +962,110 @@ class sparse_hashtable {
     settings.reset_thresholds(bucket_count());
   }
 
+  // Rehashing, when the table grows or is copied, and inserting a range
+  // at least as big as the table use n threads; 1, the default, keeps
+  // to the calling thread.
+  void set_resize_threads(size_type n) {
+    num_resize_threads = n > 0 ? n : 1;
+  }
+  size_type resize_threads() const { return num_resize_threads; }
+
+  // How many keys ahead find_batch(), count_batch() and insert_batch()
+  // prefetch, 16 by default, at most 64.
+  void set_batch_depth(size_type n) {
+    batch_prefetch_depth = n < 1 ? 1
+        : n > sparsehash_internal::MAX_BATCH_DEPTH
+        ? sparsehash_internal::MAX_BATCH_DEPTH : n;
+  }
+  size_type batch_depth() const { return batch_prefetch_depth; }
+
+  // Compaction, see the top of this file.  Each round builds a slice of
+  // the groups of the new table, copies a slice of our buckets to it,
+  // and the new table takes over once all are copied, or frees a slice
+  // of the groups of the table it took over from, until budget is spent;
+  // at least one round is done.  Returns true once there are no deleted
+  // buckets, nothing to shrink and nothing left to free.
+  bool compact(std::chrono::nanoseconds budget) {
+    const std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + budget;
+    do {
+      if ( retired_table ) {
+        retired_table->drop_last_groups(HT_COMPACT_STEP);
+        if ( retired_table->size() == 0 )
+          drop_retired_table();
+        continue;
+      }
+      const size_type target = shrunk_bucket_count();
+      if ( !compact_table ) {
+        if ( num_deleted == 0 && target == bucket_count() )
+          return true;
+        compact_table = new Table(0, get_allocator());
+        compact_pos = 0;
+      }
+      if ( compact_table->size() < target ) {
+        compact_table->grow_groups(target, HT_COMPACT_STEP);
+        continue;
+      }
+      const size_type bucket_count_minus_one = compact_table->size() - 1;
+      const size_type end = bucket_count() - compact_pos < HT_COMPACT_STEP
+          ? bucket_count() : compact_pos + HT_COMPACT_STEP;
+      for ( ; compact_pos < end; ++compact_pos ) {
+        const_pointer v = live_value(table, num_deleted, compact_pos);
+        if ( v == NULL ) continue;
+        size_type num_probes = 0;            // how many times we've probed
+        size_type bucknum;
+        for ( bucknum = hash(get_key(*v)) & bucket_count_minus_one;
+              compact_table->test(bucknum);           // not empty
+              bucknum = (bucknum + JUMP_(key, num_probes)) &
+                        bucket_count_minus_one ) {
+          ++num_probes;
+        }
+        compact_table->set(bucknum, *v);
+      }
+      if ( compact_pos == bucket_count() ) {  // the new table takes over
+        table.swap(*compact_table);
+        retired_table = compact_table;
+        compact_table = NULL;
+        compact_pos = 0;
+        num_deleted = 0;
+        settings.reset_thresholds(bucket_count());
+        settings.inc_num_ht_copies();
+      }
+    } while ( std::chrono::steady_clock::now() < deadline );
+    return !compact_table && !retired_table && num_deleted == 0 &&
+        shrunk_bucket_count() == bucket_count();
+  }
+
+  // The share of the buckets that compact() would get rid of: those a
+  // shrink would drop, what is left of the table a compaction took over
+  // from, and the deleted buckets, in proportion to the buckets kept
+  // since those in the part dropped go anyway.
+  float debris_ratio() const {
+    const float held = static_cast<float>(
+        bucket_count() + (retired_table ? retired_table->size() : 0));
+    const float kept = static_cast<float>(shrunk_bucket_count());
+    return (held - kept + num_deleted * kept / held) / held;
+  }
+
+ private:
+  // Any change voids the copy compact() is making.
+  void drop_compaction() {
+    delete compact_table;
+    compact_table = NULL;
+    compact_pos = 0;
+  }
+
+  void drop_retired_table() {
+    delete retired_table;
+    retired_table = NULL;
+  }
+
+ public:
   // CONSTRUCTORS -- as required by the specs, we take a size,
   // but also let you specify a hashfunction, key comparator,
   // and key extractor.  We also define a copy constructor and =.
-  // DESTRUCTOR -- the default is fine, surprisingly.
+  // DESTRUCTOR -- frees the copy of a compaction under way, and what is
+  // left of the table one took over from.
   explicit sparse_hashtable(size_type expected_max_items_in_table = 0,
                             const HashFcn& hf = HashFcn(),
                             const EqualKey& eql = EqualKey(),
@@ -767,10 +1075,15 @@ class sparse_hashtable {
       : settings(hf),
         key_info(ext, set, eql),
         num_deleted(0),
+        num_resize_threads(1),
+        batch_prefetch_depth(sparsehash_internal::DEFAULT_BATCH_DEPTH),
         table((expected_max_items_in_table == 0
                ? HT_DEFAULT_STARTING_BUCKETS
                : settings.min_buckets(expected_max_items_in_table, 0)),
-              alloc) {
+              alloc),
+        compact_table(NULL),
+        compact_pos(0),
+        retired_table(NULL) {
     settings.reset_thresholds(bucket_count());
   }
 
@@ -783,7 +1096,11 @@ class sparse_hashtable {
       : settings(ht.settings),
         key_info(ht.key_info),
         num_deleted(0),
-        table(0, ht.get_allocator()) {
+        num_resize_threads(ht.num_resize_threads),
+        table(0, ht.get_allocator()),
+        compact_table(NULL),
+        compact_pos(0),
+        retired_table(NULL) {
     settings.reset_thresholds(bucket_count());
     copy_from(ht, min_buckets_wanted);   // copy_from() ignores deleted entries
   }
@@ -792,16 +1109,27 @@ class sparse_hashtable {
       : settings(ht.settings),
         key_info(ht.key_info),
         num_deleted(0),
-        table(0, ht.get_allocator()) {
+        num_resize_threads(ht.num_resize_threads),
+        table(0, ht.get_allocator()),
+        compact_table(NULL),
+        compact_pos(0),
+        retired_table(NULL) {
     settings.reset_thresholds(bucket_count());
     move_from(mover, ht, min_buckets_wanted);  // ignores deleted entries
   }
 
+  ~sparse_hashtable() {
+    drop_compaction();
+    drop_retired_table();
+  }
+
   sparse_hashtable& operator= (const sparse_hashtable& ht) {
     if (&ht == this)  return *this;        // don't copy onto ourselves
     settings = ht.settings;
     key_info = ht.key_info;
     num_deleted = ht.num_deleted;
+    num_resize_threads = ht.num_resize_threads;
+    batch_prefetch_depth = ht.batch_prefetch_depth;
     // copy_from() calls clear and sets num_deleted to 0 too
     copy_from(ht, HT_MIN_BUCKETS);
     // we purposefully don't copy the allocator, which may not be copyable
@@ -813,7 +1141,12 @@ class sparse_hashtable {
     std::swap(settings, ht.settings);
     std::swap(key_info, ht.key_info);
     std::swap(num_deleted, ht.num_deleted);
+    std::swap(num_resize_threads, ht.num_resize_threads);
+    std::swap(batch_prefetch_depth, ht.batch_prefetch_depth);
     table.swap(ht.table);
+    std::swap(compact_table, ht.compact_table);
+    std::swap(compact_pos, ht.compact_pos);
+    std::swap(retired_table, ht.retired_table);
     settings.reset_thresholds(bucket_count());  // also resets consider_shrink
     ht.settings.reset_thresholds(ht.bucket_count());
     // we purposefully don't swap the allocator, which may not be swap-able
@@ -821,6 +1154,7 @@ class sparse_hashtable {
 
   // It's always nice to be able to clear a table without deallocating it
   void clear() {
+    drop_compaction();
     if (!empty() || (num_deleted != 0)) {
       table.clear();
     }
@@ -836,9 +1170,15 @@ class sparse_hashtable {
   // Note: because of deletions where-to-insert is not trivial: it's the
   // first deleted bucket we see, as long as we don't find the key later
   std::pair<size_type, size_type> find_position(const key_type &key) const {
+    return find_position(key, hash(key));
+  }
+
+  // Likewise, for a key whose hash is known already.
+  std::pair<size_type, size_type> find_position(const key_type &key,
+                                                size_type key_hash) const {
     size_type num_probes = 0;              // how many times we've probed
     const size_type bucket_count_minus_one = bucket_count() - 1;
-    size_type bucknum = hash(key) & bucket_count_minus_one;
+    size_type bucknum = key_hash & bucket_count_minus_one;
     size_type insert_pos = ILLEGAL_BUCKET; // where we would insert
     SPARSEHASH_STAT_UPDATE(total_lookups += 1);
     while ( 1 ) {                          // probe until something happens
@@ -867,6 +1207,7 @@ class sparse_hashtable {
  public:
 
   iterator find(const key_type& key) {
+    drop_compaction();
     if ( size() == 0 ) return end();
     std::pair<size_type, size_type> pos = find_position(key);
     if ( pos.first == ILLEGAL_BUCKET )     // alas, not there
@@ -919,6 +1260,68 @@ class sparse_hashtable {
     }
   }
 
+  // Batched lookups of n keys: out[i] receives find(keys[i]) or
+  // count(keys[i]).  See set_batch_depth().
+  void find_batch(const key_type* keys, size_type n, iterator* out) {
+    drop_compaction();
+    if ( size() == 0 ) {
+      std::fill(out, out + n, end());
+      return;
+    }
+    sparsehash_internal::prefetch_pipeline(
+        n, batch_prefetch_depth,
+        [&](size_type i) { return hash(keys[i]); },
+        [&](size_type h) { prefetch_group(h); },
+        [&](size_type h) { prefetch_value(h); },
+        [&](size_type i, size_type h) {
+          const std::pair<size_type, size_type> pos = find_position(keys[i], h);
+          out[i] = pos.first == ILLEGAL_BUCKET ? end()
+              : iterator(this, table.get_iter(pos.first), table.nonempty_end());
+        });
+  }
+
+  void find_batch(const key_type* keys, size_type n,
+                  const_iterator* out) const {
+    if ( size() == 0 ) {
+      std::fill(out, out + n, end());
+      return;
+    }
+    sparsehash_internal::prefetch_pipeline(
+        n, batch_prefetch_depth,
+        [&](size_type i) { return hash(keys[i]); },
+        [&](size_type h) { prefetch_group(h); },
+        [&](size_type h) { prefetch_value(h); },
+        [&](size_type i, size_type h) {
+          const std::pair<size_type, size_type> pos = find_position(keys[i], h);
+          out[i] = pos.first == ILLEGAL_BUCKET ? end()
+              : const_iterator(this, table.get_iter(pos.first),
+                               table.nonempty_end());
+        });
+  }
+
+  void count_batch(const key_type* keys, size_type n, size_type* out) const {
+    sparsehash_internal::prefetch_pipeline(
+        n, batch_prefetch_depth,
+        [&](size_type i) { return hash(keys[i]); },
+        [&](size_type h) { prefetch_group(h); },
+        [&](size_type h) { prefetch_value(h); },
+        [&](size_type i, size_type h) {
+          out[i] = find_position(keys[i], h).first == ILLEGAL_BUCKET ? 0 : 1;
+        });
+  }
+
+ private:
+  void prefetch_group(size_type key_hash) const {
+    sparsehash_internal::prefetch(
+        table.group_address(key_hash & (bucket_count() - 1)));
+  }
+  void prefetch_value(size_type key_hash) const {
+    sparsehash_internal::prefetch(
+        table.value_address(key_hash & (bucket_count() - 1)));
+  }
+
+ public:
+
 
   // INSERTION ROUTINES
  private:
@@ -938,10 +1341,17 @@ class sparse_hashtable {
 
   // If you know *this is big enough to hold obj, use this routine
   std::pair<iterator, bool> insert_noresize(const_reference obj) {
+    return insert_noresize(obj, hash(get_key(obj)));
+  }
+
+  std::pair<iterator, bool> insert_noresize(const_reference obj,
+                                            size_type obj_hash) {
+    drop_compaction();
     // First, double-check we're not inserting delkey
     assert((!settings.use_deleted() || !equals(get_key(obj), key_info.delkey))
            && "Inserting the deleted key");
-    const std::pair<size_type,size_type> pos = find_position(get_key(obj));
+    const std::pair<size_type,size_type> pos = find_position(get_key(obj),
+                                                             obj_hash);
     if ( pos.first != ILLEGAL_BUCKET) {      // object was already there
       return std::pair<iterator,bool>(iterator(this, table.get_iter(pos.first),
                                                table.nonempty_end()),
@@ -952,6 +1362,36 @@ class sparse_hashtable {
   }
 
   // Specializations of insert(it, it) depending on the power of the iterator:
+  // (0) Random access to values of our type, the range may be rehashed
+  //     along with the table on several threads
+  template <class RandomAccessIterator>
+  void insert(RandomAccessIterator f, RandomAccessIterator l,
+              std::random_access_iterator_tag) {
+    insert(f, l, typename base::is_same<value_type,
+               typename std::iterator_traits<RandomAccessIterator>::value_type
+           >::type());
+  }
+
+  template <class RandomAccessIterator>
+  void insert(RandomAccessIterator f, RandomAccessIterator l,
+              base::true_type) {
+    const size_t dist = l - f;
+    if ( num_resize_threads > 1 && dist >= size() &&
+         dist < (std::numeric_limits<size_type>::max)() - size() &&
+         settings.min_buckets(size() + dist, bucket_count()) >=
+         parallel_rehash_type::MIN_BUCKETS ) {
+      parallel_insert_range(f, static_cast<size_type>(dist));
+    } else {
+      insert(f, l, std::forward_iterator_tag());
+    }
+  }
+
+  template <class RandomAccessIterator>
+  void insert(RandomAccessIterator f, RandomAccessIterator l,
+              base::false_type) {
+    insert(f, l, std::forward_iterator_tag());
+  }
+
   // (1) Iterator supports operator-, resize before inserting
   template <class ForwardIterator>
   void insert(ForwardIterator f, ForwardIterator l, std::forward_iterator_tag) {
@@ -987,6 +1427,22 @@ class sparse_hashtable {
            typename std::iterator_traits<InputIterator>::iterator_category());
   }
 
+  // Inserts n values like insert(f, f + n), resizing once for all of
+  // them first.  Unless inserted is NULL, inserted[i] tells whether
+  // objs[i] went in or was there already.  See set_batch_depth().
+  void insert_batch(const value_type* objs, size_type n, bool* inserted) {
+    resize_delta(n);
+    sparsehash_internal::prefetch_pipeline(
+        n, batch_prefetch_depth,
+        [&](size_type i) { return hash(get_key(objs[i])); },
+        [&](size_type h) { prefetch_group(h); },
+        [&](size_type h) { prefetch_value(h); },
+        [&](size_type i, size_type h) {
+          const bool b = insert_noresize(objs[i], h).second;
+          if ( inserted ) inserted[i] = b;
+        });
+  }
+
   // DefaultValue is a functor that takes a key and returns a value_type
   // representing the default value to be inserted if none is found.
   template <class DefaultValue>
@@ -994,6 +1450,7 @@ class sparse_hashtable {
     // First, double-check we're not inserting delkey
     assert((!settings.use_deleted() || !equals(key, key_info.delkey))
            && "Inserting the deleted key");
+    drop_compaction();
     const std::pair<size_type,size_type> pos = find_position(key);
     DefaultValue default_value;
     if ( pos.first != ILLEGAL_BUCKET) {  // object was already there
@@ -1110,6 +1567,7 @@ class sparse_hashtable {
 
   template <typename INPUT>
   bool read_metadata(INPUT *fp) {
+    drop_compaction();
     num_deleted = 0;            // since we got rid before writing
     const bool result = table.read_metadata(fp);
     settings.reset_thresholds(bucket_count());
@@ -1146,6 +1604,7 @@ class sparse_hashtable {
   // ValueSerializer: a functor.  operator()(INPUT*, value_type*)
   template <typename ValueSerializer, typename INPUT>
   bool unserialize(ValueSerializer serializer, INPUT *fp) {
+    drop_compaction();
     num_deleted = 0;            // since we got rid before writing
     const bool result = table.unserialize(serializer, fp);
     settings.reset_thresholds(bucket_count());
@@ -1155,6 +1614,8 @@ class sparse_hashtable {
  private:
   // Table is the main storage class.
   typedef sparsetable<value_type, DEFAULT_GROUP_SIZE, value_alloc_type> Table;
+  typedef sparsehash_internal::parallel_rehash<size_type, const_pointer>
+      parallel_rehash_type;
 
   // Package templated functors with the other types to eliminate memory
   // needed for storing these zero-size operators.  Since ExtractKey and
@@ -1213,7 +1674,12 @@ class sparse_hashtable {
   Settings settings;
   KeyInfo key_info;
   size_type num_deleted;   // how many occupied buckets are marked deleted
+  size_type num_resize_threads;   // threads to rehash on, 1 by default
+  size_type batch_prefetch_depth; // keys the batched calls prefetch ahead
   Table table;     // holds num_buckets and num_elements too
+  Table* compact_table;    // what compact() copies to, or NULL
+  size_type compact_pos;   // the buckets before it are copied
+  Table* retired_table;    // what compact() took over from, or NULL
 };
 
 
@@ -56,6 +56,7 @@
 #include <new>                              // for placement new
 #include <stdexcept>                        // For length_error
 #include <utility>                          // for pair<>
+#include <vector>                           // for probe_stats()
 #include <cstdio>
 #include <iosfwd>
 #include <ios>
@@ -2045,6 +2046,24 @@ public:
         }
     }
 
+    // + 1 for end marker in both sizes
+    group_type *_realloc_group_array(group_size_type sz, group_size_type old_sz, spp_::true_type)
+    {
+        group_type *first = _group_alloc.reallocate(_first_group, sz, old_sz);
+        if (first == NULL)
+        {
+            fprintf(stderr, "sparsehash FATAL ERROR: failed to reallocate %lu groups\n",
+                    static_cast<unsigned long>(sz));
+            exit(1);
+        }
+        return first;
+    }
+
+    group_type *_realloc_group_array(group_size_type, group_size_type, spp_::false_type)
+    {
+        return _first_group;       // not called
+    }
+
     void _free_group_array(group_type *&first, group_type *&last)
     {
         if (first)
@@ -2203,7 +2222,21 @@ public:
         group_size_type sz = num_groups(new_size);
         group_size_type old_sz = (group_size_type)(_last_group - _first_group);
 
-        if (sz != old_sz)
+        if (sz != old_sz && old_sz && sz &&
+            spp_::has_in_place_reallocate<group_alloc_type>::value)
+        {
+            // resize group array in place, the groups are relocatable
+            // --------------------------------------------------------
+            for (group_type *g = _first_group + sz; g < _last_group; ++g)
+                g->destruct(_alloc);
+            _first_group = _realloc_group_array(sz + 1, old_sz + 1,
+                spp_::integral_constant<bool, spp_::has_in_place_reallocate<group_alloc_type>::value>());
+            _last_group = _first_group + sz;
+            if (sz > old_sz)
+                std::uninitialized_fill(_first_group + old_sz, _last_group, group_type());
+            _last_group->mark();                   // for the ne_iterator
+        }
+        else if (sz != old_sz)
         {
             // resize group array
             // ------------------
@@ -2211,7 +2244,9 @@ public:
             if (sz)
             {
                 _alloc_group_array(sz, first, last);
-                memcpy(first, _first_group, sizeof(*first) * (std::min)(sz, old_sz));
+                // groups are relocatable even though they are not trivially
+                // copyable, the void * cast says the byte copy is meant
+                memcpy(static_cast<void *>(first), _first_group, sizeof(*first) * (std::min)(sz, old_sz));
             }
 
             if (sz < old_sz)
@@ -2740,6 +2775,90 @@ public:
     // Accessor function for statistics gathering.
     unsigned int num_table_copies() const { return settings.num_ht_copies(); }
 
+    // Probe lengths in buckets looked at by find(): for a hit, over all
+    // elements, and for a miss, over all home buckets.  A cluster is a run
+    // of non-empty buckets, erased ones included.  home_variance is the
+    // variance of the number of elements per home bucket.
+    // ---------------------------------------------------------------------
+    struct probe_statistics
+    {
+        double    hit_mean;
+        double    hit_variance;
+        size_type hit_max;
+        double    miss_mean;
+        double    miss_variance;
+        size_type miss_max;
+        double    cluster_mean;
+        size_type cluster_max;
+        double    home_variance;
+    };
+
+    // Walks the whole table, so this is meant for diagnostics only.
+    // -------------------------------------------------------------
+    probe_statistics probe_stats() const
+    {
+        probe_statistics stats = probe_statistics();
+        const size_type num_buckets = bucket_count();
+        if (num_buckets == 0)
+            return stats;
+        const size_type mask = num_buckets - 1;
+        std::vector<unsigned> homes(num_buckets);
+        double hit_sum = 0, hit_squares = 0, miss_sum = 0, miss_squares = 0;
+        double cluster_sum = 0;
+        size_type clusters = 0, run = 0;
+        for (size_type bucknum = 0; bucknum <= num_buckets; ++bucknum)
+        {
+            if (bucknum < num_buckets && table.test_strict(bucknum))
+            {
+                ++run;
+            }
+            else if (run > 0)
+            {
+                ++clusters;
+                cluster_sum += run;
+                stats.cluster_max = (std::max)(stats.cluster_max, run);
+                run = 0;
+            }
+            if (bucknum == num_buckets)
+                break;
+
+            if (table.test(bucknum))
+            {
+                const size_type home = hash(get_key(table.unsafe_get(bucknum))) & mask;
+                size_type num_probes = 0;
+                for (size_type probe = home; probe != bucknum; )
+                    probe = (probe + JUMP_(key, ++num_probes)) & mask;
+                ++homes[home];
+                hit_sum += num_probes + 1;
+                hit_squares += (num_probes + 1.0) * (num_probes + 1);
+                stats.hit_max = (std::max)(stats.hit_max, num_probes + 1);
+            }
+
+            size_type num_probes = 0;
+            for (size_type probe = bucknum; table.test_strict(probe); )
+                probe = (probe + JUMP_(key, ++num_probes)) & mask;
+            miss_sum += num_probes + 1;
+            miss_squares += (num_probes + 1.0) * (num_probes + 1);
+            stats.miss_max = (std::max)(stats.miss_max, num_probes + 1);
+        }
+        const size_type hits = size();
+        if (hits > 0)
+        {
+            stats.hit_mean = hit_sum / hits;
+            stats.hit_variance = hit_squares / hits - stats.hit_mean * stats.hit_mean;
+        }
+        stats.miss_mean = miss_sum / num_buckets;
+        stats.miss_variance = miss_squares / num_buckets - stats.miss_mean * stats.miss_mean;
+        if (clusters > 0)
+            stats.cluster_mean = cluster_sum / clusters;
+        double home_squares = 0;
+        for (size_type i = 0; i < num_buckets; ++i)
+            home_squares += static_cast<double>(homes[i]) * homes[i];
+        const double home_mean = static_cast<double>(hits) / num_buckets;
+        stats.home_variance = home_squares / num_buckets - home_mean * home_mean;
+        return stats;
+    }
+
 private:
     // This is used as a tag for the copy constructor, saying to destroy its
     // arg We have two ways of destructively copying: with potentially growing
@@ -3906,6 +4025,10 @@ public:
 
     size_type bucket_size(size_type i) const    { return rep.bucket_size(i); }
     size_type bucket(const key_type& key) const { return rep.bucket(key); }
+
+    // Probe length statistics, for diagnostics
+    typedef typename ht::probe_statistics probe_statistics;
+    probe_statistics probe_stats() const { return rep.probe_stats(); }
     float     load_factor() const       { return size() * 1.0f / bucket_count(); }
 
     float max_load_factor() const      { return rep.get_enlarge_factor(); }
@@ -4285,6 +4408,10 @@ public:
     size_type bucket_size(size_type i) const    { return rep.bucket_size(i); }
     size_type bucket(const key_type& key) const { return rep.bucket(key); }
 
+    // Probe length statistics, for diagnostics
+    typedef typename ht::probe_statistics probe_statistics;
+    probe_statistics probe_stats() const { return rep.probe_stats(); }
+
     float     load_factor() const       { return size() * 1.0f / bucket_count(); }
 
     float max_load_factor() const      { return rep.get_enlarge_factor(); }
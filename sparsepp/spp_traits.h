@@ -103,6 +103,21 @@ template <class T, class U> struct is_relocatable<std::pair<T, U> > :
      integral_constant<bool, (is_relocatable<T>::value && is_relocatable<U>::value)>
 { };
 
+//  ---------------- has_in_place_reallocate ------------------------------
+// Allocators such as google::mmap_allocator_with_realloc, whose
+// reallocate(p, new_n, old_n) grows a large block without copying it, say
+// so with a static const bool reallocates_in_place member.
+// ------------------------------------------------------------------------
+template <class A>
+struct has_in_place_reallocate
+{
+    template <bool B> struct answer { char c[1 + B]; };
+    template <class U> static answer<U::reallocates_in_place> test(int);
+    template <class U> static char test(...);
+
+    static const bool value = sizeof(test<A>(0)) == 2;
+};
+
 // A template helper used to select A or B based on a condition.
 // ------------------------------------------------------------
 template<bool cond, typename A, typename B>